@@ -0,0 +1,66 @@
+#include <algorithm>
+
+#include "aot.h"
+
+// Longest block chip8-aot emits, in bytes including its lookahead, so the
+// blocks a write can touch start at most this far before it
+const uint32_t MAX_AOT_BLOCK_BYTES = 2 * 64 + 4;
+
+Aot::Aot(const AotProgram& program)
+    : program {program}
+    , checked {false}
+    , native {0}
+{
+    entries.fill(nullptr);
+}
+
+// Enable the blocks starting in [start - MAX_AOT_BLOCK_BYTES, end) whose
+// code in memory still matches the ROM, and disable the rest
+void Aot::check(const Chip8& chip8, uint32_t start, uint32_t end) {
+    const std::vector<uint8_t>& memory = chip8.get_memory();
+    uint32_t first = start > MAX_AOT_BLOCK_BYTES ? start - MAX_AOT_BLOCK_BYTES : 0;
+    const AotBlock* blocks_end = program.blocks + program.block_count;
+    const AotBlock* block = std::lower_bound(program.blocks, blocks_end, first,
+        [](const AotBlock& block, uint32_t address) { return block.start < address; });
+
+    for (; block != blocks_end && block->start < end; block++) {
+        if (block->end <= start) continue;
+        bool same = block->end <= memory.size()
+                 && std::equal(program.rom + (block->start - 0x200),
+                               program.rom + (block->end - 0x200),
+                               memory.begin() + block->start);
+        entries[block->start] = same ? block : nullptr;
+    }
+}
+
+void Aot::discard_writes(Chip8& chip8) {
+    if (chip8.written_start == chip8.written_end) return;
+    check(chip8, chip8.written_start, chip8.written_end);
+    chip8.written_start = chip8.written_end = 0;
+}
+
+uint64_t Aot::run(Chip8& chip8, uint64_t cycles) {
+    if (chip8.is_xo_chip() != program.xo_chip || chip8.get_quirks() != program.quirks) {
+        return chip8.run(cycles);
+    }
+    if (!checked) {
+        check(chip8, 0, entries.size());
+        chip8.written_start = chip8.written_end = 0;
+        checked = true;
+    }
+
+    uint64_t executed = 0;
+    while (executed < cycles && chip8.is_running) {
+        discard_writes(chip8);
+        const AotBlock* block = chip8.pc < entries.size() ? entries[chip8.pc] : nullptr;
+        if (block != nullptr && block->count <= cycles - executed) {
+            block->run(chip8);
+            executed += block->count;
+            native += block->count;
+        } else {
+            chip8.cycle();
+            executed++;
+        }
+    }
+    return executed;
+}
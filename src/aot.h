@@ -0,0 +1,95 @@
+#ifndef AOT_H
+#define AOT_H
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "chip8.h"
+
+// One basic block translated ahead of time by chip8-aot: the code at
+// [start, end) as it was in the ROM, run as a function executing count
+// instructions
+struct AotBlock {
+    uint16_t start;
+    uint16_t end;
+    uint16_t count;
+    void (*run)(Chip8&);
+};
+
+// A ROM translated by chip8-aot into C++, with the machine settings the
+// translation assumes
+struct AotProgram {
+    const char* name;
+    bool xo_chip;
+    uint32_t quirks;
+    int instructions_per_frame;
+    const uint8_t* rom;         // Image loaded at 0x200
+    size_t rom_size;
+    const AotBlock* blocks;     // Sorted by start
+    size_t block_count;
+};
+
+// The program linked into a ROM-specific engine, defined by the generated
+// source
+extern const AotProgram AOT_PROGRAM;
+
+// Runs a machine on a program's precompiled blocks. A block is only
+// entered while the memory it was translated from is unchanged, so code
+// the ROM overwrites, BNNN targets and anything outside the discovered
+// blocks run on the interpreter instead. A machine with other quirks than
+// the program's is interpreted throughout.
+//
+// The static helpers are the generated code's access to the machine.
+class Aot {
+    private:
+        const AotProgram& program;
+        std::array<const AotBlock*, 4096> entries;  // Live block at each address
+        bool checked;
+        uint64_t native;
+
+        void check(const Chip8& chip8, uint32_t start, uint32_t end);
+        void discard_writes(Chip8& chip8);
+
+    public:
+        explicit Aot(const AotProgram& program);
+
+        // Execute up to the given number of instructions, stopping early
+        // only if the ROM exits, and return how many were executed. Blocks
+        // are entered whole, so one longer than what is left of the budget
+        // is interpreted instead.
+        uint64_t run(Chip8& chip8, uint64_t cycles);
+
+        // Instructions executed in precompiled blocks so far
+        uint64_t native_instructions() const { return native; }
+
+        static uint8_t* V(Chip8& chip8) { return chip8.V.data(); }
+        static uint16_t& I(Chip8& chip8) { return chip8.I; }
+        static uint16_t& pc(Chip8& chip8) { return chip8.pc; }
+        static uint8_t& delay_timer(Chip8& chip8) { return chip8.delay_timer; }
+        static uint8_t& sound_timer(Chip8& chip8) { return chip8.sound_timer; }
+        static uint8_t read(const Chip8& chip8, uint32_t address) {
+            return chip8.memory[address & chip8.address_mask];
+        }
+
+        // Execute the instruction at address on the interpreter
+        static void interpret(Chip8& chip8, uint16_t address) {
+            chip8.pc = address;
+            chip8.cycle();
+        }
+
+        // 2NNN at address and 00EE. They fail, leaving the machine as it
+        // was, when the stack is full or empty.
+        static bool call(Chip8& chip8, uint16_t address, uint16_t target) {
+            if (chip8.sp == chip8.stack.size()) return false;
+            chip8.stack[chip8.sp++] = address;
+            chip8.pc = target;
+            return true;
+        }
+        static bool ret(Chip8& chip8) {
+            if (chip8.sp == 0) return false;
+            chip8.pc = chip8.stack[--chip8.sp] + 2;
+            return true;
+        }
+};
+
+#endif // AOT_H
@@ -0,0 +1,373 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "chip8.h"
+#include "romdb.h"
+#include "romfile.h"
+#include "scheduler.h"
+
+// Longest block emitted, in instructions and in bytes (F000 NNNN takes
+// four); src/aot.cpp relies on the byte limit
+const int MAX_BLOCK_INSTRUCTIONS = 64;
+
+static void usage() {
+    std::cout << "Usage: chip8-aot [--platform chip8|chip48|schip|xochip] "
+                 "[--db ROM database] <ROM file> <output file>" << std::endl;
+}
+
+// The ROM as loaded, with the settings the code is translated for
+struct Image {
+    std::vector<uint8_t> memory;
+    uint32_t rom_end;       // First address past the ROM
+    uint32_t code_end;      // First address not translated
+    bool xo_chip;
+    uint32_t quirks;
+
+    uint16_t opcode(uint32_t address) const {
+        return memory[address] << 8 | memory[address + 1];
+    }
+};
+
+// One instruction as C++, and where execution may go after it
+struct Translation {
+    std::string code;
+    bool ends;                          // The block stops after it
+    uint32_t next;                      // Following instruction otherwise
+    uint32_t end;                       // First byte past what it reads
+    std::vector<uint32_t> successors;   // Addresses that start blocks
+};
+
+static std::string hex(uint32_t value, int digits = 3) {
+    char text[16];
+    std::snprintf(text, sizeof(text), "0x%0*X", digits, value);
+    return text;
+}
+
+static std::string reg(int number) {
+    return "V[" + hex(number, 1) + "]";
+}
+
+static Translation translate(const Image& image, uint32_t address) {
+    uint16_t opcode = image.opcode(address);
+    int x = opcode >> 8 & 0xF;
+    int y = opcode >> 4 & 0xF;
+    int n = opcode & 0xF;
+    int nn = opcode & 0xFF;
+    int nnn = opcode & 0xFFF;
+    bool vf_reset = image.quirks & QUIRK_VF_RESET;
+    bool shift = image.quirks & QUIRK_SHIFT;
+    int source = shift ? x : y;
+
+    Translation t {"", false, address + 2, address + 2, {}};
+    std::string vx = reg(x), vy = reg(y), vf = reg(0xF);
+    std::string interpret = "Aot::interpret(c, " + hex(address) + ");";
+
+    // Skip conditions: pc moves past the next instruction, four bytes on
+    // XO-CHIP if it is F000 NNNN, so that instruction is part of the block
+    std::string condition;
+    switch (opcode & 0xF000) {
+        case 0x3000: condition = vx + " == " + hex(nn, 2); break;
+        case 0x4000: condition = vx + " != " + hex(nn, 2); break;
+        case 0x5000: if (n == 0) condition = vx + " == " + vy; break;
+        case 0x9000: if (n == 0) condition = vx + " != " + vy; break;
+        case 0xE000:
+            if (nn == 0x9E) condition = "c.keys[" + vx + " & 0xF] != 0";
+            if (nn == 0xA1) condition = "c.keys[" + vx + " & 0xF] == 0";
+            break;
+    }
+    if (!condition.empty() && address + 4 <= image.rom_end) {
+        bool long_next = image.xo_chip && image.opcode(address + 2) == 0xF000;
+        uint32_t taken = address + (long_next ? 6 : 4);
+        t.code = "Aot::pc(c) = " + condition + " ? " + hex(taken) + " : " + hex(address + 2) + ";";
+        t.ends = true;
+        t.end = address + 4;
+        t.successors = {address + 2, taken};
+        return t;
+    }
+
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            if (opcode == 0x00EE) {
+                t.code = "if (!Aot::ret(c)) " + interpret;
+                t.ends = true;
+                return t;
+            }
+            if (opcode == 0x00FD) {
+                t.code = interpret;
+                t.ends = true;
+                return t;
+            }
+            break;
+        case 0x1000:
+            t.code = "Aot::pc(c) = " + hex(nnn) + ";";
+            t.ends = true;
+            t.successors = {uint32_t(nnn)};
+            return t;
+        case 0x2000:
+            t.code = "if (!Aot::call(c, " + hex(address) + ", " + hex(nnn) + ")) " + interpret;
+            t.ends = true;
+            t.successors = {uint32_t(nnn), address + 2};
+            return t;
+        case 0x6000:
+            t.code = vx + " = " + hex(nn, 2) + ";";
+            return t;
+        case 0x7000:
+            t.code = vx + " += " + hex(nn, 2) + ";";
+            return t;
+        case 0x8000: {
+            // The same statements in the same order as the interpreter, so
+            // X or Y being F behaves the same
+            std::string reset = vf_reset ? " " + vf + " = 0;" : "";
+            switch (n) {
+                case 0x0: t.code = vx + " = " + vy + ";"; return t;
+                case 0x1: t.code = vx + " |= " + vy + ";" + reset; return t;
+                case 0x2: t.code = vx + " &= " + vy + ";" + reset; return t;
+                case 0x3: t.code = vx + " ^= " + vy + ";" + reset; return t;
+                case 0x4:
+                    t.code = "{ bool carry = " + vy + " > 0xFF - " + vx + "; " + vx + " += " + vy
+                           + "; " + vf + " = carry; }";
+                    return t;
+                case 0x5:
+                    t.code = vf + " = " + vy + " > " + vx + " ? 0 : 1; " + vx + " -= " + vy + ";";
+                    return t;
+                case 0x6:
+                    t.code = vf + " = " + reg(source) + " & 0x1; " + vx + " = " + reg(source) + " >> 1;";
+                    return t;
+                case 0x7:
+                    t.code = vf + " = " + vx + " > " + vy + " ? 0 : 1; " + vx + " = " + vy + " - " + vx + ";";
+                    return t;
+                case 0xE:
+                    t.code = vf + " = " + reg(source) + " >> 7; " + vx + " = " + reg(source) + " << 1;";
+                    return t;
+            }
+            break;
+        }
+        case 0xA000:
+            t.code = "I = " + hex(nnn) + ";";
+            return t;
+
+        // The target depends on a register, so it is left to the
+        // interpreter and the block at the target, if any, found at run time
+        case 0xB000:
+            t.code = interpret;
+            t.ends = true;
+            return t;
+
+        case 0xF000:
+            switch (nn) {
+                case 0x07: t.code = vx + " = Aot::delay_timer(c);"; return t;
+                case 0x15: t.code = "Aot::delay_timer(c) = " + vx + ";"; return t;
+                case 0x18: t.code = "Aot::sound_timer(c) = " + vx + ";"; return t;
+                case 0x1E:
+                    t.code = image.quirks & QUIRK_INDEX_OVERFLOW
+                        ? vf + " = I + " + vx + " > 0xFFF ? 1 : 0; I += " + vx + ";"
+                        : "I += " + vx + ";";
+                    return t;
+                case 0x29: t.code = "I = " + vx + " * 5;"; return t;
+                case 0x30: t.code = "I = FONT_LARGE_ADDRESS + (" + vx + " & 0xF) * 10;"; return t;
+                case 0x65:
+                    for (int i = 0; i <= x; i++) {
+                        t.code += reg(i) + " = Aot::read(c, I + " + std::to_string(i) + "); ";
+                    }
+                    if (!(image.quirks & QUIRK_LOAD_STORE)) t.code += "I += " + std::to_string(x + 1) + ";";
+                    return t;
+            }
+            break;
+    }
+
+    // Everything else runs on the interpreter. Waiting for a key and
+    // stores, which may rewrite code, end the block; F000 NNNN is four
+    // bytes long.
+    t.code = interpret;
+    if ((opcode & 0xF0FF) == 0xF00A || (opcode & 0xF0FF) == 0xF055 || (opcode & 0xF0FF) == 0xF033
+        || (image.xo_chip && (opcode & 0xF00F) == 0x5002) || !condition.empty()) {
+        t.ends = true;
+        t.successors = {address + 2};
+        if (!condition.empty()) t.successors.push_back(address + 4);
+    } else if (image.xo_chip && opcode == 0xF000) {
+        t.next = t.end = address + 4;
+    }
+    return t;
+}
+
+struct Block {
+    uint32_t end;
+    int count;
+    std::string body;
+};
+
+static bool inside(const Image& image, uint32_t address, uint32_t size) {
+    return address >= 0x200 && address + size <= image.code_end;
+}
+
+// Follow jumps, calls, returns and skips from 0x200, cutting the code into
+// blocks that each end at a branch. Blocks may overlap where one falls
+// through into another's start.
+static std::map<uint32_t, Block> discover(const Image& image) {
+    std::map<uint32_t, Block> blocks;
+    std::vector<uint32_t> pending = {0x200};
+
+    while (!pending.empty()) {
+        uint32_t start = pending.back();
+        pending.pop_back();
+        if (blocks.count(start) || !inside(image, start, 2)) continue;
+
+        Block block {start, 0, ""};
+        uint32_t address = start;
+        for (;;) {
+            if (!inside(image, address, 2)) {
+                block.body += "    Aot::pc(c) = " + hex(address) + ";\n";
+                break;
+            }
+            Translation t = translate(image, address);
+            if (t.end > image.code_end) {
+                block.body += "    Aot::pc(c) = " + hex(address) + ";\n";
+                break;
+            }
+            char comment[32];
+            std::snprintf(comment, sizeof(comment), "    // %03X: %04X\n", address, image.opcode(address));
+            block.body += comment;
+            block.body += "    " + t.code + "\n";
+            block.count++;
+            block.end = std::max(block.end, t.end);
+            pending.insert(pending.end(), t.successors.begin(), t.successors.end());
+
+            if (t.ends) break;
+            address = t.next;
+            if (block.count == MAX_BLOCK_INSTRUCTIONS
+                || address - start >= 2 * MAX_BLOCK_INSTRUCTIONS) {
+                block.body += "    Aot::pc(c) = " + hex(address) + ";\n";
+                pending.push_back(address);
+                break;
+            }
+        }
+        if (block.count > 0) blocks[start] = block;
+    }
+    return blocks;
+}
+
+static bool uses_i(const std::string& body) {
+    for (size_t at = body.find('I'); at != std::string::npos; at = body.find('I', at + 1)) {
+        bool before = at > 0 && (std::isalnum(body[at - 1]) || body[at - 1] == '_');
+        bool after = at + 1 < body.size() && (std::isalnum(body[at + 1]) || body[at + 1] == '_');
+        if (!before && !after) return true;
+    }
+    return false;
+}
+
+static std::string quote(const std::string& text) {
+    std::string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+static void emit(std::ostream& out, const Image& image, const std::string& name,
+                 int instructions_per_frame, const std::map<uint32_t, Block>& blocks) {
+    out << "// Generated by chip8-aot from " << name << ". Do not edit.\n"
+        << "#include \"aot.h\"\n\n"
+        << "static const uint8_t ROM[] = {";
+    for (uint32_t i = 0x200; i < image.rom_end; i++) {
+        out << ((i - 0x200) % 16 == 0 ? "\n    " : " ") << hex(image.memory[i], 2) << ",";
+    }
+    out << "\n};\n";
+
+    for (const auto& entry : blocks) {
+        const Block& block = entry.second;
+        out << "\nstatic void block_" << std::hex << std::uppercase << entry.first << std::dec
+            << "(Chip8& c) {\n";
+        if (block.body.find("V[") != std::string::npos) out << "    uint8_t* V = Aot::V(c);\n";
+        if (uses_i(block.body)) out << "    uint16_t& I = Aot::I(c);\n";
+        out << block.body << "}\n";
+    }
+
+    out << "\nstatic const AotBlock BLOCKS[] = {\n";
+    for (const auto& entry : blocks) {
+        out << "    {" << hex(entry.first) << ", " << hex(entry.second.end) << ", "
+            << entry.second.count << ", block_" << std::hex << std::uppercase
+            << entry.first << std::dec << "},\n";
+    }
+    out << "};\n\n"
+        << "const AotProgram AOT_PROGRAM = {\n"
+        << "    " << quote(name) << ", " << (image.xo_chip ? "true" : "false") << ", "
+        << hex(image.quirks, 2) << ", " << instructions_per_frame << ",\n"
+        << "    ROM, sizeof(ROM), BLOCKS, sizeof(BLOCKS) / sizeof(BLOCKS[0])\n"
+        << "};\n";
+}
+
+int main(int argc, char** argv) {
+    const char* platform_arg = nullptr;
+    const char* database_path = nullptr;
+    std::vector<const char*> args;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--platform") == 0 && i + 1 < argc) {
+            platform_arg = argv[++i];
+        } else if (std::strcmp(argv[i], "--db") == 0 && i + 1 < argc) {
+            database_path = argv[++i];
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+
+    Platform platform = Platform::Chip8;
+    if (args.size() != 2 || (platform_arg && !parse_platform(platform_arg, platform))) {
+        usage();
+        return -1;
+    }
+
+    RomFile file;
+    if (!file.open(args[0], MAX_ROM_SIZE)) {
+        return -1;
+    }
+    RomDatabase database;
+    if (!database.load(database_path ? database_path : DEFAULT_ROM_DATABASE,
+                       database_path != nullptr)) {
+        return -1;
+    }
+
+    // The database's settings unless a platform is given, as in chip8
+    std::string name = args[0];
+    name = name.substr(name.find_last_of('/') + 1);
+    int instructions_per_frame = DEFAULT_INSTRUCTIONS_PER_FRAME;
+    const RomInfo* info = database.find(file.hash());
+    if (info != nullptr) {
+        name = info->name;
+        instructions_per_frame = info->instructions_per_frame;
+        if (platform_arg == nullptr) platform = info->platform;
+    }
+
+    Image image;
+    image.xo_chip = platform == Platform::XoChip;
+    image.quirks = info != nullptr && platform_arg == nullptr ? rom_quirks(*info) : platform_quirks(platform);
+    image.rom_end = 0x200 + file.size();
+    image.memory.assign(std::max<uint32_t>(image.rom_end, 4096), 0);
+    std::copy(file.data(), file.data() + file.size(), image.memory.begin() + 0x200);
+
+    // Like the JIT, only the first 4 KB is translated
+    image.code_end = std::min<uint32_t>(image.rom_end, 4096);
+
+    std::map<uint32_t, Block> blocks = discover(image);
+
+    std::ofstream out(args[1]);
+    emit(out, image, name, instructions_per_frame, blocks);
+    if (!out) {
+        std::cerr << "Error: Failed to write " << args[1] << std::endl;
+        return -1;
+    }
+
+    int instructions = 0;
+    for (const auto& entry : blocks) instructions += entry.second.count;
+    std::cout << name << ": " << blocks.size() << " blocks, " << instructions
+              << " instructions" << std::endl;
+    return 0;
+}
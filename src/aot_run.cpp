@@ -0,0 +1,74 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+
+#include "aot.h"
+#include "hash.h"
+
+// Scripted keypad input as in chip8-bench: every key in turn, held for 6
+// frames and then released for 4
+static uint16_t scripted_keys(uint64_t frame) {
+    int key = (frame / 10 * 7) % 16;
+    return frame % 10 < 6 ? 1 << key : 0;
+}
+
+static void usage() {
+    std::cout << "Usage: chip8-aot-run [frames] [instructions per frame]" << std::endl;
+}
+
+// Run the linked program's ROM on its precompiled blocks and on the
+// interpreter with the same seed and scripted input, checking that the
+// state matches after every frame, and compare their speed
+int main(int argc, char** argv) {
+    const AotProgram& program = AOT_PROGRAM;
+    int frames = argc > 1 ? std::atoi(argv[1]) : 3600;
+    int instructions_per_frame = argc > 2 ? std::atoi(argv[2]) : program.instructions_per_frame;
+    if (argc > 3 || frames <= 0 || instructions_per_frame <= 0) {
+        usage();
+        return -1;
+    }
+
+    auto aot_machine = std::make_unique<Chip8>(1, program.xo_chip, program.quirks);
+    auto interpreted = std::make_unique<Chip8>(1, program.xo_chip, program.quirks);
+    if (!aot_machine->load(program.rom, program.rom_size)
+        || !interpreted->load(program.rom, program.rom_size)) {
+        return -1;
+    }
+
+    Aot aot(program);
+    double aot_seconds = 0.0;
+    double interpreter_seconds = 0.0;
+    uint64_t cycles = 0;
+    int frame = 0;
+    for (; frame < frames && aot_machine->is_running; frame++) {
+        aot_machine->set_key_mask(scripted_keys(frame));
+        interpreted->set_key_mask(scripted_keys(frame));
+
+        auto start = std::chrono::steady_clock::now();
+        cycles += aot.run(*aot_machine, instructions_per_frame);
+        auto middle = std::chrono::steady_clock::now();
+        for (int i = 0; i < instructions_per_frame && interpreted->is_running; i++) {
+            interpreted->cycle();
+        }
+        auto end = std::chrono::steady_clock::now();
+        aot_seconds += std::chrono::duration<double>(middle - start).count();
+        interpreter_seconds += std::chrono::duration<double>(end - middle).count();
+
+        aot_machine->tick_timers();
+        interpreted->tick_timers();
+        if (!aot_machine->state_equals(*interpreted)) {
+            std::cerr << "Error: " << program.name << " diverged from the interpreter in frame "
+                      << frame << std::endl;
+            return 1;
+        }
+    }
+
+    const auto& memory = aot_machine->get_memory();
+    std::cout << program.name << ": " << frame << " frames, " << cycles << " instructions, "
+              << 100.0 * aot.native_instructions() / (cycles ? cycles : 1) << "% native\n"
+              << "aot:         " << cycles / aot_seconds / 1e6 << " M instructions/s\n"
+              << "interpreter: " << cycles / interpreter_seconds / 1e6 << " M instructions/s\n"
+              << "memory hash: " << std::hex << hash64(memory.data(), memory.size()) << std::endl;
+    return 0;
+}
@@ -0,0 +1,76 @@
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+
+#include "audio.h"
+
+const int16_t VOLUME = 4000;
+
+AudioFrame audio_frame(const Chip8& chip8) {
+    return {chip8.sound_on, chip8.audio_pattern, chip8.audio_pitch};
+}
+
+Tone::Tone()
+    : phase {0}
+{
+}
+
+void Tone::render(const AudioFrame& frame, int16_t* out, size_t count) {
+    // A new tone always starts at the beginning of its pattern
+    if (!frame.on) {
+        std::fill(out, out + count, 0);
+        phase = 0;
+        return;
+    }
+
+    double step = 4000 * std::pow(2.0, (frame.pitch - 64) / 48.0) / AUDIO_RATE;
+    for (size_t i = 0; i < count; i++) {
+        int bit = int(phase);
+        bool high = frame.pattern[bit >> 3] >> (7 - (bit & 7)) & 1;
+        out[i] = high ? VOLUME : -VOLUME;
+
+        phase += step;
+        if (phase >= 128) phase -= 128;
+    }
+}
+
+void WavSink::push(const AudioFrame& frame) {
+    samples.resize(samples.size() + SAMPLES_PER_FRAME);
+    tone.render(frame, &samples[samples.size() - SAMPLES_PER_FRAME],
+                SAMPLES_PER_FRAME);
+}
+
+static void put(std::ofstream& out, uint32_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        out.put(char(value >> (8 * i)));
+    }
+}
+
+bool WavSink::save(const char* filepath) const {
+    std::ofstream out(filepath, std::ofstream::binary);
+    uint32_t data_size = samples.size() * 2;
+
+    // RIFF header and a 16-bit mono PCM format chunk
+    out.write("RIFF", 4);
+    put(out, 36 + data_size, 4);
+    out.write("WAVEfmt ", 8);
+    put(out, 16, 4);
+    put(out, 1, 2);
+    put(out, 1, 2);
+    put(out, AUDIO_RATE, 4);
+    put(out, AUDIO_RATE * 2, 4);
+    put(out, 2, 2);
+    put(out, 16, 2);
+    out.write("data", 4);
+    put(out, data_size, 4);
+    for (int16_t sample : samples) {
+        put(out, uint16_t(sample), 2);
+    }
+
+    if (!out) {
+        std::cerr << "Error: Failed to write " << filepath << std::endl;
+        return false;
+    }
+    return true;
+}
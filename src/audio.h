@@ -0,0 +1,48 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "chip8.h"
+#include "spsc.h"
+
+const int AUDIO_RATE = 48000;
+const int SAMPLES_PER_FRAME = AUDIO_RATE / 60;
+
+// Buzzer state for one 60 Hz frame
+struct AudioFrame {
+    bool on;
+    std::array<uint8_t, 16> pattern;
+    uint8_t pitch;
+};
+
+// Frames from the emulation thread to the audio callback
+typedef SpscQueue<AudioFrame, 16> AudioQueue;
+
+AudioFrame audio_frame(const Chip8& chip8);
+
+// Turns frames into 16-bit mono samples, keeping the pattern's phase
+// across calls so a tone continues smoothly from frame to frame
+class Tone {
+    private:
+        double phase;   // Position in the pattern, in bits
+
+    public:
+        Tone();
+        void render(const AudioFrame& frame, int16_t* out, size_t count);
+};
+
+// Headless output: renders every frame into a 16-bit mono WAV file
+class WavSink {
+    private:
+        Tone tone;
+        std::vector<int16_t> samples;
+
+    public:
+        void push(const AudioFrame& frame);
+        bool save(const char* filepath) const;
+};
+
+#endif // AUDIO_H
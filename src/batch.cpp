@@ -0,0 +1,1087 @@
+#include <algorithm>
+
+#include "batch.h"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Lanes handled by one vector operation
+const size_t BLOCK = 32;
+
+// Smaller groups run each lane alone until its budget is spent
+const size_t MIN_GROUP = 10;
+
+// Lanes ahead whose machines are loaded while one runs alone
+const size_t PREFETCH_AHEAD = 2;
+
+// A lane that keeps ending up alone skips parking for 1, 3, 7... runs, up
+// to 2^MAX_MISSES - 1
+const uint8_t MAX_MISSES = 5;
+
+// 32 byte lanes: one AVX2 register, two SSE2 registers, or an array the
+// compiler is free to vectorize itself
+#if defined(__AVX2__)
+typedef __m256i Lanes;
+
+static inline Lanes load_lanes(const uint8_t* p) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+}
+static inline void store_lanes(uint8_t* p, Lanes a) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), a);
+}
+static inline Lanes splat(uint8_t value) { return _mm256_set1_epi8(char(value)); }
+static inline Lanes add(Lanes a, Lanes b) { return _mm256_add_epi8(a, b); }
+static inline Lanes sub(Lanes a, Lanes b) { return _mm256_sub_epi8(a, b); }
+static inline Lanes bit_and(Lanes a, Lanes b) { return _mm256_and_si256(a, b); }
+static inline Lanes bit_or(Lanes a, Lanes b) { return _mm256_or_si256(a, b); }
+static inline Lanes bit_xor(Lanes a, Lanes b) { return _mm256_xor_si256(a, b); }
+
+// There are no byte shifts; shift words and drop the bits that crossed
+static inline Lanes shr(Lanes a, int n) {
+    return bit_and(_mm256_srli_epi16(a, n), splat(0xFF >> n));
+}
+static inline Lanes shl1(Lanes a) { return _mm256_add_epi8(a, a); }
+
+// 1 where a > b (unsigned), else 0
+static inline Lanes greater(Lanes a, Lanes b) {
+    Lanes b_max = _mm256_cmpeq_epi8(_mm256_max_epu8(a, b), b);
+    return _mm256_andnot_si256(b_max, splat(1));
+}
+
+// 0xFF where a == b, else 0
+static inline Lanes equal(Lanes a, Lanes b) { return _mm256_cmpeq_epi8(a, b); }
+
+// Store a only into the lanes whose mask byte is 0xFF
+static inline void store_masked(uint8_t* p, Lanes a, const uint8_t* mask) {
+    store_lanes(p, _mm256_blendv_epi8(load_lanes(p), a, load_lanes(mask)));
+}
+
+// Bit i set where byte i is 0xFF
+static inline uint32_t lane_bits(Lanes a) {
+    return _mm256_movemask_epi8(a);
+}
+#elif defined(__SSE2__)
+struct Lanes {
+    __m128i low, high;
+};
+
+template <typename F>
+static inline Lanes map(Lanes a, Lanes b, F f) {
+    return {f(a.low, b.low), f(a.high, b.high)};
+}
+
+static inline Lanes load_lanes(const uint8_t* p) {
+    const __m128i* q = reinterpret_cast<const __m128i*>(p);
+    return {_mm_loadu_si128(q), _mm_loadu_si128(q + 1)};
+}
+static inline void store_lanes(uint8_t* p, Lanes a) {
+    __m128i* q = reinterpret_cast<__m128i*>(p);
+    _mm_storeu_si128(q, a.low);
+    _mm_storeu_si128(q + 1, a.high);
+}
+static inline Lanes splat(uint8_t value) {
+    __m128i v = _mm_set1_epi8(char(value));
+    return {v, v};
+}
+static inline Lanes add(Lanes a, Lanes b) { return map(a, b, _mm_add_epi8); }
+static inline Lanes sub(Lanes a, Lanes b) { return map(a, b, _mm_sub_epi8); }
+static inline Lanes bit_and(Lanes a, Lanes b) { return map(a, b, _mm_and_si128); }
+static inline Lanes bit_or(Lanes a, Lanes b) { return map(a, b, _mm_or_si128); }
+static inline Lanes bit_xor(Lanes a, Lanes b) { return map(a, b, _mm_xor_si128); }
+static inline Lanes equal(Lanes a, Lanes b) { return map(a, b, _mm_cmpeq_epi8); }
+
+static inline Lanes shr(Lanes a, int n) {
+    Lanes keep = splat(0xFF >> n);
+    return bit_and({_mm_srli_epi16(a.low, n), _mm_srli_epi16(a.high, n)}, keep);
+}
+static inline Lanes shl1(Lanes a) { return add(a, a); }
+
+static inline Lanes greater(Lanes a, Lanes b) {
+    Lanes b_max = map(a, b, [](__m128i x, __m128i y) {
+        return _mm_cmpeq_epi8(_mm_max_epu8(x, y), y);
+    });
+    return map(b_max, splat(1), _mm_andnot_si128);
+}
+
+// There is no byte blend before SSE4.1; merge through the mask instead
+static inline void store_masked(uint8_t* p, Lanes a, const uint8_t* mask) {
+    Lanes m = load_lanes(mask);
+    Lanes kept = map(m, load_lanes(p), _mm_andnot_si128);
+    store_lanes(p, bit_or(kept, bit_and(a, m)));
+}
+
+static inline uint32_t lane_bits(Lanes a) {
+    return _mm_movemask_epi8(a.low) | _mm_movemask_epi8(a.high) << 16;
+}
+#else
+struct Lanes {
+    uint8_t v[BLOCK];
+};
+
+template <typename F>
+static inline Lanes map(Lanes a, Lanes b, F f) {
+    Lanes out;
+    for (size_t i = 0; i < BLOCK; i++) out.v[i] = f(a.v[i], b.v[i]);
+    return out;
+}
+
+static inline Lanes load_lanes(const uint8_t* p) {
+    Lanes a;
+    for (size_t i = 0; i < BLOCK; i++) a.v[i] = p[i];
+    return a;
+}
+static inline void store_lanes(uint8_t* p, Lanes a) {
+    for (size_t i = 0; i < BLOCK; i++) p[i] = a.v[i];
+}
+static inline Lanes splat(uint8_t value) {
+    Lanes a;
+    for (size_t i = 0; i < BLOCK; i++) a.v[i] = value;
+    return a;
+}
+static inline Lanes add(Lanes a, Lanes b) { return map(a, b, [](uint8_t x, uint8_t y) { return uint8_t(x + y); }); }
+static inline Lanes sub(Lanes a, Lanes b) { return map(a, b, [](uint8_t x, uint8_t y) { return uint8_t(x - y); }); }
+static inline Lanes bit_and(Lanes a, Lanes b) { return map(a, b, [](uint8_t x, uint8_t y) { return uint8_t(x & y); }); }
+static inline Lanes bit_or(Lanes a, Lanes b) { return map(a, b, [](uint8_t x, uint8_t y) { return uint8_t(x | y); }); }
+static inline Lanes bit_xor(Lanes a, Lanes b) { return map(a, b, [](uint8_t x, uint8_t y) { return uint8_t(x ^ y); }); }
+static inline Lanes shr(Lanes a, int n) { return map(a, a, [n](uint8_t x, uint8_t) { return uint8_t(x >> n); }); }
+static inline Lanes shl1(Lanes a) { return add(a, a); }
+static inline Lanes greater(Lanes a, Lanes b) { return map(a, b, [](uint8_t x, uint8_t y) { return uint8_t(x > y); }); }
+static inline Lanes equal(Lanes a, Lanes b) { return map(a, b, [](uint8_t x, uint8_t y) { return uint8_t(-(x == y)); }); }
+static inline void store_masked(uint8_t* p, Lanes a, const uint8_t* mask) {
+    for (size_t i = 0; i < BLOCK; i++) p[i] = (p[i] & ~mask[i]) | (a.v[i] & mask[i]);
+}
+static inline uint32_t lane_bits(Lanes a) {
+    uint32_t bits = 0;
+    for (size_t i = 0; i < BLOCK; i++) bits |= uint32_t(a.v[i] & 1) << i;
+    return bits;
+}
+#endif
+
+// A pc no lanes are parked at
+const uint32_t NO_BUCKET = UINT32_MAX;
+
+Batch::Batch(const std::vector<uint64_t>& seeds, bool xo_chip, uint32_t quirks)
+    : stride {(seeds.size() + BLOCK - 1) / BLOCK * BLOCK}
+    , V(16 * stride, 0)
+    , I(stride, 0)
+    , pc(stride, 0)
+    , delay_timer(stride, 0)
+    , sound_timer(stride, 0)
+    , sound_on(stride, 0)
+    , remaining(stride, 0)
+    , running(stride, 0)
+    , detached(stride, 0)
+    , key_masks(stride, 0)
+    , group(stride, 0)
+    , first_lane {0}
+    , end_lane {0}
+    , leader {0}
+    , group_pc {0}
+    , pending {0}
+    , group_left {0}
+    , group_most {0}
+    , bucket_count {0}
+    , bucket_at(65536, NO_BUCKET)
+    , resting_count {0}
+    , rested(stride, 0)
+    , misses(stride, 0)
+    , sitting_out(stride, 0)
+    , vector_cycles {0}
+    , scalar_cycles {0}
+{
+    members.reserve(stride);
+    joined.reserve(stride);
+    buckets.reserve(seeds.size());
+    for (uint64_t seed : seeds) {
+        machines.push_back(std::make_unique<Chip8>(seed, xo_chip, quirks));
+    }
+    for (size_t lane = 0; lane < machines.size(); lane++) from_machine(lane);
+    written.assign(xo_chip ? 65536 : 4096, 0);
+}
+
+bool Batch::load(const uint8_t* data, size_t size) {
+    for (size_t lane = 0; lane < machines.size(); lane++) {
+        Chip8& chip8 = *machines[lane];
+        if (!chip8.load(data, size)) return false;
+
+        // Every lane now holds the same code
+        chip8.written_start = chip8.written_end = 0;
+        from_machine(lane);
+        running[lane] = 1;
+        detached[lane] = 0;
+        rested[lane] = 0;
+    }
+    resting_count = 0;
+    std::fill(written.begin(), written.end(), 0);
+    return true;
+}
+
+// Keys are mostly held for several frames; only changes reach the machine
+void Batch::set_key_mask(size_t lane, uint16_t mask) {
+    if (key_masks[lane] == mask) return;
+    key_masks[lane] = mask;
+    machines[lane]->set_key_mask(mask);
+}
+
+const Chip8& Batch::machine(size_t lane) {
+    if (detached[lane]) {
+        timers_to_machine(lane);
+    } else {
+        to_machine(lane);
+    }
+    return *machines[lane];
+}
+
+// The V registers an instruction may use when run through the interpreter:
+// V0 to VX for those that load and store from V0, all of them for ranges
+// between X and Y, and otherwise X, Y, V0 and VF
+static uint16_t registers_used(uint16_t opcode) {
+    uint8_t x = opcode >> 8 & 0xF;
+    uint8_t low = opcode & 0xFF;
+    if ((opcode & 0xF000) == 0x5000) return 0xFFFF;
+    if ((opcode & 0xF000) == 0xF000
+        && (low == 0x55 || low == 0x65 || low == 0x75 || low == 0x85)) {
+        return (2 << x) - 1;
+    }
+    return 1 << x | 1 << (opcode >> 4 & 0xF) | 1 << 0x0 | 1 << 0xF;
+}
+
+void Batch::to_machine(size_t lane, uint16_t registers) {
+    Chip8& chip8 = *machines[lane];
+    if (registers == 0xFFFF) {
+        for (int x = 0; x < 16; x++) chip8.V[x] = V[x * stride + lane];
+    } else {
+        for (uint32_t bits = registers; bits != 0; bits &= bits - 1) {
+            int x = __builtin_ctz(bits);
+            chip8.V[x] = V[x * stride + lane];
+        }
+    }
+    chip8.I = I[lane];
+    chip8.pc = pc[lane];
+    chip8.delay_timer = delay_timer[lane];
+    chip8.sound_timer = sound_timer[lane];
+    chip8.sound_on = sound_on[lane];
+}
+
+void Batch::from_machine(size_t lane, uint16_t registers) {
+    const Chip8& chip8 = *machines[lane];
+    if (registers == 0xFFFF) {
+        for (int x = 0; x < 16; x++) V[x * stride + lane] = chip8.V[x];
+    } else {
+        for (uint32_t bits = registers; bits != 0; bits &= bits - 1) {
+            int x = __builtin_ctz(bits);
+            V[x * stride + lane] = chip8.V[x];
+        }
+    }
+    I[lane] = chip8.I;
+    pc[lane] = chip8.pc;
+    delay_timer[lane] = chip8.delay_timer;
+    sound_timer[lane] = chip8.sound_timer;
+    sound_on[lane] = chip8.sound_on;
+}
+
+void Batch::timers_to_machine(size_t lane) {
+    Chip8& chip8 = *machines[lane];
+    chip8.delay_timer = delay_timer[lane];
+    chip8.sound_timer = sound_timer[lane];
+    chip8.sound_on = sound_on[lane];
+}
+
+// Record the memory a machine wrote; the Batch owns the written spans as
+// the JIT does for a single machine
+void Batch::note_writes(Chip8& chip8) {
+    if (chip8.written_start == chip8.written_end) return;
+    std::fill(written.begin() + chip8.written_start,
+              written.begin() + chip8.written_end, 1);
+    chip8.written_start = chip8.written_end = 0;
+}
+
+uint16_t Batch::opcode_at(size_t lane, uint16_t address) const {
+    const Chip8& chip8 = *machines[lane];
+    address &= chip8.address_mask;
+    return chip8.memory[address] << 8 | chip8.memory[(address + 1) & chip8.address_mask];
+}
+
+// The bucket for a pc, opened empty if no lanes are parked there
+uint32_t Batch::bucket_for(uint16_t address) {
+    uint32_t index = bucket_at[address];
+    if (index == NO_BUCKET) {
+        index = bucket_count++;
+        if (index == buckets.size()) buckets.emplace_back();
+        Bucket& bucket = buckets[index];
+        bucket.pc = address;
+        bucket.least = UINT32_MAX;
+        bucket.most = 0;
+        bucket.first_lane = stride;
+        bucket.end_lane = 0;
+        bucket.detached = false;
+        bucket_at[address] = index;
+    }
+    return index;
+}
+
+// Put a lane with instructions left in the bucket for its pc
+void Batch::park(uint32_t lane) {
+    Bucket& bucket = buckets[bucket_for(pc[lane])];
+    bucket.lanes.push_back(lane);
+    bucket.least = std::min(bucket.least, remaining[lane]);
+    bucket.most = std::max(bucket.most, remaining[lane]);
+    bucket.first_lane = std::min(bucket.first_lane, lane / BLOCK * BLOCK);
+    bucket.end_lane = std::max(bucket.end_lane, lane / BLOCK * BLOCK + BLOCK);
+    bucket.detached |= detached[lane] != 0;
+}
+
+// Park the groups that finished the last run together, each as a whole,
+// with the given number of steps ahead of them
+void Batch::unpark_resting(uint32_t cycles) {
+    for (size_t rest = 0; rest < resting_count; rest++) {
+        Bucket& lanes = resting[rest];
+        Bucket& bucket = buckets[bucket_for(lanes.pc)];
+        if (bucket.lanes.empty()) {
+            bucket.lanes.swap(lanes.lanes);
+        } else {
+            bucket.lanes.insert(bucket.lanes.end(), lanes.lanes.begin(), lanes.lanes.end());
+        }
+        lanes.lanes.clear();
+        bucket.least = std::min(bucket.least, cycles);
+        bucket.most = cycles;
+        bucket.first_lane = std::min(bucket.first_lane, lanes.first_lane);
+        bucket.end_lane = std::max(bucket.end_lane, lanes.end_lane);
+    }
+    resting_count = 0;
+}
+
+// Move a bucket's lanes into the group, which must be at the bucket's pc,
+// bringing back the registers of any that ran alone. The group's pending
+// steps are added to the newcomers' counts, to come off again when the
+// group is flushed. Members are kept in order of the steps they have left,
+// most first, so those that run out are always at the back.
+void Batch::take_bucket(size_t index) {
+    Bucket& bucket = buckets[index];
+    if (bucket.detached) {
+        for (uint32_t lane : bucket.lanes) {
+            if (!detached[lane]) continue;
+            const Chip8& chip8 = *machines[lane];
+            for (int x = 0; x < 16; x++) V[x * stride + lane] = chip8.V[x];
+            I[lane] = chip8.I;
+            detached[lane] = 0;
+            misses[lane] = 0;
+        }
+    }
+    for (uint32_t lane : bucket.lanes) {
+        group[lane] = 0xFF;
+        remaining[lane] += pending;
+    }
+    group_left = std::min(group_left, bucket.least + pending);
+    group_most = std::max(group_most, bucket.most + pending);
+    first_lane = std::min(first_lane, bucket.first_lane);
+    end_lane = std::max(end_lane, bucket.end_lane);
+
+    auto more_left = [this](uint32_t a, uint32_t b) { return remaining[a] > remaining[b]; };
+    if (bucket.least != bucket.most
+        && !std::is_sorted(bucket.lanes.begin(), bucket.lanes.end(), more_left)) {
+        std::sort(bucket.lanes.begin(), bucket.lanes.end(), more_left);
+    }
+    if (members.empty()) {
+        members.swap(bucket.lanes);
+    } else if (!more_left(bucket.lanes.front(), members.back())) {
+        members.insert(members.end(), bucket.lanes.begin(), bucket.lanes.end());
+    } else {
+        joined.resize(members.size() + bucket.lanes.size());
+        std::merge(members.begin(), members.end(), bucket.lanes.begin(), bucket.lanes.end(),
+                   joined.begin(), more_left);
+        members.swap(joined);
+    }
+    release_bucket(index);
+}
+
+// Empty a bucket and return it to the unused ones
+void Batch::release_bucket(size_t index) {
+    Bucket& bucket = buckets[index];
+    bucket.lanes.clear();
+    bucket_at[bucket.pc] = NO_BUCKET;
+    bucket_count--;
+    if (index != bucket_count) {
+        std::swap(buckets[index], buckets[bucket_count]);
+        bucket_at[buckets[index].pc] = index;
+    }
+}
+
+// Once a member has run out, let those that are done rest together until
+// the next run while the others step on
+void Batch::rest_done() {
+    parted.clear();
+    while (!members.empty() && remaining[members.back()] == pending) {
+        uint32_t lane = members.back();
+        members.pop_back();
+        pc[lane] = group_pc;
+        remaining[lane] = 0;
+        group[lane] = 0;
+        rested[lane] = 1;
+        parted.push_back(lane);
+    }
+    if (!members.empty()) {
+        leader = members.front();
+        group_left = remaining[members.back()];
+        group_most = remaining[members.front()];
+    }
+    if (parted.empty()) return;
+
+    if (resting_count == resting.size()) resting.emplace_back();
+    Bucket& bucket = resting[resting_count++];
+    bucket.pc = group_pc;
+    bucket.first_lane = first_lane;
+    bucket.end_lane = end_lane;
+    bucket.lanes.swap(parted);
+}
+
+// Make the bucket furthest behind the group, preferring the lowest pc
+// where several are level. Buckets too small to step together wait for a
+// group to take them on its way; once only those are left, their lanes
+// run one by one instead. False once every lane is done.
+bool Batch::select_group() {
+    size_t best = bucket_count;
+    for (size_t index = 0; index < bucket_count; index++) {
+        const Bucket& bucket = buckets[index];
+        if (bucket.lanes.size() < MIN_GROUP) continue;
+        if (best == bucket_count || bucket.most > buckets[best].most
+            || (bucket.most == buckets[best].most && bucket.pc < buckets[best].pc)) {
+            best = index;
+        }
+    }
+
+    if (best == bucket_count) {
+        // Stepping a group this small costs more than interpreting its
+        // lanes one at a time
+        parted.clear();
+        while (bucket_count != 0) {
+            for (uint32_t lane : buckets[bucket_count - 1].lanes) {
+                if (detached[lane]) {
+                    misses[lane] = std::min<uint8_t>(misses[lane] + 1, MAX_MISSES);
+                    sitting_out[lane] = (1 << misses[lane]) - 1;
+                }
+                parted.push_back(lane);
+            }
+            release_bucket(bucket_count - 1);
+        }
+        run_each_alone(parted);
+        return false;
+    }
+
+    start_group(best);
+    return true;
+}
+
+// Make a bucket the group
+void Batch::start_group(size_t index) {
+    members.clear();
+    first_lane = stride;
+    end_lane = 0;
+    group_pc = buckets[index].pc;
+    pending = 0;
+    group_left = UINT32_MAX;
+    group_most = 0;
+    take_bucket(index);
+    leader = members.front();
+}
+
+// After a forward jump, the bucket of lanes that parted from the group and
+// are somewhere on the way to where it now is, or bucket_count
+size_t Batch::lagging(uint16_t from, uint16_t to) const {
+    size_t found = bucket_count;
+    for (size_t index = 0; index < bucket_count; index++) {
+        const Bucket& bucket = buckets[index];
+        if (bucket.pc > from && bucket.pc < to
+            && (found == bucket_count || bucket.pc < buckets[found].pc)) {
+            found = index;
+        }
+    }
+    return found;
+}
+
+// Park the whole group at its pc and let a lagging bucket catch up with it
+void Batch::wait_for(size_t index) {
+    flush_group();
+    uint16_t lagging_pc = buckets[index].pc;
+    Bucket& bucket = buckets[bucket_for(group_pc)];
+    for (uint32_t lane : members) group[lane] = 0;
+    if (bucket.lanes.empty()) {
+        bucket.lanes.swap(members);
+    } else {
+        bucket.lanes.insert(bucket.lanes.end(), members.begin(), members.end());
+    }
+    bucket.least = std::min(bucket.least, group_left);
+    bucket.most = std::max(bucket.most, group_most);
+    bucket.first_lane = std::min(bucket.first_lane, first_lane);
+    bucket.end_lane = std::max(bucket.end_lane, end_lane);
+    start_group(bucket_at[lagging_pc]);
+}
+
+// Hand the group's shared pc and step count back to its lanes
+void Batch::flush_group() {
+    if (pending == 0) return;
+    for (uint32_t lane : members) {
+        pc[lane] = group_pc;
+        remaining[lane] -= pending;
+    }
+    group_left -= pending;
+    group_most -= pending;
+    pending = 0;
+}
+
+// Once the members have taken their own pc, keep those at the lowest
+// stepping together, park the others and drop those that are done
+void Batch::split() {
+    uint16_t lowest = UINT16_MAX;
+    for (uint32_t lane : members) {
+        if (remaining[lane] != 0) lowest = std::min(lowest, pc[lane]);
+    }
+    size_t kept = 0;
+    for (uint32_t lane : members) {
+        if (remaining[lane] != 0 && pc[lane] == lowest) {
+            members[kept++] = lane;
+        } else {
+            group[lane] = 0;
+            if (remaining[lane] != 0) park(lane);
+        }
+    }
+    members.resize(kept);
+    group_pc = lowest;
+    if (kept != 0) leader = members.front();
+}
+
+// Code written since loading may differ from lane to lane. Members whose
+// instruction at the group's pc is not the leader's run alone.
+void Batch::drop_differing(uint16_t opcode) {
+    bool same = true;
+    for (uint32_t lane : members) same &= opcode_at(lane, group_pc) == opcode;
+    if (same) return;
+
+    flush_group();
+    size_t kept = 0;
+    for (uint32_t lane : members) {
+        if (opcode_at(lane, group_pc) == opcode) {
+            members[kept++] = lane;
+        } else {
+            group[lane] = 0;
+            run_alone(lane);
+        }
+    }
+    members.resize(kept);
+}
+
+// Run one instruction for the whole group, exactly as the interpreter's
+// handler would, if it needs no more than the lane registers, the stack,
+// the keys and the random number generator. Returns false, touching
+// nothing, for anything else.
+bool Batch::execute(uint16_t opcode) {
+    const Chip8& first = *machines[leader];
+    uint8_t x = (opcode & 0x0F00) >> 8;
+    uint8_t y = (opcode & 0x00F0) >> 4;
+    uint16_t nnn = opcode & 0x0FFF;
+    uint8_t nn = opcode & 0x00FF;
+
+    uint8_t* vx = &V[x * stride];
+    uint8_t* vy = &V[y * stride];
+    uint8_t* vf = &V[0xF * stride];
+    const uint8_t* mask = group.data();
+    uint32_t quirks = first.quirks;
+
+    // On XO-CHIP a skip's length depends on the next instruction
+    bool skip = (opcode & 0xF000) == 0x3000 || (opcode & 0xF000) == 0x4000
+             || (opcode & 0xF000) == 0x5000 || (opcode & 0xF000) == 0x9000
+             || (opcode & 0xF000) == 0xE000;
+    if (skip && first.xo_chip) return false;
+
+    // Calls and returns use each lane's own stack, and key tests and waits
+    // its key mask. Lanes that would go past the stack are left to the
+    // interpreter.
+    bool supported;
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            supported = opcode == 0x00EE;
+            for (uint32_t lane : members) supported &= machines[lane]->sp != 0;
+            break;
+        case 0x2000:
+            supported = true;
+            for (uint32_t lane : members) supported &= machines[lane]->sp < 16;
+            break;
+        case 0xE000:
+            supported = nn == 0x9E || nn == 0xA1;
+            break;
+        case 0x8000: supported = (opcode & 0xF) <= 0x7 || (opcode & 0xF) == 0xE; break;
+        case 0xF000:
+            switch (nn) {
+                case 0x07: case 0x0A: case 0x15: case 0x18: case 0x1E: case 0x29: case 0x30:
+                    supported = true;
+                    break;
+                default:
+                    supported = false;
+            }
+            break;
+        case 0xD000:
+            supported = false;
+            break;
+        default:
+            supported = true;
+    }
+    if (!supported) return false;
+
+    if (skip || (opcode & 0xF000) == 0xB000 || opcode == 0x00EE
+        || (opcode & 0xF0FF) == 0xF00A) {
+        branch(opcode);
+        return true;
+    }
+
+    switch (opcode & 0xF000) {
+        case 0x2000:
+            for (uint32_t lane : members) {
+                Chip8& chip8 = *machines[lane];
+                chip8.stack[chip8.sp] = group_pc;
+                chip8.sp++;
+            }
+            break;
+
+        case 0x6000:
+            for (size_t lane = first_lane; lane < end_lane; lane += BLOCK) {
+                store_masked(vx + lane, splat(nn), mask + lane);
+            }
+            break;
+        case 0x7000:
+            for (size_t lane = first_lane; lane < end_lane; lane += BLOCK) {
+                store_masked(vx + lane, add(load_lanes(vx + lane), splat(nn)), mask + lane);
+            }
+            break;
+
+        // Operands are reloaded after every store so that X, Y and F
+        // aliasing behaves as in the interpreter
+        case 0x8000:
+            for (size_t lane = first_lane; lane < end_lane; lane += BLOCK) {
+                uint8_t* px = vx + lane;
+                uint8_t* py = vy + lane;
+                uint8_t* pf = vf + lane;
+                const uint8_t* m = mask + lane;
+                uint8_t* source = quirks & QUIRK_SHIFT ? px : py;
+                switch (opcode & 0xF) {
+                    case 0x0: store_masked(px, load_lanes(py), m); break;
+                    case 0x1: store_masked(px, bit_or(load_lanes(px), load_lanes(py)), m); break;
+                    case 0x2: store_masked(px, bit_and(load_lanes(px), load_lanes(py)), m); break;
+                    case 0x3: store_masked(px, bit_xor(load_lanes(px), load_lanes(py)), m); break;
+                    case 0x4: {
+                        Lanes carry = greater(load_lanes(py), bit_xor(load_lanes(px), splat(0xFF)));
+                        store_masked(px, add(load_lanes(px), load_lanes(py)), m);
+                        store_masked(pf, carry, m);
+                        break;
+                    }
+                    case 0x5:
+                        store_masked(pf, bit_xor(greater(load_lanes(py), load_lanes(px)), splat(1)), m);
+                        store_masked(px, sub(load_lanes(px), load_lanes(py)), m);
+                        break;
+                    case 0x6:
+                        store_masked(pf, bit_and(load_lanes(source), splat(1)), m);
+                        store_masked(px, shr(load_lanes(source), 1), m);
+                        break;
+                    case 0x7:
+                        store_masked(pf, bit_xor(greater(load_lanes(px), load_lanes(py)), splat(1)), m);
+                        store_masked(px, sub(load_lanes(py), load_lanes(px)), m);
+                        break;
+                    case 0xE:
+                        store_masked(pf, shr(load_lanes(source), 7), m);
+                        store_masked(px, shl1(load_lanes(source)), m);
+                        break;
+                }
+                if ((opcode & 0xF) >= 0x1 && (opcode & 0xF) <= 0x3
+                    && (quirks & QUIRK_VF_RESET)) {
+                    store_masked(pf, splat(0), m);
+                }
+            }
+            break;
+
+        case 0xA000:
+            for (uint32_t lane : members) I[lane] = nnn;
+            break;
+        case 0xC000:
+            for (uint32_t lane : members) {
+                vx[lane] = (machines[lane]->random() >> 24) & nn;
+            }
+            break;
+
+        case 0xF000:
+            switch (nn) {
+                case 0x07:
+                    for (size_t lane = first_lane; lane < end_lane; lane += BLOCK) {
+                        store_masked(vx + lane, load_lanes(&delay_timer[lane]), mask + lane);
+                    }
+                    break;
+                case 0x15:
+                    for (size_t lane = first_lane; lane < end_lane; lane += BLOCK) {
+                        store_masked(&delay_timer[lane], load_lanes(vx + lane), mask + lane);
+                    }
+                    break;
+                case 0x18:
+                    for (size_t lane = first_lane; lane < end_lane; lane += BLOCK) {
+                        store_masked(&sound_timer[lane], load_lanes(vx + lane), mask + lane);
+                    }
+                    break;
+                case 0x1E:
+                    for (uint32_t lane : members) {
+                        if (quirks & QUIRK_INDEX_OVERFLOW) vf[lane] = I[lane] + vx[lane] > 0xFFF;
+                        I[lane] += vx[lane];
+                    }
+                    break;
+                case 0x29:
+                    for (uint32_t lane : members) I[lane] = vx[lane] * 5;
+                    break;
+                case 0x30:
+                    for (uint32_t lane : members) {
+                        I[lane] = FONT_LARGE_ADDRESS + (vx[lane] & 0xF) * 10;
+                    }
+                    break;
+            }
+            break;
+    }
+
+    bool jump = (opcode & 0xF000) == 0x1000 || (opcode & 0xF000) == 0x2000;
+    group_pc = jump ? nnn : group_pc + 2;
+    pending++;
+    return true;
+}
+
+// Run a skip, computed jump, return or key wait, where lanes may part
+// ways. While every member goes the same way the group steps on as one;
+// otherwise each takes its own pc and the group splits.
+void Batch::branch(uint16_t opcode) {
+    uint8_t x = (opcode & 0x0F00) >> 8;
+    uint8_t y = (opcode & 0x00F0) >> 4;
+    uint16_t nnn = opcode & 0x0FFF;
+    uint8_t nn = opcode & 0x00FF;
+    uint8_t* vx = &V[x * stride];
+    const uint8_t* vy = &V[y * stride];
+    const uint8_t* offset = machines[leader]->quirks & QUIRK_JUMP ? vx : &V[0];
+
+    // How many members take the branch, and where the first goes
+    size_t taken = 0;
+    uint16_t target = 0;
+    bool together = true;
+    switch (opcode & 0xF000) {
+        case 0x3000: case 0x4000: case 0x5000: case 0x9000: {
+            Lanes operand = splat(nn);
+            bool registers = (opcode & 0xF000) == 0x5000 || (opcode & 0xF000) == 0x9000;
+            for (size_t lane = first_lane; lane < end_lane; lane += BLOCK) {
+                if (registers) operand = load_lanes(vy + lane);
+                Lanes same = bit_and(equal(load_lanes(vx + lane), operand),
+                                     load_lanes(&group[lane]));
+                taken += __builtin_popcount(lane_bits(same));
+            }
+            if ((opcode & 0xF000) == 0x4000 || (opcode & 0xF000) == 0x9000) {
+                taken = members.size() - taken;
+            }
+            together = taken == 0 || taken == members.size();
+            target = group_pc + 2 + (taken != 0) * 2;
+            break;
+        }
+        case 0xE000:
+            for (uint32_t lane : members) {
+                taken += (key_masks[lane] >> (vx[lane] & 0xF) & 1) == (nn == 0x9E);
+            }
+            together = taken == 0 || taken == members.size();
+            target = group_pc + 2 + (taken != 0) * 2;
+            break;
+        case 0xF000:
+            for (uint32_t lane : members) taken += key_masks[lane] != 0;
+            together = taken == 0 || taken == members.size();
+            target = group_pc + (taken != 0) * 2;
+            break;
+        case 0xB000:
+            target = nnn + offset[leader];
+            for (uint32_t lane : members) together &= uint16_t(nnn + offset[lane]) == target;
+            break;
+        default: {
+            const Chip8& first = *machines[leader];
+            target = first.stack[first.sp - 1] + 2;
+            for (uint32_t lane : members) {
+                const Chip8& chip8 = *machines[lane];
+                together &= uint16_t(chip8.stack[chip8.sp - 1] + 2) == target;
+            }
+            break;
+        }
+    }
+
+    // Whether a member of a skip or key wait goes the further way
+    bool two_way = (opcode & 0xF000) != 0xB000 && opcode != 0x00EE;
+    auto further = [&](uint32_t lane) {
+        switch (opcode & 0xF000) {
+            case 0x3000: return vx[lane] == nn;
+            case 0x4000: return vx[lane] != nn;
+            case 0x5000: return vx[lane] == vy[lane];
+            case 0x9000: return vx[lane] != vy[lane];
+            case 0xE000: return (key_masks[lane] >> (vx[lane] & 0xF) & 1) == (nn == 0x9E);
+            default:     return key_masks[lane] != 0;
+        }
+    };
+
+    if (together) {
+        if (opcode == 0x00EE) {
+            for (uint32_t lane : members) machines[lane]->sp--;
+        }
+        if ((opcode & 0xF000) == 0xF000 && taken != 0) {
+            for (uint32_t lane : members) vx[lane] = 31 - __builtin_clz(key_masks[lane]);
+        }
+        group_pc = target;
+
+        // The keys stay as they are for the rest of the run, so members
+        // waiting for one wait until the first of them runs out
+        if ((opcode & 0xF000) == 0xF000 && taken == 0) {
+            vector_cycles += (group_left - pending - 1) * members.size();
+            pending = group_left;
+        } else {
+            pending++;
+        }
+    } else if (two_way && group_left > pending + 1) {
+        // Members going the further way leave together for the bucket
+        // there, and the rest step on without a flush
+        uint16_t low = (opcode & 0xF000) == 0xF000 ? group_pc : group_pc + 2;
+        uint16_t high = low + 2;
+        parted.clear();
+        size_t kept = 0;
+        for (uint32_t lane : members) {
+            if (!further(lane)) {
+                members[kept++] = lane;
+                continue;
+            }
+            if ((opcode & 0xF000) == 0xF000) vx[lane] = 31 - __builtin_clz(key_masks[lane]);
+            group[lane] = 0;
+            pc[lane] = high;
+            remaining[lane] -= pending + 1;
+            parted.push_back(lane);
+        }
+        members.resize(kept);
+        leader = members.front();
+
+        Bucket& bucket = buckets[bucket_for(high)];
+        if (bucket.lanes.empty()) {
+            bucket.lanes.swap(parted);
+        } else {
+            bucket.lanes.insert(bucket.lanes.end(), parted.begin(), parted.end());
+        }
+        bucket.least = std::min(bucket.least, group_left - pending - 1);
+        bucket.most = std::max(bucket.most, group_most - pending - 1);
+        bucket.first_lane = std::min(bucket.first_lane, first_lane);
+        bucket.end_lane = std::max(bucket.end_lane, end_lane);
+        group_pc = low;
+        pending++;
+    } else {
+        flush_group();
+        for (uint32_t lane : members) {
+            Chip8& chip8 = *machines[lane];
+            if (two_way) {
+                bool jump = further(lane);
+                if ((opcode & 0xF000) == 0xF000 && jump) {
+                    vx[lane] = 31 - __builtin_clz(key_masks[lane]);
+                }
+                pc[lane] += ((opcode & 0xF000) != 0xF000) * 2 + jump * 2;
+            } else if ((opcode & 0xF000) == 0xB000) {
+                pc[lane] = nnn + offset[lane];
+            } else {
+                chip8.sp--;
+                pc[lane] = chip8.stack[chip8.sp] + 2;
+            }
+            remaining[lane]--;
+        }
+        group_left--;
+        group_most--;
+        split();
+    }
+}
+
+// Run the group's instruction through each member's own interpreter. The
+// group stays together unless a member stops or goes elsewhere.
+void Batch::interpret(uint16_t opcode) {
+    uint16_t registers = registers_used(opcode);
+
+    // Drawing, clearing and loads and stores need only V, I, memory and the
+    // screen: call the handler, decoded once for the group, on each member
+    // without its pc, timers or decode cache
+    uint8_t low = opcode & 0xFF;
+    bool plain = (opcode & 0xF000) == 0xD000 || opcode == 0x00E0
+              || ((opcode & 0xF000) == 0xF000 && (low == 0x33 || low == 0x55 || low == 0x65));
+    if (plain) {
+        // Only what the handler reads goes in and only what it writes
+        // comes back
+        uint8_t x = (opcode & 0x0F00) >> 8;
+        uint8_t y = (opcode & 0x00F0) >> 4;
+        uint16_t in = 0, out = 0;
+        if ((opcode & 0xF000) == 0xD000) {
+            in = 1 << x | 1 << y;
+            out = 1 << 0xF;
+        } else if (low == 0x33) {
+            in = 1 << x;
+        } else if (low == 0x55) {
+            in = registers;
+        } else if (low == 0x65) {
+            out = registers;
+        }
+
+        Instruction op = machines[leader]->decode(opcode);
+        for (uint32_t lane : members) {
+            Chip8& chip8 = *machines[lane];
+            for (uint32_t bits = in; bits != 0; bits &= bits - 1) {
+                int r = __builtin_ctz(bits);
+                chip8.V[r] = V[r * stride + lane];
+            }
+            chip8.I = I[lane];
+            op.execute(chip8, op);
+            for (uint32_t bits = out; bits != 0; bits &= bits - 1) {
+                int r = __builtin_ctz(bits);
+                V[r * stride + lane] = chip8.V[r];
+            }
+            I[lane] = chip8.I;
+            note_writes(chip8);
+        }
+        group_pc += 2;
+        pending++;
+        return;
+    }
+
+    flush_group();
+    uint16_t next = group_pc + 2;
+    bool together = true;
+    for (uint32_t lane : members) {
+        Chip8& chip8 = *machines[lane];
+        to_machine(lane, registers);
+        chip8.cycle();
+        from_machine(lane, registers);
+        note_writes(chip8);
+        remaining[lane] = chip8.is_running ? remaining[lane] - 1 : 0;
+        together &= chip8.is_running && pc[lane] == next;
+
+        // A lane that stops is left with its machine up to date
+        if (!chip8.is_running) {
+            to_machine(lane);
+            running[lane] = 0;
+            detached[lane] = 1;
+        }
+    }
+    group_left--;
+    group_most--;
+    if (together) {
+        group_pc = next;
+    } else {
+        split();
+    }
+}
+
+// Run a lane alone through its interpreter for the rest of its budget. Its
+// registers stay in the machine until a group takes the lane back.
+void Batch::run_alone(size_t lane) {
+    Chip8& chip8 = *machines[lane];
+    if (detached[lane]) {
+        timers_to_machine(lane);
+    } else {
+        to_machine(lane);
+    }
+    detached[lane] = 1;
+    uint32_t budget = remaining[lane];
+    uint32_t executed = 0;
+    for (; executed < budget && chip8.is_running; executed++) chip8.cycle();
+    scalar_cycles += executed;
+    note_writes(chip8);
+    pc[lane] = chip8.pc;
+    delay_timer[lane] = chip8.delay_timer;
+    sound_timer[lane] = chip8.sound_timer;
+    running[lane] = chip8.is_running;
+    remaining[lane] = 0;
+}
+
+// Run lanes alone one after another. Each starts loading the machine a few
+// lanes ahead, its registers and the decoded instructions at its pc, while
+// it runs. The prefetches stay in the loop: a function doing nothing else
+// looks free of side effects to the compiler, and calls to it are dropped.
+void Batch::run_each_alone(const std::vector<uint32_t>& lanes) {
+    for (size_t index = 0; index < lanes.size(); index++) {
+        if (index + PREFETCH_AHEAD < lanes.size()) {
+            uint32_t ahead = lanes[index + PREFETCH_AHEAD];
+            const Chip8& chip8 = *machines[ahead];
+            const char* object = reinterpret_cast<const char*>(&chip8);
+            __builtin_prefetch(object);
+            __builtin_prefetch(object + 64);
+            const Instruction* next = &chip8.decoded[pc[ahead] & chip8.address_mask];
+            __builtin_prefetch(next);
+            __builtin_prefetch(next + 4);
+            __builtin_prefetch(next + 8);
+        }
+        run_alone(lanes[index]);
+    }
+}
+
+void Batch::run(uint64_t cycles) {
+    // Lanes joining a group may count up to twice their budget for a while
+    const uint32_t most = UINT32_MAX / 2;
+    for (; cycles > most; cycles -= most) run_lanes(most);
+    run_lanes(cycles);
+}
+
+void Batch::run_lanes(uint32_t cycles) {
+    parted.clear();
+    for (size_t lane = 0; lane < machines.size(); lane++) {
+        remaining[lane] = running[lane] ? cycles : 0;
+        bool was_rested = rested[lane];
+        rested[lane] = 0;
+        if (remaining[lane] == 0 || was_rested) continue;
+        if (sitting_out[lane] != 0) {
+            sitting_out[lane]--;
+            parted.push_back(lane);
+        } else {
+            park(lane);
+        }
+    }
+    run_each_alone(parted);
+    unpark_resting(cycles);
+
+    while (select_group()) {
+        while (!members.empty()) {
+            // Lanes waiting where the group has got to join it
+            uint32_t index = bucket_at[group_pc];
+            if (index != NO_BUCKET) take_bucket(index);
+
+            // A member is about to run out
+            if (pending == group_left) {
+                rest_done();
+                if (members.empty()) break;
+            }
+
+            const Chip8& first = *machines[leader];
+            uint16_t address = group_pc & first.address_mask;
+            uint16_t next = (address + 1) & first.address_mask;
+            uint16_t opcode = first.memory[address] << 8 | first.memory[next];
+            uint16_t group_from = group_pc;
+            if (written[address] || written[next]) drop_differing(opcode);
+
+            size_t count = members.size();
+            if (execute(opcode)) {
+                vector_cycles += count;
+            } else {
+                interpret(opcode);
+                scalar_cycles += count;
+            }
+
+            // A forward jump past lanes that parted on the way waits for them
+            if ((opcode & 0xF000) == 0x1000 && group_pc > group_from && !members.empty()) {
+                size_t index = lagging(group_from, group_pc);
+                if (index != bucket_count) wait_for(index);
+            }
+        }
+    }
+}
+
+// As Chip8::tick_timers(), on the lanes
+void Batch::tick_timers() {
+    for (size_t lane = 0; lane < stride; lane++) {
+        uint8_t delay = delay_timer[lane];
+        uint8_t sound = sound_timer[lane];
+        delay_timer[lane] = delay - (delay != 0);
+        sound_on[lane] = sound != 0;
+        sound_timer[lane] = sound - (sound != 0);
+    }
+}
@@ -0,0 +1,160 @@
+#ifndef BATCH_H
+#define BATCH_H
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "chip8.h"
+
+// Steps many copies of one ROM, each a lane with its own seed and keys,
+// for fuzzing and search. The registers, I, pc and timers of all lanes
+// live as structure of arrays (V[16][lanes]); memory, the screen and the
+// rest stay in each lane's own Chip8.
+//
+// Lanes waiting to run are kept in buckets by pc. Each step runs one
+// instruction for a group of lanes at the same pc, taken from the bucket
+// with the most budget left, and takes along any lanes waiting at the pc
+// it reaches, so lanes that part at a branch come back together where
+// their paths meet. A group that jumps forward past lanes left behind
+// waits there for them. A skip, return or computed jump that sends the
+// members two ways splits the group: the lanes at the lower pc step on
+// and the rest are parked. Register, timer, branch, call and key
+// instructions run once for the whole group, 32 lanes at a time with
+// AVX2 or SSE2 where they only use lane registers; the rest go through
+// Chip8::cycle() lane by lane. Groups of fewer than ten lanes are not
+// worth stepping together: their lanes run alone in Chip8::cycle() until
+// their budgets are spent, and a lane that keeps ending up alone stops
+// being parked for a while. Every lane executes exactly the instructions
+// a single Chip8 would, so the results are bit-identical.
+class Batch {
+    private:
+        std::vector<std::unique_ptr<Chip8>> machines;
+        size_t stride;              // Lanes rounded up to a whole block
+
+        // Lane registers. The machines' copies are only current while a
+        // lane runs through Chip8::cycle().
+        std::vector<uint8_t> V;     // VX of lane L at V[X * stride + L]
+        std::vector<uint16_t> I;
+        std::vector<uint16_t> pc;
+        std::vector<uint8_t> delay_timer;
+        std::vector<uint8_t> sound_timer;
+        std::vector<uint8_t> sound_on;
+
+        // Instructions each lane still has to run in the current run()
+        std::vector<uint32_t> remaining;
+
+        // Lanes that have not stopped
+        std::vector<uint8_t> running;
+
+        // Lanes whose V and I live in their machine instead, since they
+        // last ran alone, until a group takes them back. Their pc and
+        // timers are kept here all the same.
+        std::vector<uint8_t> detached;
+
+        // The key mask each lane's machine last had set
+        std::vector<uint16_t> key_masks;
+
+        // The lanes stepping together: a byte mask (0xFF per member), their
+        // indices and the blocks [first_lane, end_lane) that hold them.
+        // While the group runs, its members' pc and remaining count are
+        // held in group_pc and pending until flushed.
+        std::vector<uint8_t> group;
+        std::vector<uint32_t> members;
+        std::vector<uint32_t> parted;   // Members leaving at a branch
+        std::vector<uint32_t> joined;   // Members merged with newcomers
+        size_t first_lane;
+        size_t end_lane;
+        size_t leader;
+        uint16_t group_pc;
+        uint32_t pending;
+        uint32_t group_left;        // Steps until a member may run out
+        uint32_t group_most;        // Most steps a member has left
+
+        // Lanes parked at the same pc, with bounds on the steps they have
+        // left, the blocks that hold them and whether any ran alone. The
+        // first bucket_count are in use; bucket_at maps a pc to its
+        // bucket, or NO_BUCKET.
+        struct Bucket {
+            uint16_t pc;
+            uint32_t least;
+            uint32_t most;
+            size_t first_lane;
+            size_t end_lane;
+            bool detached;
+            std::vector<uint32_t> lanes;
+        };
+        std::vector<Bucket> buckets;
+        size_t bucket_count;
+        std::vector<uint32_t> bucket_at;
+
+        // Groups that used up the last run together, each still at one pc,
+        // to be parked whole when the next run starts. rested marks their
+        // lanes.
+        std::vector<Bucket> resting;
+        size_t resting_count;
+        std::vector<uint8_t> rested;
+
+        // Runs in a row a detached lane was parked and still ran alone, and
+        // how many more runs it skips parking for
+        std::vector<uint8_t> misses;
+        std::vector<uint8_t> sitting_out;
+
+        // Addresses some lane has written since loading, where the lanes'
+        // code may differ
+        std::vector<uint8_t> written;
+
+        uint64_t vector_cycles;
+        uint64_t scalar_cycles;
+
+        void to_machine(size_t lane, uint16_t registers = 0xFFFF);
+        void from_machine(size_t lane, uint16_t registers = 0xFFFF);
+        void timers_to_machine(size_t lane);
+        void note_writes(Chip8& chip8);
+        uint16_t opcode_at(size_t lane, uint16_t address) const;
+        uint32_t bucket_for(uint16_t address);
+        void park(uint32_t lane);
+        void unpark_resting(uint32_t cycles);
+        void take_bucket(size_t index);
+        void release_bucket(size_t index);
+        void rest_done();
+        bool select_group();
+        void start_group(size_t index);
+        size_t lagging(uint16_t from, uint16_t to) const;
+        void wait_for(size_t index);
+        void flush_group();
+        void split();
+        void drop_differing(uint16_t opcode);
+        bool execute(uint16_t opcode);
+        void branch(uint16_t opcode);
+        void interpret(uint16_t opcode);
+        void run_alone(size_t lane);
+        void run_each_alone(const std::vector<uint32_t>& lanes);
+        void run_lanes(uint32_t cycles);
+
+    public:
+        // One lane per seed. All lanes share the platform and quirks.
+        Batch(const std::vector<uint64_t>& seeds, bool xo_chip = false,
+              uint32_t quirks = PROFILE_CHIP8);
+
+        // Load the same ROM into every lane
+        bool load(const uint8_t* data, size_t size);
+
+        size_t size() const { return machines.size(); }
+        void set_key_mask(size_t lane, uint16_t mask);
+
+        // Execute the given number of instructions on every running lane
+        void run(uint64_t cycles);
+
+        // Count every lane's timers down, once per 60 Hz frame
+        void tick_timers();
+
+        // A lane's machine with its registers brought up to date
+        const Chip8& machine(size_t lane);
+
+        // Lane instructions run in groups, and one lane at a time
+        uint64_t get_vector_cycles() const { return vector_cycles; }
+        uint64_t get_scalar_cycles() const { return scalar_cycles; }
+};
+
+#endif // BATCH_H
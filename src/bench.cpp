@@ -0,0 +1,1394 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <chrono>
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <filesystem>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "batch.h"
+#include "capture.h"
+#include "chip8.h"
+#include "hash.h"
+#include "libchip8.h"
+#include "profiler.h"
+#include "reference.h"
+#include "rewind.h"
+#include "romdb.h"
+#include "scheduler.h"
+
+// Read a whole ROM file into a byte vector
+static bool read_rom(const char* filepath, std::vector<uint8_t>& rom) {
+    std::ifstream file(filepath, std::ifstream::binary);
+    if (!file) {
+        std::cerr << "Error: Failed to open ROM " << filepath << std::endl;
+        return false;
+    }
+
+    rom.assign(std::istreambuf_iterator<char>(file),
+               std::istreambuf_iterator<char>());
+    return true;
+}
+
+// Every file in the directories, sorted
+static bool list_roms(const std::vector<std::string>& dirs,
+                      std::vector<std::string>& roms) {
+    for (const std::string& dir : dirs) {
+        std::error_code error;
+        for (const auto& entry : std::filesystem::directory_iterator(dir, error)) {
+            if (entry.is_regular_file()) roms.push_back(entry.path().string());
+        }
+        if (error) {
+            std::cerr << "Error: Failed to list " << dir << std::endl;
+            return false;
+        }
+    }
+    std::sort(roms.begin(), roms.end());
+    return true;
+}
+
+// XXH64 of the screen at its current resolution, so runs can be compared
+// frame by frame. Only worth taking when the draw flag says the screen may
+// have changed.
+static uint64_t screen_hash(bool extended, const Framebuffer& gfx,
+                            const FramebufferExtended& gfx_extended) {
+    return extended ? hash64(gfx_extended.data(), sizeof(gfx_extended))
+                    : hash64(gfx.data(), sizeof(gfx));
+}
+
+static uint64_t screen_hash(const Chip8& chip8) {
+    return screen_hash(chip8.extended_resolution, chip8.gfx, chip8.gfx_extended);
+}
+
+// Run a fresh machine for the given number of cycles, in 60 Hz frames, and
+// return the achieved millions of instructions per second
+template <void (Chip8::*Cycle)()>
+static double measure_mips(const std::vector<uint8_t>& rom, uint64_t cycles) {
+    auto chip8 = std::make_unique<Chip8>();
+    chip8->load(rom.data(), rom.size());
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t executed = 0;
+    while (executed < cycles && chip8->is_running) {
+        ((*chip8).*Cycle)();
+        if (++executed % DEFAULT_INSTRUCTIONS_PER_FRAME == 0) {
+            chip8->tick_timers();
+        }
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    return executed / elapsed.count() / 1e6;
+}
+
+// The interpreter as it was before instructions were predecoded: one nested
+// switch decoding every instruction from memory, with byte-per-pixel
+// graphics. It is kept only as the baseline for chip8-bench dispatch, with
+// indices masked so any ROM runs, timers ticked per frame like the engines
+// it is compared with, unknown opcodes ignored rather than printed, and the
+// Super-CHIP mode instructions left out.
+class SwitchInterpreter {
+    private:
+        uint16_t opcode;
+        uint16_t I;
+        uint16_t pc;
+        std::array<uint8_t, 4096> memory;
+        std::array<uint8_t, 16> V;
+        std::array<uint16_t, 16> stack;
+        uint16_t sp;
+        uint8_t delay_timer;
+        uint8_t sound_timer;
+        std::array<uint8_t, 16> keys;
+        std::array<uint8_t, 64 * 32> gfx;
+        bool draw_flag;
+
+    public:
+        bool is_running;
+
+        SwitchInterpreter(const std::vector<uint8_t>& rom)
+            : opcode {0}
+            , I {0}
+            , pc {0x200}
+            , sp {0}
+            , delay_timer {0}
+            , sound_timer {0}
+            , draw_flag {false}
+            , is_running {true}
+        {
+            stack.fill(0);
+            memory.fill(0);
+            V.fill(0);
+            keys.fill(0);
+            gfx.fill(0);
+            std::copy(fontset.begin(), fontset.end(), memory.begin());
+            std::copy(rom.begin(), rom.begin() + std::min<size_t>(rom.size(), 4096 - 0x200),
+                      memory.begin() + 0x200);
+        }
+
+        void tick_timers() {
+            if (delay_timer > 0) delay_timer--;
+            if (sound_timer > 0) sound_timer--;
+        }
+
+        void cycle() {
+            opcode = memory[pc & 0xFFF] << 8 | memory[(pc + 1) & 0xFFF];
+
+            uint8_t x = (opcode & 0x0F00) >> 8;
+            uint8_t y = (opcode & 0x00F0) >> 4;
+            uint16_t nnn = opcode & 0x0FFF;
+            uint16_t nn = opcode & 0x00FF;
+            uint16_t n = opcode & 0x000F;
+
+            bool increment_pc = true;
+
+            switch (opcode & 0xF000) {
+                case 0x0000:
+                    switch (opcode & 0x00FF) {
+                        case 0x00E0:
+                            gfx.fill(0);
+                            draw_flag = true;
+                            break;
+                        case 0x00EE:
+                            sp = (sp - 1) & 0xF;
+                            pc = stack[sp];
+                            break;
+                        case 0x00FD:
+                            is_running = false;
+                            break;
+                    }
+                    break;
+                case 0x1000:
+                    pc = nnn;
+                    increment_pc = false;
+                    break;
+                case 0x2000:
+                    stack[sp] = pc;
+                    sp = (sp + 1) & 0xF;
+                    pc = nnn;
+                    increment_pc = false;
+                    break;
+                case 0x3000:
+                    if (V[x] == nn) pc += 2;
+                    break;
+                case 0x4000:
+                    if (V[x] != nn) pc += 2;
+                    break;
+                case 0x5000:
+                    if (V[x] == V[y]) pc += 2;
+                    break;
+                case 0x6000:
+                    V[x] = nn;
+                    break;
+                case 0x7000:
+                    V[x] += nn;
+                    break;
+                case 0x8000:
+                    switch (opcode & 0x000F) {
+                        case 0x0000: V[x] = V[y]; break;
+                        case 0x0001: V[x] |= V[y]; break;
+                        case 0x0002: V[x] &= V[y]; break;
+                        case 0x0003: V[x] ^= V[y]; break;
+                        case 0x0004:
+                            V[x] += V[y];
+                            V[0xF] = V[y] > (0xFF - V[x]) ? 1 : 0;
+                            break;
+                        case 0x0005:
+                            V[0xF] = V[y] > V[x] ? 0 : 1;
+                            V[x] -= V[y];
+                            break;
+                        case 0x0006:
+                            V[0xF] = V[x] & 0x1;
+                            V[x] >>= 1;
+                            break;
+                        case 0x0007:
+                            V[0xF] = V[x] > V[y] ? 0 : 1;
+                            V[x] = V[y] - V[x];
+                            break;
+                        case 0x000E:
+                            V[0xF] = V[x] >> 7;
+                            V[x] <<= 1;
+                            break;
+                    }
+                    break;
+                case 0x9000:
+                    if (V[x] != V[y]) pc += 2;
+                    break;
+                case 0xA000:
+                    I = nnn;
+                    break;
+                case 0xB000:
+                    pc = nnn + V[0];
+                    increment_pc = false;
+                    break;
+                case 0xC000:
+                    V[x] = (rand() % 256) & nn;
+                    break;
+                case 0xD000:
+                    V[0xF] = 0;
+                    for (int yline = 0; yline < n; yline++) {
+                        uint16_t pixel = memory[(I + yline) & 0xFFF];
+                        for (int xline = 0; xline < 8; xline++) {
+                            if ((pixel & (0x80 >> xline)) != 0) {
+                                int at = (V[x] + xline + (V[y] + yline) * 64) & 0x7FF;
+                                if (gfx[at] == 1) V[0xF] = 1;
+                                gfx[at] ^= 1;
+                            }
+                        }
+                    }
+                    draw_flag = true;
+                    break;
+                case 0xE000:
+                    switch (opcode & 0x00FF) {
+                        case 0x009E:
+                            if (keys[V[x] & 0xF] != 0) pc += 2;
+                            break;
+                        case 0x00A1:
+                            if (keys[V[x] & 0xF] == 0) pc += 2;
+                            break;
+                    }
+                    break;
+                case 0xF000:
+                    switch (opcode & 0x00FF) {
+                        case 0x0007:
+                            V[x] = delay_timer;
+                            break;
+                        case 0x000A: {
+                            bool key_pressed = false;
+                            for (int i = 0; i < 16; i++) {
+                                if (keys[i] != 0) {
+                                    V[x] = i;
+                                    key_pressed = true;
+                                }
+                            }
+                            if (!key_pressed) return;
+                            break;
+                        }
+                        case 0x0015:
+                            delay_timer = V[x];
+                            break;
+                        case 0x0018:
+                            sound_timer = V[x];
+                            break;
+                        case 0x001E:
+                            V[0xF] = I + V[x] > 0xFFF ? 1 : 0;
+                            I += V[x];
+                            break;
+                        case 0x0029:
+                            I = V[x] * 5;
+                            break;
+                        case 0x0033:
+                            memory[I & 0xFFF]       = V[x] / 100;
+                            memory[(I + 1) & 0xFFF] = (V[x] / 10) % 10;
+                            memory[(I + 2) & 0xFFF] = (V[x] % 100) % 10;
+                            break;
+                        case 0x0055:
+                            for (int i = 0; i <= x; i++) memory[(I + i) & 0xFFF] = V[i];
+                            break;
+                        case 0x0065:
+                            for (int i = 0; i <= x; i++) V[i] = memory[(I + i) & 0xFFF];
+                            break;
+                    }
+                    break;
+            }
+
+            if (increment_pc) pc += 2;
+        }
+};
+
+// Run the switch interpreter as measure_mips runs a Chip8
+static double measure_switch_mips(const std::vector<uint8_t>& rom, uint64_t cycles) {
+    auto machine = std::make_unique<SwitchInterpreter>(rom);
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t executed = 0;
+    while (executed < cycles && machine->is_running) {
+        machine->cycle();
+        if (++executed % DEFAULT_INSTRUCTIONS_PER_FRAME == 0) {
+            machine->tick_timers();
+        }
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    return executed / elapsed.count() / 1e6;
+}
+
+// Compare the predecoded interpreter against decoding every cycle, and
+// both against the original switch interpreter
+static int bench_dispatch(int argc, char** argv) {
+    if (argc < 1) {
+        std::cout << "Usage: chip8-bench dispatch [ROM file] [cycles]"
+                  << std::endl;
+        return -1;
+    }
+
+    std::vector<uint8_t> rom;
+    if (!read_rom(argv[0], rom)) return -1;
+    uint64_t cycles = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 50000000;
+
+    double original = measure_switch_mips(rom, cycles);
+    double uncached = measure_mips<&Chip8::cycle_uncached>(rom, cycles);
+    double cached = measure_mips<&Chip8::cycle>(rom, cycles);
+
+    std::cout << std::fixed << std::setprecision(1)
+              << "original switch:    " << original << " MIPS\n"
+              << "decode every cycle: " << uncached << " MIPS ("
+              << std::setprecision(2) << uncached / original << "x)\n"
+              << std::setprecision(1)
+              << "predecoded:         " << cached << " MIPS ("
+              << std::setprecision(2) << cached / original << "x)\n";
+    return 0;
+}
+
+// Save state and rewind costs over a ROM's first frames
+static int bench_savestate(int argc, char** argv) {
+    if (argc < 1) {
+        std::cout << "Usage: chip8-bench savestate [ROM file] [frames]"
+                  << std::endl;
+        return -1;
+    }
+
+    std::vector<uint8_t> rom;
+    if (!read_rom(argv[0], rom)) return -1;
+    int frames = argc > 1 ? std::atoi(argv[1]) : 3600;
+
+    auto chip8 = std::make_unique<Chip8>();
+    chip8->load(rom.data(), rom.size());
+
+    // Ten minutes of history at the default frame rate easily fits
+    Rewind rewind(16 << 20);
+    std::vector<uint8_t> state;
+    std::chrono::duration<double, std::nano> save_time {0}, load_time {0};
+    std::chrono::duration<double, std::nano> capture_time {0}, restore_time {0};
+
+    for (int frame = 0; frame < frames; frame++) {
+        for (int i = 0; i < DEFAULT_INSTRUCTIONS_PER_FRAME; i++) {
+            chip8->cycle();
+        }
+        chip8->tick_timers();
+
+        auto start = std::chrono::steady_clock::now();
+        chip8->save_state(state);
+        auto saved = std::chrono::steady_clock::now();
+        chip8->load_state(state.data(), state.size());
+        auto loaded = std::chrono::steady_clock::now();
+        rewind.capture(*chip8);
+        auto captured = std::chrono::steady_clock::now();
+
+        save_time += saved - start;
+        load_time += loaded - saved;
+        capture_time += captured - loaded;
+    }
+
+    double bytes_per_frame = double(rewind.bytes()) / rewind.frames();
+
+    // Scrub backwards through the whole history, one frame at a time
+    int restored = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (rewind.frames() > 1 && rewind.restore(*chip8, 1)) {
+        restored++;
+    }
+    restore_time = std::chrono::steady_clock::now() - start;
+
+    std::cout << std::fixed << std::setprecision(0)
+              << "state size:      " << state.size() << " bytes\n"
+              << "save_state:      " << save_time.count() / frames << " ns\n"
+              << "load_state:      " << load_time.count() / frames << " ns\n"
+              << "rewind capture:  " << capture_time.count() / frames << " ns\n"
+              << "rewind restore:  " << restore_time.count() / restored << " ns\n"
+              << std::setprecision(1)
+              << "rewind storage:  " << bytes_per_frame
+              << " bytes/frame over " << frames << " frames\n";
+    return 0;
+}
+
+// Median and standard deviation of repeated measurements
+struct Stats {
+    double median;
+    double stddev;
+};
+
+static Stats stats(std::vector<double> samples) {
+    std::sort(samples.begin(), samples.end());
+    size_t n = samples.size();
+    double median = n % 2 ? samples[n / 2]
+                          : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+
+    double mean = 0;
+    for (double sample : samples) mean += sample;
+    mean /= n;
+    double variance = 0;
+    for (double sample : samples) variance += (sample - mean) * (sample - mean);
+
+    return {median, n > 1 ? std::sqrt(variance / (n - 1)) : 0.0};
+}
+
+// Scripted keypad input: every key in turn, held for 6 frames and then
+// released for 4, so input-driven ROMs get past their title screens
+static uint16_t scripted_keys(uint64_t frame) {
+    int key = (frame / 10 * 7) % 16;
+    return frame % 10 < 6 ? 1 << key : 0;
+}
+
+// Convert dirty rows to ARGB pixels the way the display upload does, so
+// renderer changes show up in frames/sec
+template <size_t Words>
+static void render_rows(const std::array<uint64_t, Words>& gfx, int width,
+                        int height, uint64_t dirty_rows,
+                        std::vector<uint32_t>& pixels) {
+    const int words_per_row = width / 64;
+    for (int y = 0; y < height; y++) {
+        if ((dirty_rows >> y & 1) == 0) continue;
+        uint32_t* line = &pixels[y * width];
+        for (int word = 0; word < words_per_row; word++) {
+            uint64_t low = gfx[y * words_per_row + word];
+            uint64_t high = gfx[Words / 2 + y * words_per_row + word];
+            for (int x = 0; x < 64; x++) {
+                int colour = (low >> (63 - x) & 1) | (high >> (63 - x) & 1) << 1;
+                line[word * 64 + x] = PALETTE[colour];
+            }
+        }
+    }
+}
+
+// Settings a ROM runs with, from the database as in chip8
+static void rom_settings(const std::vector<uint8_t>& rom, const RomDatabase& database,
+                            bool& xo_chip, uint32_t& quirks, int& instructions_per_frame) {
+    const RomInfo* info = database.find(hash64(rom.data(), rom.size()));
+    xo_chip = info != nullptr && info->platform == Platform::XoChip;
+    quirks = info != nullptr ? rom_quirks(*info) : PROFILE_CHIP8;
+    instructions_per_frame = info != nullptr ? info->instructions_per_frame
+                                             : DEFAULT_INSTRUCTIONS_PER_FRAME;
+}
+
+struct SuiteRun {
+    uint64_t instructions;
+    uint64_t frames;
+    uint64_t draws;
+    uint64_t screens;       // Hash of every frame's screen hash in turn
+    double seconds;
+};
+
+// One timed run of a ROM for a fixed number of frames with scripted input
+static SuiteRun run_suite_rom(const std::vector<uint8_t>& rom, int frames,
+                              bool xo_chip, uint32_t quirks, int instructions_per_frame,
+                              std::vector<uint32_t>& pixels) {
+    auto chip8 = std::make_unique<Chip8>(1, xo_chip, quirks);
+    chip8->load(rom.data(), rom.size());
+
+    SuiteRun run {0, 0, 0, 0, 0.0};
+    uint64_t screen = screen_hash(*chip8);
+    auto start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < frames && chip8->is_running; frame++) {
+        chip8->set_key_mask(scripted_keys(frame));
+        for (int i = 0; i < instructions_per_frame && chip8->is_running; i++) {
+            chip8->cycle();
+            run.instructions++;
+        }
+        chip8->tick_timers();
+        run.frames++;
+
+        if (chip8->draw_flag) {
+            chip8->draw_flag = false;
+            if (chip8->extended_resolution) {
+                render_rows(chip8->gfx_extended, 128, 64, chip8->dirty_rows, pixels);
+            } else {
+                render_rows(chip8->gfx, 64, 32, chip8->dirty_rows, pixels);
+            }
+            chip8->dirty_rows = 0;
+            run.draws++;
+            screen = screen_hash(*chip8);
+        }
+        run.screens = hash64(&screen, sizeof(screen), run.screens);
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    run.seconds = elapsed.count();
+    return run;
+}
+
+// Seconds to run a synthetic loop that draws a font sprite at a moving
+// position. Without draw the DXYN becomes a 6XNN, so the difference
+// between the two is the cost of the draw itself.
+static double time_draw_loop(bool draw, uint64_t iterations) {
+    const uint8_t loop[] = {
+        0x60, 0x00,                     // 200: V0 = 0
+        0x61, 0x00,                     // 202: V1 = 0
+        0xA0, 0x00,                     // 204: I = font
+        uint8_t(draw ? 0xD0 : 0x6F),    // 206: DXYN V0, V1, 5 or VF = 0
+        uint8_t(draw ? 0x15 : 0x00),
+        0x70, 0x03,                     // 208: V0 += 3
+        0x71, 0x05,                     // 20A: V1 += 5
+        0x12, 0x06                      // 20C: jump 206
+    };
+    auto chip8 = std::make_unique<Chip8>(1);
+    chip8->load(loop, sizeof(loop));
+    for (int i = 0; i < 3; i++) chip8->cycle();
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < iterations * 4; i++) {
+        chip8->cycle();
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+// Escape a string for a JSON string literal
+static std::string json_string(const std::string& text) {
+    std::string escaped = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') escaped += '\\';
+        escaped += c;
+    }
+    return escaped + "\"";
+}
+
+static void write_stats(std::ostream& out, const char* key, Stats value) {
+    out << "\"" << key << "\": {\"median\": " << value.median
+        << ", \"stddev\": " << value.stddev << "}";
+}
+
+// Read the median of the given metric from a line of suite JSON output.
+// Only handles the layout bench_suite writes, one result per line.
+static bool read_median(const std::string& line, const char* key,
+                        double& value) {
+    std::string prefix = std::string("\"") + key + "\": {\"median\": ";
+    size_t at = line.find(prefix);
+    if (at == std::string::npos) return false;
+    value = std::strtod(line.c_str() + at + prefix.size(), nullptr);
+    return true;
+}
+
+struct Baseline {
+    std::map<std::string, double> instructions_per_sec;
+    std::map<std::string, double> frames_per_sec;
+    std::map<std::string, std::string> screens;
+    double dxyn_ns = 0;
+};
+
+static bool read_baseline(const char* filepath, Baseline& baseline) {
+    std::ifstream file(filepath);
+    if (!file) {
+        std::cerr << "Error: Failed to open baseline " << filepath << std::endl;
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(file, line)) {
+        const std::string key = "\"rom\": ";
+        size_t at = line.find(key);
+        if (at != std::string::npos) {
+            // Names stay escaped; they are compared against escaped names
+            size_t start = at + key.size();
+            size_t end = start + 1;
+            while (end < line.size() && line[end] != '"') {
+                end += line[end] == '\\' ? 2 : 1;
+            }
+            std::string name = line.substr(start, end + 1 - start);
+            read_median(line, "instructions_per_sec",
+                        baseline.instructions_per_sec[name]);
+            read_median(line, "frames_per_sec", baseline.frames_per_sec[name]);
+
+            const std::string screens = "\"screens\": \"";
+            size_t hash = line.find(screens);
+            if (hash != std::string::npos) {
+                baseline.screens[name] = line.substr(hash + screens.size(), 16);
+            }
+        }
+        read_median(line, "dxyn_ns", baseline.dxyn_ns);
+    }
+    return true;
+}
+
+// Report a change against the baseline; returns true if it is a
+// regression beyond threshold percent
+static bool compare(const std::string& name, const char* metric, double now,
+                    double before, bool higher_is_better, double threshold) {
+    if (before <= 0) return false;
+    double change = (now - before) / before * 100;
+    bool regressed = higher_is_better ? change < -threshold : change > threshold;
+    if (regressed) {
+        std::cout << "REGRESSION " << name << " " << metric << ": "
+                  << std::setprecision(1) << std::showpos << change
+                  << std::noshowpos << "%\n";
+    }
+    return regressed;
+}
+
+// Run every ROM in the corpus directories with scripted input, warm-up and
+// repeated timed runs, write the results as JSON and optionally fail on a
+// regression against a baseline written by an earlier run
+static int bench_suite(int argc, char** argv) {
+    int frames = 3000;
+    int instructions_per_frame = 0;     // From the ROM database
+    int repetitions = 10;
+    int warmup = 2;
+    double threshold = 10;
+    const char* out_path = "bench.json";
+    const char* baseline_path = nullptr;
+    const char* database_path = nullptr;
+    std::vector<std::string> dirs;
+
+    for (int i = 0; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (std::strcmp(argv[i], "--frames") == 0 && has_value) {
+            frames = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--db") == 0 && has_value) {
+            database_path = argv[++i];
+        } else if (std::strcmp(argv[i], "--ipf") == 0 && has_value) {
+            instructions_per_frame = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--reps") == 0 && has_value) {
+            repetitions = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--warmup") == 0 && has_value) {
+            warmup = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--out") == 0 && has_value) {
+            out_path = argv[++i];
+        } else if (std::strcmp(argv[i], "--baseline") == 0 && has_value) {
+            baseline_path = argv[++i];
+        } else if (std::strcmp(argv[i], "--threshold") == 0 && has_value) {
+            threshold = std::atof(argv[++i]);
+        } else if (argv[i][0] != '-') {
+            dirs.push_back(argv[i]);
+        } else {
+            std::cout << "Usage: chip8-bench suite [--frames n] [--ipf n] "
+                         "[--reps n] [--warmup n] [--out file] "
+                         "[--baseline file] [--threshold percent] "
+                         "[--db ROM database] [ROM directories]" << std::endl;
+            return -1;
+        }
+    }
+    if (frames <= 0 || instructions_per_frame < 0 || repetitions <= 0
+        || warmup < 0) {
+        std::cerr << "Error: Counts must be positive" << std::endl;
+        return -1;
+    }
+    if (dirs.empty()) dirs = {"roms", "roms/super-chip"};
+
+    Baseline baseline;
+    if (baseline_path != nullptr && !read_baseline(baseline_path, baseline)) {
+        return -1;
+    }
+
+    RomDatabase database;
+    if (!database.load(database_path ? database_path : DEFAULT_ROM_DATABASE,
+                       database_path != nullptr)) {
+        return -1;
+    }
+    std::vector<std::string> roms;
+    if (!list_roms(dirs, roms)) return -1;
+
+    std::ofstream out(out_path);
+    if (!out) {
+        std::cerr << "Error: Failed to write " << out_path << std::endl;
+        return -1;
+    }
+    out << std::setprecision(6)
+        << "{\n"
+        << "  \"frames\": " << frames << ",\n"
+        << "  \"repetitions\": " << repetitions << ",\n"
+        << "  \"warmup\": " << warmup << ",\n"
+        << "  \"results\": [\n";
+
+    bool regressed = false;
+    std::vector<uint32_t> pixels(128 * 64);
+    std::cout << std::left << std::setw(28) << "rom" << std::right
+              << std::setw(14) << "MIPS" << std::setw(14) << "frames/s" << "\n";
+
+    for (size_t r = 0; r < roms.size(); r++) {
+        std::vector<uint8_t> rom;
+        if (!read_rom(roms[r].c_str(), rom)) return -1;
+
+        // Each ROM runs as chip8 would run it, unless --ipf overrides the
+        // database's instructions per frame
+        bool xo_chip;
+        uint32_t quirks;
+        int rom_instructions_per_frame;
+        rom_settings(rom, database, xo_chip, quirks, rom_instructions_per_frame);
+        if (instructions_per_frame > 0) rom_instructions_per_frame = instructions_per_frame;
+
+        SuiteRun run {};
+        std::vector<double> instructions_per_sec, frames_per_sec;
+        for (int i = 0; i < warmup + repetitions; i++) {
+            run = run_suite_rom(rom, frames, xo_chip, quirks, rom_instructions_per_frame, pixels);
+            if (i < warmup) continue;
+            instructions_per_sec.push_back(run.instructions / run.seconds);
+            frames_per_sec.push_back(run.frames / run.seconds);
+        }
+        Stats ips = stats(instructions_per_sec);
+        Stats fps = stats(frames_per_sec);
+
+        std::string name = json_string(roms[r]);
+        std::ostringstream screens;
+        screens << std::hex << std::setw(16) << std::setfill('0') << run.screens;
+        out << "    {\"rom\": " << name
+            << ", \"instructions\": " << run.instructions
+            << ", \"instructions_per_frame\": " << rom_instructions_per_frame
+            << ", \"frames\": " << run.frames
+            << ", \"draws\": " << run.draws
+            << ", \"screens\": \"" << screens.str() << "\", ";
+        write_stats(out, "instructions_per_sec", ips);
+        out << ", ";
+        write_stats(out, "frames_per_sec", fps);
+        out << "}" << (r + 1 < roms.size() ? "," : "") << "\n";
+
+        std::cout << std::left << std::setw(28) << roms[r] << std::right
+                  << std::fixed << std::setprecision(1)
+                  << std::setw(14) << ips.median / 1e6
+                  << std::setw(14) << fps.median << "\n";
+
+        if (baseline.instructions_per_sec.count(name) != 0) {
+            regressed |= compare(roms[r], "instructions/sec", ips.median,
+                                 baseline.instructions_per_sec[name],
+                                 true, threshold);
+            regressed |= compare(roms[r], "frames/sec", fps.median,
+                                 baseline.frames_per_sec[name], true, threshold);
+        }
+
+        // The same settings must give the same pictures, however fast
+        if (baseline.screens.count(name) != 0 && baseline.screens[name] != screens.str()) {
+            std::cout << "MISMATCH " << roms[r] << " screens differ from the baseline\n";
+            regressed = true;
+        }
+    }
+
+    // ns per DXYN from the synthetic draw loop minus its baseline loop
+    const uint64_t iterations = 1000000;
+    std::vector<double> dxyn_ns;
+    for (int i = 0; i < warmup + repetitions; i++) {
+        double with_draw = time_draw_loop(true, iterations);
+        double without_draw = time_draw_loop(false, iterations);
+        if (i >= warmup) {
+            dxyn_ns.push_back((with_draw - without_draw) / iterations * 1e9);
+        }
+    }
+    Stats dxyn = stats(dxyn_ns);
+
+    out << "  ],\n  ";
+    write_stats(out, "dxyn_ns", dxyn);
+    out << "\n}\n";
+
+    std::cout << "DXYN: " << std::setprecision(1) << dxyn.median << " ns (+/- "
+              << dxyn.stddev << ")\n";
+    regressed |= compare("DXYN", "ns", dxyn.median, baseline.dxyn_ns, false,
+                         threshold);
+
+    if (!out) {
+        std::cerr << "Error: Failed to write " << out_path << std::endl;
+        return -1;
+    }
+    return regressed ? 1 : 0;
+}
+
+// Profile a ROM over a number of frames with the suite's scripted input
+static int bench_profile(int argc, char** argv) {
+    if (argc < 1) {
+        std::cout << "Usage: chip8-bench profile [ROM file] [frames] "
+                     "[output prefix]" << std::endl;
+        return -1;
+    }
+
+    std::vector<uint8_t> rom;
+    if (!read_rom(argv[0], rom)) return -1;
+    int frames = argc > 1 ? std::atoi(argv[1]) : 3600;
+
+    auto chip8 = std::make_unique<Chip8>(1);
+    chip8->load(rom.data(), rom.size());
+    auto profiler = std::make_unique<Profiler>();
+
+    for (int frame = 0; frame < frames && chip8->is_running; frame++) {
+        chip8->set_key_mask(scripted_keys(frame));
+        for (int i = 0; i < DEFAULT_INSTRUCTIONS_PER_FRAME && chip8->is_running; i++) {
+            profiler->cycle(*chip8);
+        }
+        chip8->tick_timers();
+        if (chip8->draw_flag) {
+            chip8->draw_flag = false;
+            profiler->present();
+        }
+    }
+
+    profiler->write_flat(std::cout);
+    if (argc > 2) {
+        std::string prefix = argv[2];
+        std::ofstream json(prefix + ".json");
+        std::ofstream flat(prefix + ".txt");
+        profiler->write_json(json);
+        profiler->write_flat(flat);
+        if (!json || !flat) {
+            std::cerr << "Error: Failed to write profile " << prefix << std::endl;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Many copies of a ROM with different seeds and the suite's scripted
+// input, as separate machines and as one lock-step batch, each timed over
+// several fresh runs and compared by median. Every lane must end in the
+// same state as its separate machine.
+static int bench_batch(int argc, char** argv) {
+    if (argc < 1) {
+        std::cout << "Usage: chip8-bench batch [ROM file] [lanes] [frames] [repetitions]"
+                  << std::endl;
+        return -1;
+    }
+
+    std::vector<uint8_t> rom;
+    if (!read_rom(argv[0], rom)) return -1;
+    size_t lanes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 64;
+    int frames = argc > 2 ? std::atoi(argv[2]) : 600;
+    int repetitions = argc > 3 ? std::atoi(argv[3]) : 5;
+    if (lanes == 0 || frames <= 0 || repetitions <= 0) return -1;
+
+    std::vector<uint64_t> seeds;
+    for (size_t lane = 0; lane < lanes; lane++) seeds.push_back(lane + 1);
+
+    std::vector<double> separate_sec, batched_sec;
+    std::vector<std::unique_ptr<Chip8>> machines;
+    std::unique_ptr<Batch> batch;
+    uint64_t instructions = 0;
+    for (int repetition = 0; repetition < repetitions; repetition++) {
+        machines.clear();
+        for (uint64_t seed : seeds) {
+            machines.push_back(std::make_unique<Chip8>(seed));
+            machines.back()->load(rom.data(), rom.size());
+        }
+        instructions = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int frame = 0; frame < frames; frame++) {
+            for (auto& chip8 : machines) {
+                chip8->set_key_mask(scripted_keys(frame));
+                for (int i = 0; i < DEFAULT_INSTRUCTIONS_PER_FRAME && chip8->is_running; i++) {
+                    chip8->cycle();
+                    instructions++;
+                }
+                chip8->tick_timers();
+            }
+        }
+        std::chrono::duration<double> separate = std::chrono::steady_clock::now() - start;
+        separate_sec.push_back(separate.count());
+
+        batch = std::make_unique<Batch>(seeds);
+        batch->load(rom.data(), rom.size());
+        start = std::chrono::steady_clock::now();
+        for (int frame = 0; frame < frames; frame++) {
+            for (size_t lane = 0; lane < lanes; lane++) {
+                batch->set_key_mask(lane, scripted_keys(frame));
+            }
+            batch->run(DEFAULT_INSTRUCTIONS_PER_FRAME);
+            batch->tick_timers();
+        }
+        std::chrono::duration<double> batched = std::chrono::steady_clock::now() - start;
+        batched_sec.push_back(batched.count());
+    }
+    double separate = stats(separate_sec).median;
+    double batched = stats(batched_sec).median;
+
+    size_t mismatched = 0;
+    for (size_t lane = 0; lane < lanes; lane++) {
+        if (!batch->machine(lane).state_equals(*machines[lane])) mismatched++;
+    }
+
+    double steps = batch->get_vector_cycles() + batch->get_scalar_cycles();
+    std::cout << std::fixed << std::setprecision(1)
+              << "separate machines: " << instructions / separate / 1e6 << " MIPS\n"
+              << "lock-step batch:   " << instructions / batched / 1e6 << " MIPS ("
+              << std::setprecision(2) << separate / batched << "x), "
+              << std::setprecision(1) << batch->get_vector_cycles() / steps * 100
+              << "% of cycles vectorized\n"
+              << "lanes matching:    " << lanes - mismatched << "/" << lanes << std::endl;
+    return mismatched == 0 ? 0 : 1;
+}
+
+// Words in a C API screen of the given size, both planes
+static size_t screen_words(int width, int height) {
+    return size_t(width / 64) * height * 2;
+}
+
+// Drive environments through the C API as an agent would, a few frames per
+// action with a reset every episode. Checks that stepping them together
+// matches stepping each alone and that a reset replays an episode exactly.
+static int bench_env(int argc, char** argv) {
+    if (argc < 1) {
+        std::cout << "Usage: chip8-bench env [ROM file] [environments] [steps]"
+                  << std::endl;
+        return -1;
+    }
+
+    std::vector<uint8_t> rom;
+    if (!read_rom(argv[0], rom)) return -1;
+    size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 64;
+    int steps = argc > 2 ? std::atoi(argv[2]) : 1000;
+    const int frames_per_step = 4;
+    const int episode = 250;
+    if (count == 0 || steps <= 0) return -1;
+
+    std::vector<chip8_env*> together, alone;
+    for (size_t i = 0; i < count; i++) {
+        together.push_back(chip8_create(rom.data(), rom.size(), i + 1, nullptr));
+        alone.push_back(chip8_create(rom.data(), rom.size(), i + 1, nullptr));
+        if (!together.back() || !alone.back()) return -1;
+        chip8_watch(together.back(), 0x200, 2);
+    }
+
+    std::vector<uint16_t> keys(count);
+    std::vector<const uint64_t*> screens(count);
+    std::vector<uint64_t> first_episode;
+    auto start = std::chrono::steady_clock::now();
+    for (int step = 0; step < steps; step++) {
+        if (step > 0 && step % episode == 0) {
+            for (size_t i = 0; i < count; i++) chip8_reset(together[i], i + 1);
+        }
+        for (size_t i = 0; i < count; i++) keys[i] = scripted_keys(step + i);
+        chip8_step_many(together.data(), keys.data(), count, frames_per_step, screens.data());
+
+        if (step == std::min(steps, episode) - 1) {
+            int width, height;
+            const uint64_t* screen = chip8_screen(together[0], &width, &height);
+            first_episode.assign(screen, screen + screen_words(width, height));
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    // The same steps and resets, one environment at a time
+    size_t mismatched = 0;
+    for (size_t i = 0; i < count; i++) {
+        for (int step = 0; step < steps; step++) {
+            if (step > 0 && step % episode == 0) chip8_reset(alone[i], i + 1);
+            chip8_step(alone[i], scripted_keys(step + i), frames_per_step);
+        }
+        int width, height;
+        const uint64_t* a = chip8_screen(together[i], &width, &height);
+        const uint64_t* b = chip8_screen(alone[i], nullptr, nullptr);
+        size_t size;
+        const uint8_t* memory = chip8_memory(together[i], &size);
+        const uint8_t* other = chip8_memory(alone[i], nullptr);
+        if (!std::equal(a, a + screen_words(width, height), b)
+            || !std::equal(memory, memory + size, other)) {
+            mismatched++;
+        }
+    }
+
+    // A reset followed by the first episode's keys gives its last screen
+    chip8_reset(alone[0], 1);
+    for (int step = 0; step < std::min(steps, episode); step++) {
+        chip8_step(alone[0], scripted_keys(step), frames_per_step);
+    }
+    int width, height;
+    const uint64_t* screen = chip8_screen(alone[0], &width, &height);
+    bool replayed = std::equal(first_episode.begin(), first_episode.end(), screen)
+                 && first_episode.size() == screen_words(width, height);
+
+    double frames = double(count) * steps * frames_per_step;
+    std::cout << std::fixed << std::setprecision(1)
+              << "environments:      " << count << ", " << frames_per_step
+              << " frames per step\n"
+              << "throughput:        " << frames / elapsed.count() / 1e6 << "M frames/s, "
+              << frames / elapsed.count() * 3600 / 1e9 << "G frames/hour\n"
+              << "step latency:      " << elapsed.count() / (double(count) * steps) * 1e9
+              << " ns\n"
+              << "step_many matches: " << count - mismatched << "/" << count << "\n"
+              << "reset replays:     " << (replayed ? "yes" : "no") << std::endl;
+
+    for (size_t i = 0; i < count; i++) {
+        chip8_destroy(together[i]);
+        chip8_destroy(alone[i]);
+    }
+    return mismatched == 0 && replayed ? 0 : 1;
+}
+
+// Run a ROM with the suite's scripted input one instruction at a time and
+// through Chip8::run, which skips idle loops. Both must end in the same
+// state; the speedup is what the skipping saves.
+static int bench_idle(int argc, char** argv) {
+    if (argc < 1) {
+        std::cout << "Usage: chip8-bench idle [ROM file] [frames] [instructions per frame]"
+                  << std::endl;
+        return -1;
+    }
+
+    std::vector<uint8_t> rom;
+    if (!read_rom(argv[0], rom)) return -1;
+    int frames = argc > 1 ? std::atoi(argv[1]) : 600;
+    int ipf = argc > 2 ? std::atoi(argv[2]) : 1000;
+
+    auto plain = std::make_unique<Chip8>(1);
+    auto skipping = std::make_unique<Chip8>(1);
+    plain->load(rom.data(), rom.size());
+    skipping->load(rom.data(), rom.size());
+
+    uint64_t instructions = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < frames; frame++) {
+        plain->set_key_mask(scripted_keys(frame));
+        for (int i = 0; i < ipf && plain->is_running; i++) {
+            plain->cycle();
+            instructions++;
+        }
+        plain->tick_timers();
+    }
+    std::chrono::duration<double> cycled = std::chrono::steady_clock::now() - start;
+
+    uint64_t counted = 0;
+    start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < frames; frame++) {
+        skipping->set_key_mask(scripted_keys(frame));
+        counted += skipping->run(ipf);
+        skipping->tick_timers();
+    }
+    std::chrono::duration<double> ran = std::chrono::steady_clock::now() - start;
+
+    bool matching = skipping->state_equals(*plain) && counted == instructions;
+    std::cout << std::fixed << std::setprecision(1)
+              << "cycle():     " << instructions / cycled.count() / 1e6 << " MIPS\n"
+              << "run():       " << instructions / ran.count() / 1e6 << " MIPS ("
+              << std::setprecision(2) << cycled.count() / ran.count() << "x)\n"
+              << "final state: " << (matching ? "identical" : "DIFFERENT") << std::endl;
+    return matching ? 0 : 1;
+}
+
+// Decode GIF image data the way giflib does, independently of the
+// encoder: widen the codes as soon as the next free one needs it, and
+// reject a code beyond the table
+static bool gif_decode(const std::vector<uint8_t>& data, std::vector<uint8_t>& pixels,
+                       std::string& error) {
+    int min_code_size = data[0];
+    std::vector<uint8_t> codes;
+    size_t at = 1;
+    while (at < data.size() && data[at] != 0) {
+        codes.insert(codes.end(), data.begin() + at + 1, data.begin() + at + 1 + data[at]);
+        at += data[at] + 1;
+    }
+
+    const int clear = 1 << min_code_size;
+    std::vector<std::vector<uint8_t>> table;
+    int code_size = min_code_size + 1;
+    int previous = -1;
+    size_t bit = 0;
+    for (;;) {
+        if (bit + code_size > codes.size() * 8) {
+            error = "no end code";
+            return false;
+        }
+        int code = 0;
+        for (int i = 0; i < code_size; i++, bit++) {
+            code |= (codes[bit / 8] >> (bit % 8) & 1) << i;
+        }
+
+        if (code == clear) {
+            table.assign(clear + 2, {});
+            for (int i = 0; i < clear; i++) table[i] = {uint8_t(i)};
+            code_size = min_code_size + 1;
+            previous = -1;
+            continue;
+        }
+        if (code == clear + 1) return true;
+        if (code > int(table.size()) || (previous < 0 && code >= clear)) {
+            error = "bad code " + std::to_string(code) + ", table " + std::to_string(table.size());
+            return false;
+        }
+
+        if (previous >= 0) {
+            std::vector<uint8_t> entry = table[previous];
+            entry.push_back(code < int(table.size()) ? table[code][0] : entry[0]);
+            if (table.size() < 4096) table.push_back(entry);
+            if (table.size() == (1u << code_size) && code_size < 12) code_size++;
+        }
+        pixels.insert(pixels.end(), table[code].begin(), table[code].end());
+        previous = code;
+    }
+}
+
+// Round-trip random 128x64 frames, from noise to long runs, through the
+// capture's GIF encoder and an independent decoder
+static int bench_gif(int argc, char** argv) {
+    int frames = argc > 0 ? std::atoi(argv[0]) : 3000;
+    uint32_t seed = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1;
+    std::mt19937 random(seed);
+
+    int failed = 0;
+    for (int frame = 0; frame < frames; frame++) {
+        // Each pixel repeats the one before with a chance that varies by frame
+        std::uniform_int_distribution<int> percent(0, 99);
+        int repeat = percent(random);
+        std::vector<uint8_t> pixels(128 * 64);
+        for (size_t i = 0; i < pixels.size(); i++) {
+            pixels[i] = i > 0 && percent(random) < repeat ? pixels[i - 1] : random() & 3;
+        }
+
+        std::vector<uint8_t> data, decoded;
+        gif_image_data(pixels, data);
+        std::string error;
+        if (!gif_decode(data, decoded, error)) {
+            std::cout << "Frame " << frame << ": " << error << std::endl;
+            failed++;
+        } else if (decoded != pixels) {
+            std::cout << "Frame " << frame << ": decoded pixels differ" << std::endl;
+            failed++;
+        }
+    }
+    std::cout << frames - failed << " of " << frames << " frames round-trip" << std::endl;
+    return failed ? 1 : 0;
+}
+
+// Screen hash after every frame of a run with the suite's scripted input
+static std::vector<uint64_t> golden_run(const std::vector<uint8_t>& rom, int frames,
+                                        bool xo_chip, uint32_t quirks,
+                                        int instructions_per_frame) {
+    auto chip8 = std::make_unique<Chip8>(1, xo_chip, quirks);
+    chip8->load(rom.data(), rom.size());
+
+    std::vector<uint64_t> hashes;
+    uint64_t screen = screen_hash(*chip8);
+    for (int frame = 0; frame < frames && chip8->is_running; frame++) {
+        chip8->set_key_mask(scripted_keys(frame));
+        chip8->run(instructions_per_frame);
+        chip8->tick_timers();
+        if (chip8->draw_flag) {
+            chip8->draw_flag = false;
+            screen = screen_hash(*chip8);
+        }
+        hashes.push_back(screen);
+    }
+    return hashes;
+}
+
+// Golden files hold the frame count, then "<frame> <hash>" for the first
+// frame and each one whose screen differs from the frame before
+static bool write_golden(const std::string& path, const std::string& rom,
+                         const std::vector<uint64_t>& hashes) {
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path());
+    std::ofstream out(path);
+    out << "# Screen hashes of " << rom << " by frame, from chip8-bench golden --update\n"
+        << "frames " << hashes.size() << "\n" << std::hex << std::setfill('0');
+    for (size_t frame = 0; frame < hashes.size(); frame++) {
+        if (frame == 0 || hashes[frame] != hashes[frame - 1]) {
+            out << std::dec << frame << " " << std::hex << std::setw(16) << hashes[frame] << "\n";
+        }
+    }
+    if (!out) {
+        std::cerr << "Error: Failed to write " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static bool read_golden(const std::string& path, std::vector<uint64_t>& hashes) {
+    std::ifstream file(path);
+    std::string line;
+    size_t frames = 0;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        std::istringstream fields(line);
+        std::string first;
+        fields >> first;
+        if (first == "frames") {
+            fields >> frames;
+            continue;
+        }
+        size_t frame = std::strtoull(first.c_str(), nullptr, 10);
+        std::string hash;
+        fields >> hash;
+        if (frame > frames || hash.empty()) return false;
+        hashes.resize(frame, hashes.empty() ? 0 : hashes.back());
+        hashes.push_back(std::strtoull(hash.c_str(), nullptr, 16));
+    }
+    if (hashes.empty()) return false;
+    hashes.resize(frames, hashes.back());
+    return true;
+}
+
+// Replay the run on the reference interpreter up to the frame that
+// differs, and print that frame from both: '#' where they agree on a lit
+// pixel, '+' lit only here, '-' lit only in the reference, '*' both lit in
+// different colours
+static void golden_diff(const std::vector<uint8_t>& rom, size_t divergent, uint64_t expected,
+                        bool xo_chip, uint32_t quirks, int instructions_per_frame) {
+    auto chip8 = std::make_unique<Chip8>(1, xo_chip, quirks);
+    chip8->load(rom.data(), rom.size());
+    auto reference = std::make_unique<Reference>(*chip8);
+    for (size_t frame = 0; frame <= divergent; frame++) {
+        chip8->set_key_mask(scripted_keys(frame));
+        reference->set_key_mask(scripted_keys(frame));
+        chip8->run(instructions_per_frame);
+        for (int i = 0; i < instructions_per_frame; i++) reference->cycle();
+        chip8->tick_timers();
+        reference->tick_timers();
+    }
+
+    auto gfx = std::make_unique<Framebuffer>();
+    auto gfx_extended = std::make_unique<FramebufferExtended>();
+    bool extended = reference->framebuffer(*gfx, *gfx_extended);
+    bool golden = screen_hash(extended, *gfx, *gfx_extended) == expected;
+    std::cout << "  this build against the reference interpreter, which "
+              << (golden ? "matches" : "also differs from") << " the golden frame:\n";
+
+    if (extended != chip8->extended_resolution) {
+        std::cout << "  resolution differs\n";
+        return;
+    }
+    int width = extended ? 128 : 64;
+    std::vector<uint8_t> here, there;
+    if (extended) {
+        auto a = expand(chip8->gfx_extended), b = expand(*gfx_extended);
+        here.assign(a.begin(), a.end());
+        there.assign(b.begin(), b.end());
+    } else {
+        auto a = expand(chip8->gfx), b = expand(*gfx);
+        here.assign(a.begin(), a.end());
+        there.assign(b.begin(), b.end());
+    }
+    for (size_t row = 0; row < here.size() / width; row++) {
+        std::string line = "  ";
+        for (int x = 0; x < width; x++) {
+            uint8_t mine = here[row * width + x], theirs = there[row * width + x];
+            line += mine == theirs ? (mine ? '#' : '.')
+                  : !theirs ? '+' : !mine ? '-' : '*';
+        }
+        std::cout << line << "\n";
+    }
+}
+
+// Run every ROM headless with the suite's scripted input and compare the
+// screen after every frame with the golden hashes under data/golden, or
+// with --update write them
+static int bench_golden(int argc, char** argv) {
+    int frames = 600;
+    bool update = false;
+    std::string golden_dir = "data/golden";
+    const char* database_path = nullptr;
+    std::vector<std::string> dirs;
+
+    for (int i = 0; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (std::strcmp(argv[i], "--frames") == 0 && has_value) {
+            frames = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--update") == 0) {
+            update = true;
+        } else if (std::strcmp(argv[i], "--golden") == 0 && has_value) {
+            golden_dir = argv[++i];
+        } else if (std::strcmp(argv[i], "--db") == 0 && has_value) {
+            database_path = argv[++i];
+        } else if (argv[i][0] != '-') {
+            dirs.push_back(argv[i]);
+        } else {
+            std::cout << "Usage: chip8-bench golden [--update] [--frames n] "
+                         "[--golden directory] [--db ROM database] "
+                         "[ROM directories]" << std::endl;
+            return -1;
+        }
+    }
+    if (frames <= 0) {
+        std::cerr << "Error: Counts must be positive" << std::endl;
+        return -1;
+    }
+    if (dirs.empty()) dirs = {"roms", "roms/super-chip"};
+
+    RomDatabase database;
+    if (!database.load(database_path ? database_path : DEFAULT_ROM_DATABASE,
+                       database_path != nullptr)) {
+        return -1;
+    }
+    std::vector<std::string> roms;
+    if (!list_roms(dirs, roms)) return -1;
+
+    int failed = 0;
+    for (const std::string& path : roms) {
+        std::vector<uint8_t> rom;
+        if (!read_rom(path.c_str(), rom)) return -1;
+
+        bool xo_chip;
+        uint32_t quirks;
+        int instructions_per_frame;
+        rom_settings(rom, database, xo_chip, quirks, instructions_per_frame);
+        std::vector<uint64_t> hashes = golden_run(rom, frames, xo_chip, quirks,
+                                                  instructions_per_frame);
+
+        std::string golden_path = golden_dir + "/" + path + ".txt";
+        if (update) {
+            if (!write_golden(golden_path, path, hashes)) return -1;
+            continue;
+        }
+
+        std::vector<uint64_t> golden;
+        if (!read_golden(golden_path, golden)) {
+            std::cout << "MISSING " << path << ": no golden " << golden_path << "\n";
+            failed++;
+            continue;
+        }
+        size_t frame = 0;
+        while (frame < hashes.size() && frame < golden.size() && hashes[frame] == golden[frame]) {
+            frame++;
+        }
+        if (frame == hashes.size() && frame == golden.size()) {
+            std::cout << "ok       " << path << "\n";
+            continue;
+        }
+
+        failed++;
+        if (frame == hashes.size() || frame == golden.size()) {
+            std::cout << "MISMATCH " << path << ": ran " << hashes.size()
+                      << " frames, the golden has " << golden.size() << "\n";
+            continue;
+        }
+        std::cout << "MISMATCH " << path << ": first differs in frame " << frame << "\n";
+        golden_diff(rom, frame, golden[frame], xo_chip, quirks, instructions_per_frame);
+    }
+
+    if (update) {
+        std::cout << "Wrote " << roms.size() << " golden files to " << golden_dir << std::endl;
+        return 0;
+    }
+    std::cout << roms.size() - failed << " of " << roms.size() << " match" << std::endl;
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc >= 2 && std::strcmp(argv[1], "dispatch") == 0) {
+        return bench_dispatch(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && std::strcmp(argv[1], "savestate") == 0) {
+        return bench_savestate(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && std::strcmp(argv[1], "suite") == 0) {
+        return bench_suite(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && std::strcmp(argv[1], "profile") == 0) {
+        return bench_profile(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && std::strcmp(argv[1], "batch") == 0) {
+        return bench_batch(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && std::strcmp(argv[1], "env") == 0) {
+        return bench_env(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && std::strcmp(argv[1], "idle") == 0) {
+        return bench_idle(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && std::strcmp(argv[1], "golden") == 0) {
+        return bench_golden(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && std::strcmp(argv[1], "gif") == 0) {
+        return bench_gif(argc - 2, argv + 2);
+    }
+
+    std::cout << "Usage: chip8-bench dispatch|savestate|profile [ROM file] [count]\n"
+                 "       chip8-bench batch [ROM file] [lanes] [frames] [repetitions]\n"
+                 "       chip8-bench env [ROM file] [environments] [steps]\n"
+                 "       chip8-bench idle [ROM file] [frames] [instructions per frame]\n"
+                 "       chip8-bench golden [--update] [options] [ROM directories]\n"
+                 "       chip8-bench gif [frames] [seed]\n"
+                 "       chip8-bench suite [options] [ROM directories]"
+              << std::endl;
+    return -1;
+}
@@ -0,0 +1,375 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+#include "capture.h"
+
+// GIF players show frames shorter than this many centiseconds for far
+// longer, so briefer frames are left out
+const uint64_t MIN_GIF_DELAY = 2;
+
+// Colour (0-3) of a pixel, at the frame's own resolution
+static int pixel(const CaptureFrame& frame, int x, int y) {
+    int words = frame.extended_resolution ? 2 : 1;
+    int rows = frame.extended_resolution ? 64 : 32;
+    uint64_t low = frame.gfx[y * words + x / 64];
+    uint64_t high = frame.gfx[(rows + y) * words + x / 64];
+    int bit = 63 - x % 64;
+    return (low >> bit & 1) | (high >> bit & 1) << 1;
+}
+
+static void put_be32(std::vector<uint8_t>& out, uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) out.push_back(value >> shift);
+}
+
+static void put_le16(std::vector<uint8_t>& out, uint16_t value) {
+    out.push_back(value);
+    out.push_back(value >> 8);
+}
+
+static uint32_t crc32(const uint8_t* data, size_t size) {
+    static std::array<uint32_t, 256> table = [] {
+        std::array<uint32_t, 256> table;
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++) crc = crc & 1 ? 0xEDB88320 ^ crc >> 1 : crc >> 1;
+            table[i] = crc;
+        }
+        return table;
+    }();
+
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < size; i++) crc = table[(crc ^ data[i]) & 0xFF] ^ crc >> 8;
+    return crc ^ 0xFFFFFFFF;
+}
+
+static void png_chunk(std::vector<uint8_t>& out, const char* type, const std::vector<uint8_t>& data) {
+    put_be32(out, data.size());
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    put_be32(out, crc32(&out[start], out.size() - start));
+}
+
+// GIF LZW for 4 colours: 2-bit minimum code size, codes packed from the
+// least significant bit and cut into sub-blocks of up to 255 bytes
+class GifLzw {
+    private:
+        static const int MIN_CODE_SIZE = 2;
+        static const int CLEAR = 1 << MIN_CODE_SIZE;
+        static const int MAX_CODE = 4095;
+
+        std::vector<uint8_t>& out;
+        std::vector<uint8_t> block;
+        uint32_t bits;
+        int bit_count;
+
+        // Code for each string plus one more colour, or 0 if none yet
+        std::vector<std::array<uint16_t, 4>> next;
+        int code_size;
+        int last_code;
+
+        void emit(int code) {
+            bits |= uint32_t(code) << bit_count;
+            bit_count += code_size;
+            while (bit_count >= 8) {
+                byte(bits & 0xFF);
+                bits >>= 8;
+                bit_count -= 8;
+            }
+        }
+
+        void byte(uint8_t value) {
+            block.push_back(value);
+            if (block.size() == 255) flush();
+        }
+
+        void flush() {
+            if (block.empty()) return;
+            out.push_back(block.size());
+            out.insert(out.end(), block.begin(), block.end());
+            block.clear();
+        }
+
+        void reset() {
+            std::fill(next.begin(), next.end(), std::array<uint16_t, 4> {});
+            code_size = MIN_CODE_SIZE + 1;
+            last_code = CLEAR + 1;
+        }
+
+    public:
+        GifLzw(std::vector<uint8_t>& out) : out {out}, bits {0}, bit_count {0}, next(MAX_CODE + 1) {}
+
+        void encode(const std::vector<uint8_t>& pixels) {
+            out.push_back(MIN_CODE_SIZE);
+            reset();
+            emit(CLEAR);
+
+            int current = pixels[0];
+            for (size_t i = 1; i < pixels.size(); i++) {
+                uint8_t colour = pixels[i];
+                if (next[current][colour] != 0) {
+                    current = next[current][colour];
+                    continue;
+                }
+                emit(current);
+                next[current][colour] = ++last_code;
+                if (last_code >= (1 << code_size)) code_size++;
+                if (last_code == MAX_CODE) {
+                    emit(CLEAR);
+                    reset();
+                }
+                current = colour;
+            }
+
+            // The decoder adds a string for the last code too, and widens
+            // its codes if that fills the width, before it reads the clear
+            // code that lets the end code go out at the starting width
+            emit(current);
+            if (++last_code >= (1 << code_size) && code_size < 12) code_size++;
+            emit(CLEAR);
+            code_size = MIN_CODE_SIZE + 1;
+            emit(CLEAR + 1);
+            if (bit_count > 0) byte(bits & 0xFF);
+            flush();
+            out.push_back(0);
+        }
+};
+
+void gif_image_data(const std::vector<uint8_t>& pixels, std::vector<uint8_t>& out) {
+    GifLzw(out).encode(pixels);
+}
+
+Capture::Capture()
+    : format {Format::Raw}
+    , closing {false}
+    , failed {false}
+    , has_last {false}
+    , frames {0}
+    , total {0}
+    , dropped {0}
+    , has_pending {false}
+    , gif_time {0}
+{
+}
+
+Capture::~Capture() {
+    if (thread.joinable()) close();
+}
+
+bool Capture::open(const char* path) {
+    this->path = path;
+    std::string name = path;
+    auto ends_with = [&](const char* extension) {
+        size_t size = std::char_traits<char>::length(extension);
+        return name.size() >= size && name.compare(name.size() - size, size, extension) == 0;
+    };
+    format = ends_with(".gif") ? Format::Gif : ends_with(".png") ? Format::Png : Format::Raw;
+
+    if (format == Format::Png) {
+        this->path.resize(name.size() - 4);
+    } else {
+        out.open(path, std::ios::binary);
+        if (!out) {
+            std::cerr << "Error: Failed to open capture " << path << std::endl;
+            return false;
+        }
+    }
+
+    // Header, a global palette and the extension that makes the GIF loop
+    if (format == Format::Gif) {
+        std::vector<uint8_t> header = {'G', 'I', 'F', '8', '9', 'a'};
+        put_le16(header, 128);
+        put_le16(header, 64);
+        header.insert(header.end(), {0xF1, 0, 0});
+        for (uint32_t colour : PALETTE) {
+            header.insert(header.end(), {uint8_t(colour >> 16), uint8_t(colour >> 8), uint8_t(colour)});
+        }
+        const char* loop = "\x21\xFF\x0BNETSCAPE2.0\x03\x01\x00\x00\x00";
+        header.insert(header.end(), loop, loop + 19);
+        out.write(reinterpret_cast<const char*>(header.data()), header.size());
+    }
+
+    thread = std::thread(&Capture::encode, this);
+    return true;
+}
+
+void Capture::push(const Chip8& chip8) {
+    CaptureFrame frame;
+    frame.number = frames++;
+    frame.extended_resolution = chip8.extended_resolution;
+    if (frame.extended_resolution) {
+        frame.gfx = chip8.gfx_extended;
+    } else {
+        std::copy(chip8.gfx.begin(), chip8.gfx.end(), frame.gfx.begin());
+        std::fill(frame.gfx.begin() + chip8.gfx.size(), frame.gfx.end(), 0);
+    }
+
+    if (has_last && frame.extended_resolution == last.extended_resolution && frame.gfx == last.gfx) {
+        return;
+    }
+    if (!queue.push(frame)) {
+        dropped++;
+        return;
+    }
+    last = frame;
+    has_last = true;
+    wake.notify_one();
+}
+
+bool Capture::close() {
+    if (!thread.joinable()) return !failed;
+
+    total = frames;
+    closing = true;
+    wake.notify_one();
+    thread.join();
+
+    if (out.is_open()) {
+        out.close();
+        failed |= !out;
+    }
+    if (failed) std::cerr << "Error: Failed to write capture " << path << std::endl;
+    return !failed;
+}
+
+void Capture::encode() {
+    CaptureFrame frame;
+    for (;;) {
+        // Read the flag first, so a frame pushed just before closing is
+        // still found in the queue
+        bool done = closing;
+        if (queue.pop(frame)) {
+            write(frame);
+        } else if (done) {
+            break;
+        } else {
+            std::unique_lock<std::mutex> lock(wake_lock);
+            wake.wait_for(lock, std::chrono::milliseconds(10));
+        }
+    }
+
+    if (format == Format::Gif) {
+        if (has_pending) write_gif(pending, total, true);
+        out.put(0x3B);
+    }
+}
+
+void Capture::write(const CaptureFrame& frame) {
+    switch (format) {
+        case Format::Raw:
+            write_raw(frame);
+            break;
+        case Format::Png:
+            write_png(frame);
+            break;
+        case Format::Gif:
+            if (has_pending) write_gif(pending, frame.number, false);
+            pending = frame;
+            has_pending = true;
+            break;
+    }
+}
+
+void Capture::write_raw(const CaptureFrame& frame) {
+    int rows = frame.extended_resolution ? 64 : 32;
+    int words = frame.extended_resolution ? 256 : 64;
+
+    std::vector<uint8_t> data;
+    put_le16(data, frame.number);
+    put_le16(data, frame.number >> 16);
+    data.push_back(rows * 2);
+    data.push_back(rows);
+    for (int word = 0; word < words; word++) {
+        for (int shift = 56; shift >= 0; shift -= 8) data.push_back(frame.gfx[word] >> shift);
+    }
+    out.write(reinterpret_cast<const char*>(data.data()), data.size());
+}
+
+// 2-bit indexed colour, with the image data in stored (uncompressed)
+// deflate blocks so no zlib is needed
+void Capture::write_png(const CaptureFrame& frame) {
+    int width = frame.extended_resolution ? 128 : 64;
+    int height = width / 2;
+
+    std::vector<uint8_t> image;
+    for (int y = 0; y < height; y++) {
+        image.push_back(0);     // No filter
+        for (int x = 0; x < width; x += 4) {
+            image.push_back(pixel(frame, x, y) << 6 | pixel(frame, x + 1, y) << 4
+                          | pixel(frame, x + 2, y) << 2 | pixel(frame, x + 3, y));
+        }
+    }
+
+    std::vector<uint8_t> zlib = {0x78, 0x01};
+    for (size_t at = 0; at < image.size(); at += 65535) {
+        size_t size = std::min<size_t>(image.size() - at, 65535);
+        zlib.push_back(at + size == image.size());
+        put_le16(zlib, size);
+        put_le16(zlib, ~size);
+        zlib.insert(zlib.end(), image.begin() + at, image.begin() + at + size);
+    }
+    uint32_t a = 1, b = 0;
+    for (uint8_t byte : image) {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    put_be32(zlib, b << 16 | a);
+
+    std::vector<uint8_t> header;
+    put_be32(header, width);
+    put_be32(header, height);
+    header.insert(header.end(), {2, 3, 0, 0, 0});
+    std::vector<uint8_t> palette;
+    for (uint32_t colour : PALETTE) {
+        palette.insert(palette.end(), {uint8_t(colour >> 16), uint8_t(colour >> 8), uint8_t(colour)});
+    }
+
+    std::vector<uint8_t> png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    png_chunk(png, "IHDR", header);
+    png_chunk(png, "PLTE", palette);
+    png_chunk(png, "IDAT", zlib);
+    png_chunk(png, "IEND", {});
+
+    char number[16];
+    std::snprintf(number, sizeof(number), "-%06llu.png", static_cast<unsigned long long>(frame.number));
+    std::ofstream file(path + number, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(png.data()), png.size());
+    failed |= !file;
+}
+
+// A frame shown from its own number until frame until, at 60 frames a
+// second, on the 128x64 canvas
+void Capture::write_gif(const CaptureFrame& frame, uint64_t until, bool last) {
+    uint64_t end = (until * 100 + 30) / 60;
+    if (end < gif_time + MIN_GIF_DELAY) {
+        if (!last) return;
+        end = gif_time + MIN_GIF_DELAY;
+    }
+    uint16_t delay = std::min<uint64_t>(end - gif_time, 0xFFFF);
+    gif_time += delay;
+
+    std::vector<uint8_t> pixels(128 * 64);
+    int scale = frame.extended_resolution ? 1 : 2;
+    for (int y = 0; y < 64; y++) {
+        for (int x = 0; x < 128; x++) pixels[y * 128 + x] = pixel(frame, x / scale, y / scale);
+    }
+
+    // Graphic control extension with the delay, then an image descriptor
+    // covering the whole canvas
+    std::vector<uint8_t> data = {0x21, 0xF9, 4, 0};
+    put_le16(data, delay);
+    data.insert(data.end(), {0, 0, 0x2C});
+    put_le16(data, 0);
+    put_le16(data, 0);
+    put_le16(data, 128);
+    put_le16(data, 64);
+    data.push_back(0);
+    gif_image_data(pixels, data);
+
+    out.write(reinterpret_cast<const char*>(data.data()), data.size());
+    failed |= !out;
+}
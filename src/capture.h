@@ -0,0 +1,95 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "chip8.h"
+#include "spsc.h"
+
+// Screen contents of one captured frame, as the machine holds them: one bit
+// per pixel per plane. A 64x32 screen fills the first 64 words.
+struct CaptureFrame {
+    uint64_t number;        // Frames pushed before this one
+    bool extended_resolution;
+    FramebufferExtended gfx;
+};
+
+// Appends GIF image data for pixels of colours 0-3: the LZW minimum code
+// size, then the codes in sub-blocks ending with an empty one
+void gif_image_data(const std::vector<uint8_t>& pixels, std::vector<uint8_t>& out);
+
+// Records the screen to a file on a background encoder thread. The
+// emulation thread hands each frame over through a bounded lock-free queue
+// and never waits: a frame that finds the queue full is dropped and
+// counted. A frame identical to the one before is not queued at all, as
+// every frame carries its number.
+//
+// The format follows the file name:
+//  - .gif: an animated GIF at 128x64 (64x32 screens doubled), looping,
+//    each frame shown until the next different one
+//  - .png: one PNG per different frame, named <name>-<frame number>.png
+//  - anything else: raw frames, each a 4-byte little-endian frame number,
+//    the width and height in one byte each, then plane 0 and plane 1 row
+//    by row, leftmost pixel in the top bit
+class Capture {
+    private:
+        enum class Format { Raw, Png, Gif };
+
+        Format format;
+        std::string path;
+        std::ofstream out;
+
+        SpscQueue<CaptureFrame, 64> queue;
+        std::thread thread;
+        std::mutex wake_lock;
+        std::condition_variable wake;
+        std::atomic<bool> closing;
+        bool failed;
+
+        // Emulation thread
+        CaptureFrame last;      // Last frame queued
+        bool has_last;
+        uint64_t frames;
+        std::atomic<uint64_t> total;    // Frames pushed, for the encoder at close
+        uint64_t dropped;
+
+        // Encoder thread: GIF frames are written once the next one shows
+        // how long they last
+        CaptureFrame pending;
+        bool has_pending;
+        uint64_t gif_time;      // Centiseconds of GIF written so far
+
+        void encode();
+        void write(const CaptureFrame& frame);
+        void write_raw(const CaptureFrame& frame);
+        void write_png(const CaptureFrame& frame);
+        void write_gif(const CaptureFrame& frame, uint64_t until, bool last);
+
+    public:
+        Capture();
+        ~Capture();
+        Capture(const Capture&) = delete;
+        Capture& operator=(const Capture&) = delete;
+
+        // Create the output and start the encoder
+        bool open(const char* path);
+
+        // Queue the current screen as the next frame. Called once per
+        // frame from the emulation thread; never blocks.
+        void push(const Chip8& chip8);
+
+        // Encode what is queued, finish the file and stop the encoder.
+        // Returns false if anything failed to write.
+        bool close();
+
+        uint64_t frames_pushed() const { return frames; }
+        uint64_t frames_dropped() const { return dropped; }
+};
+
+#endif // CAPTURE_H
@@ -1,10 +1,11 @@
 #include <iostream>
 #include <iomanip>
-#include <fstream>
-#include <SDL2/SDL.h>
-#include <memory>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 
 #include "chip8.h"
+#include "romfile.h"
 
 // CHIP-8 fontset
 std::array<uint8_t, 80> fontset {
@@ -26,437 +27,1165 @@ std::array<uint8_t, 80> fontset {
     0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
+// Super-CHIP large fontset
+std::array<uint8_t, 160> fontset_large {
+    0x3C, 0x7E, 0xE7, 0xC3, 0xC3, 0xC3, 0xC3, 0xE7, 0x7E, 0x3C, // 0
+    0x18, 0x38, 0x58, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C, // 1
+    0x3E, 0x7F, 0xC3, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xFF, 0xFF, // 2
+    0x3C, 0x7E, 0xC3, 0x03, 0x0E, 0x0E, 0x03, 0xC3, 0x7E, 0x3C, // 3
+    0x06, 0x0E, 0x1E, 0x36, 0x66, 0xC6, 0xFF, 0xFF, 0x06, 0x06, // 4
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFE, 0x03, 0xC3, 0x7E, 0x3C, // 5
+    0x3E, 0x7C, 0xE0, 0xC0, 0xFC, 0xFE, 0xC3, 0xC3, 0x7E, 0x3C, // 6
+    0xFF, 0xFF, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x60, 0x60, // 7
+    0x3C, 0x7E, 0xC3, 0xC3, 0x7E, 0x7E, 0xC3, 0xC3, 0x7E, 0x3C, // 8
+    0x3C, 0x7E, 0xC3, 0xC3, 0x7F, 0x3F, 0x03, 0x03, 0x3E, 0x7C, // 9
+    0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+    0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+    0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+    0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+};
+
 // Constructor
-Chip8::Chip8()
-    : opcode {0}
-    , I {0}
+Chip8::Chip8(uint64_t seed, bool xo_chip, uint32_t quirks)
+    : I {0}
     , pc {0x200}
+    , memory(xo_chip ? 65536 : 4096, 0)
+    , address_mask {uint16_t(memory.size() - 1)}
+    , xo_chip {xo_chip}
+    , quirks {quirks}
     , sp {0}
     , delay_timer {0}
     , sound_timer {0}
+    , decoded(memory.size())
+    , written_start {0}
+    , written_end {0}
+    , idle_jump {false}
+    , dirty_rows {~uint64_t(0)}
     , draw_flag {false}
     , is_running {true}
+    , waiting_for_key {false}
+    , sound_on {false}
+    , audio_pitch {64}
     , extended_resolution {false}
+    , planes {1}
 {
     stack.fill(0);
-    memory.fill(0);
     V.fill(0);
+    rpl_flags.fill(0);
     gfx.fill(0);
+    gfx_extended.fill(0);
     keys.fill(0);
+    audio_pattern.fill(0xF0);   // Square wave, 500 Hz at the default pitch
+    invalidate(0, memory.size());
+    this->seed(seed);
 
-    // Load fontset into memory
+    // Load fontsets into memory
     for (int i = 0; i < 80; i++) {
         memory[i] = fontset[i];
     }
+    for (int i = 0; i < 160; i++) {
+        memory[FONT_LARGE_ADDRESS + i] = fontset_large[i];
+    }
 }
 
-// Open ROM and load into memory
+// Map the ROM file and load it into memory
 bool Chip8::load(const char* filepath) {
     std::cout << "Loading ROM: " << filepath << std::endl;
-    std::ifstream rom(filepath, std::ifstream::binary);
 
-    // Verify that ROM opens correctly
-    if (!rom) {
-        std::cerr << "Error: Failed to open ROM" << std::endl;
+    RomFile rom;
+    if (!rom.open(filepath, memory.size() - 0x200)) {
         return false;
     }
+    return load(rom.data(), rom.size());
+}
 
-    // Find size of ROM
-    rom.seekg(0, std::ifstream::end);
-    int rom_size = rom.tellg();
-    rom.clear();
-    rom.seekg(0, std::ifstream::beg);
-
-    
-    // Allocate memory for ROM
-    auto rom_buffer = std::make_unique<char[]>(rom_size);
-    if (rom_buffer == nullptr) {
-        std::cerr << "Error: Failed memory allocation for ROM" << std::endl;
-        return false;
-    }
-
-    // Copy rom into buffer
-    rom.read(rom_buffer.get(), rom_size);
-
+// Load a ROM image that is already in host memory
+bool Chip8::load(const uint8_t* data, size_t size) {
     // Verify that ROM is of valid size
     // Available memory space begins at address 0x200
-    if (rom_size > (4096 - 0x200)) {
+    if (size > (memory.size() - 0x200)) {
         std::cerr << "Error: ROM too large to load into memory" << std::endl;
         return false;
     }
 
     // Load ROM into memory
-    for (int i = 0; i < rom_size; i++) {
-        memory[i + 0x200] = rom_buffer[i];
-    }
-
-    // Clean up
-    rom.close();
+    if (size > 0) std::memcpy(&memory[0x200], data, size);
+    invalidate(0x200, size);
 
     return true;
 }
 
 // Complete one emulation cycle
 void Chip8::cycle() {
-    // Fetch opcode 
-    opcode = memory[pc] << 8 | memory[pc + 1];
-
-    uint8_t x = (opcode & 0x0F00) >> 8;
-    uint8_t y = (opcode & 0x00F0) >> 4;
-    uint16_t nnn = opcode & 0x0FFF;
-    uint16_t nn = opcode & 0x00FF;
-    uint16_t n = opcode & 0x000F;
+    // Fetch the predecoded instruction and advance past it. Handlers that
+    // jump overwrite pc; the rest leave it pointing at the next instruction.
+    // A store may invalidate the entry, so handlers read op before storing
+    const Instruction& op = decoded[pc & address_mask];
+    pc += 2;
+    op.execute(*this, op);
+}
 
-    bool increment_pc = true;
+// Complete one emulation cycle without consulting the decode cache
+void Chip8::cycle_uncached() {
+    Instruction op = decode(memory[pc & address_mask] << 8
+                          | memory[(pc + 1) & address_mask]);
+    pc += 2;
+    op.execute(*this, op);
+}
 
-    // Decode and execute opcode
-    switch (opcode & 0xF000) {
-        case 0x0000:
-            switch (opcode & 0x00FF) {
-                // 00E0: Clears the screen
-                case 0x00E0:
-                    if (extended_resolution) {
-                        gfx.fill(0);
-                    } else {
-                        gfx_extended.fill(0);
-                    }                    
-                    draw_flag = true;
-                    break;
+// Run until the budget is spent. A pass round an idle loop that finds V, I
+// and pc as the previous pass left them must have changed nothing else
+// either, so every further pass this call would do ends in that same
+// state: only the part of a pass left over at the end is executed.
+uint64_t Chip8::run(uint64_t count) {
+    uint64_t executed = 0;
+    idle_jump = false;
 
-                // 00EE: Returns from subroutine
-                case 0x00EE:
-                    sp--;
-                    pc = stack[sp];
-                    break;
+    // The loop being watched: pc stays within [head, end] between passes
+    bool watching = false;
+    uint16_t head = 0;
+    uint16_t end = 0;
+    uint64_t passed_at = 0;
+    std::array<uint8_t, 16> saved_V {};
+    uint16_t saved_I = 0;
 
-                // 00FD (Super-CHIP): Exit CHIP interpreter
-                case 0x00FD:
-                    is_running = false;
-                    break;
+    while (executed < count && is_running) {
+        uint16_t at = pc;
+        if (watching && (at < head || at > end)) watching = false;
 
-                // 00FE (Super-CHIP): Disable extended mode
-                case 0x00FE:
-                    extended_resolution = false;
-                    break;
+        cycle();
+        executed++;
 
-                // 00FF (Super-CHIP): Enable extended mode
-                case 0x00FF:
-                    extended_resolution = true;
-                    break;
+        // FX0A with no key pressed repeats without changing anything
+        if (waiting_for_key) {
+            executed = count;
+            break;
+        }
 
-                default:
-                    // Return erroneous opcode
-                    std::cerr << "Error: unknown opcode 0x" << std::hex
-                              << std::uppercase << std::setfill('0')
-                              << std::setw(4) << opcode << std::endl;
+        if (idle_jump) {
+            idle_jump = false;
+            if (watching && pc == head && at == end && V == saved_V && I == saved_I) {
+                uint64_t length = executed - passed_at;
+                executed += (count - executed) / length * length;
             }
-            break;
+            watching = true;
+            head = pc;
+            end = at;
+            passed_at = executed;
+            saved_V = V;
+            saved_I = I;
+        }
+    }
+    return executed;
+}
 
-        // 1NNN: Jumps to address NNN
-        case 0x1000:
-            pc = nnn;
-            increment_pc = false;
-            break;
+// Count both timers down; called at 60 Hz independent of the instruction rate
+void Chip8::tick_timers() {
+    if (delay_timer > 0) delay_timer--;
 
-        // 2NNN: Calls subroutine at NNN
-        case 0x2000:
-            stack[sp] = pc;
-            sp++;
-            pc = nnn;
-            increment_pc = false;
-            break;
+    // The buzzer covers exactly the frames the timer counted through
+    sound_on = sound_timer > 0;
+    if (sound_timer > 0) sound_timer--;
+}
+
+// Forget decoded instructions overlapping [address, address + size). The
+// instruction starting one byte earlier also reads the first byte, and a
+// jump up to MAX_IDLE_BODY bytes later may have judged the written bytes
+// part of an idle loop.
+void Chip8::invalidate(uint16_t address, uint32_t size) {
+    const Instruction undecoded {dispatch<&Chip8::op_decode>, 0, 0, 0, 0, 0, 0};
+
+    int stale = std::min<uint32_t>(size + MAX_IDLE_BODY, memory.size());
+    for (int i = -1; i < stale; i++) {
+        decoded[(address + i) & address_mask] = undecoded;
+    }
+
+    // Grow the written span; anything wrapping past the end marks it all
+    int start = address - 1;
+    int end = address + size;
+    if (start < 0 || end > int(memory.size())) {
+        start = 0;
+        end = memory.size();
+    }
+    if (written_start == written_end) {
+        written_start = start;
+        written_end = end;
+    } else {
+        if (uint32_t(start) < written_start) written_start = start;
+        if (uint32_t(end) > written_end) written_end = end;
+    }
+}
+
+void Chip8::set_quirks(uint32_t quirks) {
+    this->quirks = quirks;
+    invalidate(0, memory.size());
+}
+
+// Step over the next instruction, which on XO-CHIP may be the four byte
+// F000 NNNN
+void Chip8::skip() {
+    if (xo_chip && memory[pc & address_mask] == 0xF0
+                && memory[(pc + 1) & address_mask] == 0x00) {
+        pc += 4;
+    } else {
+        pc += 2;
+    }
+}
+
+// Expand the seed with splitmix64 so that nearby seeds give unrelated
+// streams and the xoshiro state is never all zero
+void Chip8::seed(uint64_t seed) {
+    for (int i = 0; i < 4; i += 2) {
+        uint64_t z = (seed += 0x9E3779B97F4A7C15);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+        z ^= z >> 31;
+        rng[i] = z;
+        rng[i + 1] = z >> 32;
+    }
+}
+
+static inline uint32_t rotl(uint32_t x, int k) {
+    return (x << k) | (x >> (32 - k));
+}
+
+// xoshiro128** step
+uint32_t Chip8::random() {
+    uint32_t result = rotl(rng[1] * 5, 7) * 9;
+    uint32_t t = rng[1] << 9;
+    rng[2] ^= rng[0];
+    rng[3] ^= rng[1];
+    rng[1] ^= rng[2];
+    rng[0] ^= rng[3];
+    rng[2] ^= t;
+    rng[3] = rotl(rng[3], 11);
+    return result;
+}
+
+uint16_t Chip8::key_mask() const {
+    uint16_t mask = 0;
+    for (int i = 0; i < 16; i++) {
+        if (keys[i]) mask |= 1 << i;
+    }
+    return mask;
+}
+
+void Chip8::set_key_mask(uint16_t mask) {
+    for (int i = 0; i < 16; i++) {
+        keys[i] = (mask >> i) & 1;
+    }
+}
+
+bool Chip8::state_equals(const Chip8& other) const {
+    return I == other.I
+        && pc == other.pc
+        && memory == other.memory
+        && V == other.V
+        && stack == other.stack
+        && sp == other.sp
+        && delay_timer == other.delay_timer
+        && sound_timer == other.sound_timer
+        && rpl_flags == other.rpl_flags
+        && audio_pattern == other.audio_pattern
+        && audio_pitch == other.audio_pitch
+        && rng == other.rng
+        && keys == other.keys
+        && gfx == other.gfx
+        && gfx_extended == other.gfx_extended
+        && draw_flag == other.draw_flag
+        && is_running == other.is_running
+        && extended_resolution == other.extended_resolution
+        && planes == other.planes;
+}
+
+// Decode an opcode into its handler and operands. XO-CHIP instructions
+// are only recognised on an XO-CHIP machine, and quirk-dependent ones get
+// the handler instantiated for this machine's quirks.
+Instruction Chip8::decode(uint16_t opcode) const {
+    bool shift = quirks & QUIRK_SHIFT;
+    bool load_store = quirks & QUIRK_LOAD_STORE;
+    bool jump = quirks & QUIRK_JUMP;
+    bool vf_reset = quirks & QUIRK_VF_RESET;
+    bool wrap = quirks & QUIRK_WRAP;
+    bool index_overflow = quirks & QUIRK_INDEX_OVERFLOW;
+
+    Instruction op;
+    op.opcode = opcode;
+    op.x = (opcode & 0x0F00) >> 8;
+    op.y = (opcode & 0x00F0) >> 4;
+    op.nnn = opcode & 0x0FFF;
+    op.nn = opcode & 0x00FF;
+    op.n = opcode & 0x000F;
+    op.execute = dispatch<&Chip8::op_unknown>;
 
-        // 3XNN: Skips next instruction if VX equals NN
-        case 0x3000:
-            if (V[x] == nn) {
-                pc += 2;
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            if ((opcode & 0xFFF0) == 0x00C0) {
+                op.execute = dispatch<&Chip8::op_00cn>;
+                break;
             }
-            break;
-        
-        // 4XNN: Skips next instruction if VX doesn't equal NN
-        case 0x4000:
-            if (V[x] != nn) {
-                pc += 2;
+            if ((opcode & 0xFFF0) == 0x00D0 && xo_chip) {
+                op.execute = dispatch<&Chip8::op_00dn>;
+                break;
+            }
+            switch (opcode & 0x00FF) {
+                case 0x00E0: op.execute = dispatch<&Chip8::op_00e0>; break;
+                case 0x00EE: op.execute = dispatch<&Chip8::op_00ee>; break;
+                case 0x00FB: op.execute = dispatch<&Chip8::op_00fb>; break;
+                case 0x00FC: op.execute = dispatch<&Chip8::op_00fc>; break;
+                case 0x00FD: op.execute = dispatch<&Chip8::op_00fd>; break;
+                case 0x00FE: op.execute = dispatch<&Chip8::op_00fe>; break;
+                case 0x00FF: op.execute = dispatch<&Chip8::op_00ff>; break;
             }
             break;
 
-        // 5XY0: Skips next instruction if VX equals VY
+        case 0x1000: op.execute = dispatch<&Chip8::op_1nnn>; break;
+        case 0x2000: op.execute = dispatch<&Chip8::op_2nnn>; break;
+        case 0x3000: op.execute = dispatch<&Chip8::op_3xnn>; break;
+        case 0x4000: op.execute = dispatch<&Chip8::op_4xnn>; break;
         case 0x5000:
-            if (V[x] == V[y]) {
-                pc += 2;
+            if (!xo_chip) {
+                op.execute = dispatch<&Chip8::op_5xy0>;
+                break;
+            }
+            switch (opcode & 0x000F) {
+                case 0x0000: op.execute = dispatch<&Chip8::op_5xy0>; break;
+                case 0x0002: op.execute = dispatch<&Chip8::op_5xy2>; break;
+                case 0x0003: op.execute = dispatch<&Chip8::op_5xy3>; break;
             }
             break;
-
-        // 6XNN: Sets VX to NN
-        case 0x6000:
-            V[x] = nn;
-            break;
-
-        // 7XNN: Adds NN to VX
-        case 0x7000:
-            V[x] += nn;
-            break;
+        case 0x6000: op.execute = dispatch<&Chip8::op_6xnn>; break;
+        case 0x7000: op.execute = dispatch<&Chip8::op_7xnn>; break;
 
         case 0x8000:
             switch (opcode & 0x000F) {
-                // 8XY0: Sets VX to the value of VY
-                case 0x0000:
-                    V[x] = V[y];
-                    break;
-
-                // 8XY1: Sets VX to VX or VY
+                case 0x0000: op.execute = dispatch<&Chip8::op_8xy0>; break;
                 case 0x0001:
-                    V[x] |= V[y];
-                    break; 
-
-                // 8XY2: Sets VX to VX and VY
+                    op.execute = vf_reset ? dispatch<&Chip8::op_8xy1<true>>
+                                          : dispatch<&Chip8::op_8xy1<false>>;
+                    break;
                 case 0x0002:
-                    V[x] &= V[y];
+                    op.execute = vf_reset ? dispatch<&Chip8::op_8xy2<true>>
+                                          : dispatch<&Chip8::op_8xy2<false>>;
                     break;
-
-                // 8XY3: Sets VX to VX xor VY
                 case 0x0003:
-                    V[x] ^= V[y];
-                    break;
-
-                // 8XY4: Adds VY to VX. VF is set to 0 when there's a borrow,
-                // and 1 when there isn't
-                case 0x0004:
-                    V[x] += V[y];
-                    if (V[y] > (0xFF - V[x])) {
-                        V[0xF] = 1; // Carry
-                    } else {
-                        V[0xF] = 0;
-                    }               
-                    break;
-
-                // 8XY5: VY is subtracted from VX. VF is set to 0 when there's
-                // a borrow, and 1 when there isn't
-                case 0x0005:
-                    if (V[y] > (V[x])) {
-                        V[0xF] = 0; // Borrow
-                    } else {
-                        V[0xF] = 1;
-                    }
-                    V[x] -= V[y];               
+                    op.execute = vf_reset ? dispatch<&Chip8::op_8xy3<true>>
+                                          : dispatch<&Chip8::op_8xy3<false>>;
                     break;
-
-                // 8XY6: Stores the least significant bit of VX in VF and then
-                // shifts VX to the right by 1. 
+                case 0x0004: op.execute = dispatch<&Chip8::op_8xy4>; break;
+                case 0x0005: op.execute = dispatch<&Chip8::op_8xy5>; break;
                 case 0x0006:
-                    V[0xF] = V[x] & 0x1;
-                    V[x] >>= 1;
-                    break;
-                
-                // 8XY7: Sets VX to VY minus VX. VF is set to 0 when there's
-                // a borrow, and 1 when there isn't
-                case 0x0007:
-                    if (V[x] > V[y]) {
-                        V[0xF] = 0; // Borrow
-                    } else {
-                        V[0xF] = 1;
-                    }
-                    V[x] = V[y] - V[x];
+                    op.execute = shift ? dispatch<&Chip8::op_8xy6<true>>
+                                       : dispatch<&Chip8::op_8xy6<false>>;
                     break;
-                
-                // 8XYE: Stores the most significant bit of VX in VF and then
-                // shifts VX to the left by one
+                case 0x0007: op.execute = dispatch<&Chip8::op_8xy7>; break;
                 case 0x000E:
-                    V[0xF] = V[x] >> 7;
-                    V[x] <<= 1;
-                    break;              
-
-                default:
-                    // Return erroneous opcode
-                    std::cerr << "Error: unknown opcode 0x" << std::hex
-                              << std::uppercase << std::setfill('0')
-                              << std::setw(4) << opcode << std::endl;
-            }
-            break;
-
-        // 9XY0: Skips the next instruction if VX doesn't equal VY
-        case 0x9000:
-            if(V[x] != V[y]) {
-                pc += 2;
+                    op.execute = shift ? dispatch<&Chip8::op_8xye<true>>
+                                       : dispatch<&Chip8::op_8xye<false>>;
+                    break;
             }
             break;
 
-        // ANNN: Sets I to the address NNN
-        case 0xA000:
-            I = nnn;
-            break;
-        
-        // BNNN: Jumps to the address NNN plus V0
+        case 0x9000: op.execute = dispatch<&Chip8::op_9xy0>; break;
+        case 0xA000: op.execute = dispatch<&Chip8::op_annn>; break;
         case 0xB000:
-            pc = nnn + V[0];
-            increment_pc = false;
+            op.execute = jump ? dispatch<&Chip8::op_bnnn<true>>
+                              : dispatch<&Chip8::op_bnnn<false>>;
             break;
-        
-        // CXNN: Sets VX to the result of a bitwise and operation on a random
-        // number 0-255 and NN
-        case 0xC000:
-            V[x] = (rand() % 256) & nn;
+        case 0xC000: op.execute = dispatch<&Chip8::op_cxnn>; break;
+        case 0xD000:
+            if (op.n == 0) {
+                op.execute = wrap ? dispatch<&Chip8::op_dxy0<true>>
+                                  : dispatch<&Chip8::op_dxy0<false>>;
+            } else {
+                op.execute = wrap ? dispatch<&Chip8::op_dxyn<true>>
+                                  : dispatch<&Chip8::op_dxyn<false>>;
+            }
             break;
 
-        // DXYN: Draws a sprite at coordinate (VX, VY) that has a width of 8 
-        // pixels and a height of N pixels. Each row of 8 pixels is read as
-        // bit-coded starting from memory location I; I value doesn’t change
-        // after the execution of this instruction. As described above, VF is
-        // set to 1 if any screen pixels are flipped from set to unset when
-        // the sprite is drawn, and to 0 if that doesn’t happen 
-        case 0xD000: {
-            uint16_t pixel;
-
-            V[0xF] = 0;
-            for (int yline = 0; yline < n; yline++) {
-                pixel = memory[I + yline];
-                for (int xline = 0; xline < 8; xline++) {
-                    if ((pixel & (0x80 >> xline)) != 0) {
-                        if (gfx[V[x] + xline + ((V[y] + yline) * 64)] == 1) {
-                            V[0xF] = 1;
-                        }
-                        gfx[V[x] + xline + ((V[y] + yline) * 64)] ^= 1;
-                    }
-                }
+        case 0xE000:
+            switch (opcode & 0x00FF) {
+                case 0x009E: op.execute = dispatch<&Chip8::op_ex9e>; break;
+                case 0x00A1: op.execute = dispatch<&Chip8::op_exa1>; break;
             }
-            draw_flag = true;
             break;
-        }
 
-        case 0xE000:
+        case 0xF000:
             switch (opcode & 0x00FF) {
-                // EX9E: Skips the next instruction if the key stored in VX
-                // is pressed
-                case 0x009E:
-                    if (keys[V[x]] != 0) {
-                        pc += 2;
-                    }
+                case 0x0000:
+                    if (xo_chip && opcode == 0xF000) op.execute = dispatch<&Chip8::op_f000>;
                     break;
-
-                // EXA1: Skips the next instruction if the key stored in VX
-                // isn't pressed
-                case 0x00A1:
-                    if (keys[V[x]] == 0) {
-                        pc += 2;
-                    }
+                case 0x0001:
+                    if (xo_chip) op.execute = dispatch<&Chip8::op_fn01>;
                     break;
-
-                default:
-                    std::cerr << "Error: unknown opcode 0x" << std::hex
-                              << std::uppercase << std::setfill('0')
-                              << std::setw(4) << opcode << std::endl;
+                case 0x0002:
+                    if (xo_chip && opcode == 0xF002) op.execute = dispatch<&Chip8::op_f002>;
+                    break;
+                case 0x0007: op.execute = dispatch<&Chip8::op_fx07>; break;
+                case 0x000A: op.execute = dispatch<&Chip8::op_fx0a>; break;
+                case 0x0015: op.execute = dispatch<&Chip8::op_fx15>; break;
+                case 0x0018: op.execute = dispatch<&Chip8::op_fx18>; break;
+                case 0x001E:
+                    op.execute = index_overflow ? dispatch<&Chip8::op_fx1e<true>>
+                                                : dispatch<&Chip8::op_fx1e<false>>;
+                    break;
+                case 0x0029: op.execute = dispatch<&Chip8::op_fx29>; break;
+                case 0x0030: op.execute = dispatch<&Chip8::op_fx30>; break;
+                case 0x0033: op.execute = dispatch<&Chip8::op_fx33>; break;
+                case 0x003A:
+                    if (xo_chip) op.execute = dispatch<&Chip8::op_fx3a>;
+                    break;
+                case 0x0055:
+                    op.execute = load_store ? dispatch<&Chip8::op_fx55<true>>
+                                            : dispatch<&Chip8::op_fx55<false>>;
+                    break;
+                case 0x0065:
+                    op.execute = load_store ? dispatch<&Chip8::op_fx65<true>>
+                                            : dispatch<&Chip8::op_fx65<false>>;
+                    break;
+                case 0x0075: op.execute = dispatch<&Chip8::op_fx75>; break;
+                case 0x0085: op.execute = dispatch<&Chip8::op_fx85>; break;
             }
             break;
+    }
 
+    return op;
+}
 
-        case 0xF000:
-            switch (opcode & 0x00FF) {
-                // FX07: Sets VX to the value of the delay timer
-                case 0x0007:
-                    V[x] = delay_timer;
-                    break;
+// First execution at an address: decode, cache, then run it
+void Chip8::op_decode(const Instruction&) {
+    uint16_t address = (pc - 2) & address_mask;
 
-                // FX0A: A key press is awaited, and then stored in VX
-                case 0x000A: {
-                    bool key_pressed;
-                    
-                    for (int i = 0; i < 16; i++) {
-                        if( keys[i] != 0) {
-                            V[x] = i;
-                            key_pressed = true;
-                        }
-                    }
-
-                    // No key is pressed
-                    if (!key_pressed) return;
-                    break;
+    Instruction op = decode(memory[address] << 8 | memory[(address + 1) & address_mask]);
+    if (op.execute == dispatch<&Chip8::op_1nnn> && is_idle_loop(address, op.nnn)) {
+        op.execute = dispatch<&Chip8::op_1nnn_idle>;
+    }
+    decoded[address] = op;
+    op.execute(*this, op);
+}
+
+// Whether a jump at address back to target closes a short loop whose body
+// only reads the machine and writes V and I: skips, loads, arithmetic,
+// key tests and reading the delay timer. Such a loop can only leave once
+// a timer tick or a key changes what it reads.
+bool Chip8::is_idle_loop(uint16_t address, uint16_t target) const {
+    if (target > address || address - target > MAX_IDLE_BODY
+        || (address - target) % 2 != 0) {
+        return false;
+    }
+
+    for (uint16_t at = target; at < address; at += 2) {
+        uint16_t opcode = memory[at] << 8 | memory[(at + 1) & address_mask];
+        bool pure = false;
+        switch (opcode & 0xF000) {
+            case 0x3000: case 0x4000: case 0x6000: case 0x7000:
+            case 0x9000: case 0xA000:
+                pure = true;
+                break;
+            case 0x5000:
+                pure = (opcode & 0x000F) == 0;
+                break;
+            case 0x8000:
+                pure = (opcode & 0x000F) <= 7 || (opcode & 0x000F) == 0xE;
+                break;
+            case 0xE000:
+                pure = (opcode & 0x00FF) == 0x9E || (opcode & 0x00FF) == 0xA1;
+                break;
+            case 0xF000:
+                switch (opcode & 0x00FF) {
+                    case 0x07: case 0x1E: case 0x29: case 0x30: case 0x65: case 0x85:
+                        pure = true;
+                        break;
                 }
+                break;
+        }
+        if (!pure) return false;
+    }
+    return true;
+}
 
-                // FX15: Sets the delay timer to VX
-                case 0x0015:
-                    delay_timer = V[x];
-                    break;
+void Chip8::op_unknown(const Instruction& op) {
+    // Return erroneous opcode
+    std::cerr << "Error: unknown opcode 0x" << std::hex
+              << std::uppercase << std::setfill('0')
+              << std::setw(4) << op.opcode << std::endl;
+}
 
-                // FX18: Sets the delay timer to VX
-                case 0x0018:
-                    sound_timer = V[x];
-                    break;
+// 00CN (Super-CHIP): Scrolls the display down N rows
+void Chip8::op_00cn(const Instruction& op) {
+    if (extended_resolution) {
+        scroll_down(gfx_extended, planes, op.n);
+    } else {
+        scroll_down(gfx, planes, op.n);
+    }
+    dirty_rows = ~uint64_t(0);
+    draw_flag = true;
+}
 
-                // FX1E: Adds VX to I
-                // (Undocumented feature: set VF to 1 if there is range 
-                // overflow (when (I + VX) > 0xFFF), set VF to 0 if
-                // there is not)
-                case 0x001E:
-                    if (I + V[x] > 0xFFF) {
-                        V[0xF] = 1;
-                    } else {
-                        V[0xF] = 0;
-                    }
-                    I += V[x];
-                    break;
+// 00DN (XO-CHIP): Scrolls the display up N rows
+void Chip8::op_00dn(const Instruction& op) {
+    if (extended_resolution) {
+        scroll_up(gfx_extended, planes, op.n);
+    } else {
+        scroll_up(gfx, planes, op.n);
+    }
+    dirty_rows = ~uint64_t(0);
+    draw_flag = true;
+}
 
-                // FX29: Sets I to the location of the sprite in character VX.
-                // Characters 0-F (in hexadecimal) are represented by a 4x5
-                // font 
-                case 0x0029:
-                    I = V[x] * 5;
-                    break;
+// 00E0: Clears the screen (the selected planes on XO-CHIP)
+void Chip8::op_00e0(const Instruction&) {
+    if (extended_resolution) {
+        clear(gfx_extended, planes);
+    } else {
+        clear(gfx, planes);
+    }
+    dirty_rows = ~uint64_t(0);
+    draw_flag = true;
+}
 
-                // FX30 (Super-CHIP): Sets I to the location of the sprite in
-                // digit VX
-                case 0x0030:
-                    I = V[x] * 10;
-                    break;
+// 00EE: Returns from subroutine. Returning with no call outstanding stops
+// the machine.
+void Chip8::op_00ee(const Instruction&) {
+    if (sp == 0) {
+        std::cerr << "Error: stack underflow" << std::endl;
+        is_running = false;
+        return;
+    }
+    sp--;
+    pc = stack[sp] + 2;
+}
 
-                // Stores the binary-coded decimal representation of VX, with
-                // the most significant of three digits at the address in I,
-                // the middle digit at I plus 1, and the least significant
-                // digit at I plus 2
-                case 0x0033:
-                    memory[I]     = V[x] / 100;
-                    memory[I + 1] = (V[x] / 10) % 10;
-                    memory[I + 2] = (V[x] % 100) % 10;
-                    break;
+// 00FB (Super-CHIP): Scrolls the display right 4 pixels
+void Chip8::op_00fb(const Instruction&) {
+    if (extended_resolution) {
+        scroll_right(gfx_extended, planes, 4);
+    } else {
+        scroll_right(gfx, planes, 4);
+    }
+    dirty_rows = ~uint64_t(0);
+    draw_flag = true;
+}
 
-                // FX55: Stores V0 to VX (including VX) in memory starting at
-                // address I. The offset from I is increased by 1 for each
-                // value written, but I itself is left unmodified
-                case 0x0055:
-                    for (int i = 0; i <= x; i++) {
-                        memory[I + i] = V[i];
-                    }
-                    break;
+// 00FC (Super-CHIP): Scrolls the display left 4 pixels
+void Chip8::op_00fc(const Instruction&) {
+    if (extended_resolution) {
+        scroll_left(gfx_extended, planes, 4);
+    } else {
+        scroll_left(gfx, planes, 4);
+    }
+    dirty_rows = ~uint64_t(0);
+    draw_flag = true;
+}
 
-                // FX65: Fills V0 to VX (including VX) with values from memory
-                // starting at address I. The offset from I is increased by 1
-                // for each value written, but I itself is left unmodified
-                case 0x0065:
-                    for (int i = 0; i <= x; i++) {
-                        V[i] = memory[I + i];
-                    }
-                    break;
+// 00FD (Super-CHIP): Exit CHIP interpreter
+void Chip8::op_00fd(const Instruction&) {
+    is_running = false;
+}
 
-                default:
-                    // Return erroneous opcode
-                    std::cerr << "Error: unknown opcode 0x" << std::hex
-                              << std::uppercase << std::setfill('0')
-                              << std::setw(4) << opcode << std::endl;
-            }
-            break;
+// 00FE (Super-CHIP): Disable extended mode
+void Chip8::op_00fe(const Instruction&) {
+    extended_resolution = false;
+    dirty_rows = ~uint64_t(0);
+    draw_flag = true;
+}
+
+// 00FF (Super-CHIP): Enable extended mode
+void Chip8::op_00ff(const Instruction&) {
+    extended_resolution = true;
+    dirty_rows = ~uint64_t(0);
+    draw_flag = true;
+}
+
+// 1NNN: Jumps to address NNN
+void Chip8::op_1nnn(const Instruction& op) {
+    pc = op.nnn;
+}
+
+// 1NNN closing an idle loop: jumps like 1NNN and lets run() know
+void Chip8::op_1nnn_idle(const Instruction& op) {
+    pc = op.nnn;
+    idle_jump = true;
+}
 
-        default:
-            // Return erroneous opcode
-            std::cerr << "Error: unknown opcode 0x" << std::hex
-                      << std::uppercase << std::setfill('0')
-                      << std::setw(4) << opcode << std::endl;
+// 2NNN: Calls subroutine at NNN. A 17th nested call stops the machine.
+void Chip8::op_2nnn(const Instruction& op) {
+    if (sp == stack.size()) {
+        std::cerr << "Error: stack overflow" << std::endl;
+        is_running = false;
+        return;
     }
+    stack[sp] = pc - 2;
+    sp++;
+    pc = op.nnn;
+}
 
-    if (increment_pc) pc += 2;
+// 3XNN: Skips next instruction if VX equals NN
+void Chip8::op_3xnn(const Instruction& op) {
+    if (V[op.x] == op.nn) {
+        skip();
+    }
+}
 
-    // Update timers
-    if (delay_timer > 0) delay_timer--;
-    if (sound_timer > 0) sound_timer--;
-    if (sound_timer == 0) {
-        // TODO: Play sound
+// 4XNN: Skips next instruction if VX doesn't equal NN
+void Chip8::op_4xnn(const Instruction& op) {
+    if (V[op.x] != op.nn) {
+        skip();
+    }
+}
+
+// 5XY0: Skips next instruction if VX equals VY
+void Chip8::op_5xy0(const Instruction& op) {
+    if (V[op.x] == V[op.y]) {
+        skip();
+    }
+}
+
+// 5XY2 (XO-CHIP): Stores VX to VY (including VY) in memory starting at
+// address I, in reverse order if X is greater than Y. I is left unmodified
+void Chip8::op_5xy2(const Instruction& op) {
+    int step = op.x <= op.y ? 1 : -1;
+    int count = (op.x <= op.y ? op.y - op.x : op.x - op.y) + 1;
+    for (int i = 0; i < count; i++) {
+        memory[(I + i) & address_mask] = V[op.x + i * step];
+    }
+    invalidate(I, count);
+}
+
+// 5XY3 (XO-CHIP): Fills VX to VY (including VY) from memory starting at
+// address I, in reverse order if X is greater than Y. I is left unmodified
+void Chip8::op_5xy3(const Instruction& op) {
+    int step = op.x <= op.y ? 1 : -1;
+    int count = (op.x <= op.y ? op.y - op.x : op.x - op.y) + 1;
+    for (int i = 0; i < count; i++) {
+        V[op.x + i * step] = memory[(I + i) & address_mask];
+    }
+}
+
+// 6XNN: Sets VX to NN
+void Chip8::op_6xnn(const Instruction& op) {
+    V[op.x] = op.nn;
+}
+
+// 7XNN: Adds NN to VX
+void Chip8::op_7xnn(const Instruction& op) {
+    V[op.x] += op.nn;
+}
+
+// 8XY0: Sets VX to the value of VY
+void Chip8::op_8xy0(const Instruction& op) {
+    V[op.x] = V[op.y];
+}
+
+// 8XY1: Sets VX to VX or VY. With the VF reset quirk VF is cleared
+template <bool VfReset>
+void Chip8::op_8xy1(const Instruction& op) {
+    V[op.x] |= V[op.y];
+    if constexpr (VfReset) V[0xF] = 0;
+}
+
+// 8XY2: Sets VX to VX and VY. With the VF reset quirk VF is cleared
+template <bool VfReset>
+void Chip8::op_8xy2(const Instruction& op) {
+    V[op.x] &= V[op.y];
+    if constexpr (VfReset) V[0xF] = 0;
+}
+
+// 8XY3: Sets VX to VX xor VY. With the VF reset quirk VF is cleared
+template <bool VfReset>
+void Chip8::op_8xy3(const Instruction& op) {
+    V[op.x] ^= V[op.y];
+    if constexpr (VfReset) V[0xF] = 0;
+}
+
+// 8XY4: Adds VY to VX. VF is set to 1 when there's a carry, and 0 when
+// there isn't
+void Chip8::op_8xy4(const Instruction& op) {
+    bool carry = V[op.y] > (0xFF - V[op.x]);
+    V[op.x] += V[op.y];
+    V[0xF] = carry;
+}
+
+// 8XY5: VY is subtracted from VX. VF is set to 0 when there's a borrow, and
+// 1 when there isn't
+void Chip8::op_8xy5(const Instruction& op) {
+    if (V[op.y] > (V[op.x])) {
+        V[0xF] = 0; // Borrow
+    } else {
+        V[0xF] = 1;
+    }
+    V[op.x] -= V[op.y];
+}
+
+// 8XY6: Stores the least significant bit of VY in VF and then sets VX to
+// VY shifted right by 1. With the shift quirk VX is shifted in place.
+template <bool Shift>
+void Chip8::op_8xy6(const Instruction& op) {
+    uint8_t source = Shift ? op.x : op.y;
+    V[0xF] = V[source] & 0x1;
+    V[op.x] = V[source] >> 1;
+}
+
+// 8XY7: Sets VX to VY minus VX. VF is set to 0 when there's a borrow, and 1
+// when there isn't
+void Chip8::op_8xy7(const Instruction& op) {
+    if (V[op.x] > V[op.y]) {
+        V[0xF] = 0; // Borrow
+    } else {
+        V[0xF] = 1;
+    }
+    V[op.x] = V[op.y] - V[op.x];
+}
+
+// 8XYE: Stores the most significant bit of VY in VF and then sets VX to
+// VY shifted left by one. With the shift quirk VX is shifted in place.
+template <bool Shift>
+void Chip8::op_8xye(const Instruction& op) {
+    uint8_t source = Shift ? op.x : op.y;
+    V[0xF] = V[source] >> 7;
+    V[op.x] = V[source] << 1;
+}
+
+// 9XY0: Skips the next instruction if VX doesn't equal VY
+void Chip8::op_9xy0(const Instruction& op) {
+    if (V[op.x] != V[op.y]) {
+        skip();
+    }
+}
+
+// ANNN: Sets I to the address NNN
+void Chip8::op_annn(const Instruction& op) {
+    I = op.nnn;
+}
+
+// BNNN: Jumps to the address NNN plus V0. With the jump quirk it is BXNN,
+// adding VX instead.
+template <bool Jump>
+void Chip8::op_bnnn(const Instruction& op) {
+    pc = op.nnn + V[Jump ? op.x : 0];
+}
+
+// CXNN: Sets VX to the result of a bitwise and operation on a random number
+// 0-255 and NN
+void Chip8::op_cxnn(const Instruction& op) {
+    V[op.x] = (random() >> 24) & op.nn;
+}
+
+// DXYN: Draws a sprite at coordinate (VX, VY) that has a width of 8 pixels
+// and a height of N pixels. Each row of 8 pixels is read as bit-coded
+// starting from memory location I; I value doesn’t change after the
+// execution of this instruction. As described above, VF is set to 1 if any
+// screen pixels are flipped from set to unset when the sprite is drawn, and
+// to 0 if that doesn’t happen. The position wraps around the screen and
+// the parts of the sprite past the edges are clipped, or with the wrap
+// quirk drawn at the opposite edge.
+// In extended mode the sprite goes to the 128x64 screen. On XO-CHIP it is
+// drawn on each selected plane in turn, the data for the next plane
+// following on from the last.
+template <bool Wrap>
+void Chip8::op_dxyn(const Instruction& op) {
+    uint8_t rows[15];
+    uint16_t address = I;
+    bool collision = false;
+
+    for (int plane = 0; plane < 2; plane++) {
+        if ((planes >> plane & 1) == 0) continue;
+        for (int row = 0; row < op.n; row++) {
+            rows[row] = memory[(address + row) & address_mask];
+        }
+        address += op.n;
+
+        if (extended_resolution) {
+            collision |= draw_sprite<Wrap>(gfx_extended, plane, V[op.x], V[op.y], rows, op.n);
+        } else {
+            collision |= draw_sprite<Wrap>(gfx, plane, V[op.x], V[op.y], rows, op.n);
+        }
     }
+
+    dirty_rows |= row_mask<Wrap>(V[op.y], op.n, extended_resolution ? 64 : 32);
+    V[0xF] = collision;
+    draw_flag = true;
+}
+
+// DXY0 (Super-CHIP): Draws a 16x16 sprite, two bytes per row, in extended
+// mode or on XO-CHIP, and an 8x16 sprite otherwise. Planes and VF work as
+// for DXYN, as does the wrap quirk.
+template <bool Wrap>
+void Chip8::op_dxy0(const Instruction& op) {
+    uint8_t rows[32];
+    uint16_t address = I;
+    bool wide = extended_resolution || xo_chip;
+    int size = wide ? 32 : 16;
+    bool collision = false;
+
+    for (int plane = 0; plane < 2; plane++) {
+        if ((planes >> plane & 1) == 0) continue;
+        for (int i = 0; i < size; i++) {
+            rows[i] = memory[(address + i) & address_mask];
+        }
+        address += size;
+
+        if (extended_resolution) {
+            collision |= draw_sprite16<Wrap>(gfx_extended, plane, V[op.x], V[op.y], rows);
+        } else if (wide) {
+            collision |= draw_sprite16<Wrap>(gfx, plane, V[op.x], V[op.y], rows);
+        } else {
+            collision |= draw_sprite<Wrap>(gfx, plane, V[op.x], V[op.y], rows, 16);
+        }
+    }
+
+    dirty_rows |= row_mask<Wrap>(V[op.y], 16, extended_resolution ? 64 : 32);
+    V[0xF] = collision;
+    draw_flag = true;
+}
+
+// EX9E: Skips the next instruction if the key stored in VX is pressed. Only
+// the low nibble of VX is used.
+void Chip8::op_ex9e(const Instruction& op) {
+    if (keys[V[op.x] & 0xF] != 0) {
+        skip();
+    }
+}
+
+// EXA1: Skips the next instruction if the key stored in VX isn't pressed
+void Chip8::op_exa1(const Instruction& op) {
+    if (keys[V[op.x] & 0xF] == 0) {
+        skip();
+    }
+}
+
+// F000 NNNN (XO-CHIP): Sets I to the 16-bit address NNNN in the next two
+// bytes, then steps over them
+void Chip8::op_f000(const Instruction&) {
+    I = memory[pc & address_mask] << 8 | memory[(pc + 1) & address_mask];
+    pc += 2;
+}
+
+// FN01 (XO-CHIP): Selects the bitplanes N that drawing, clearing and
+// scrolling act on
+void Chip8::op_fn01(const Instruction& op) {
+    planes = op.x & 3;
+}
+
+// F002 (XO-CHIP): Loads the 16 byte audio pattern from memory at I
+void Chip8::op_f002(const Instruction&) {
+    for (int i = 0; i < 16; i++) {
+        audio_pattern[i] = memory[(I + i) & address_mask];
+    }
+}
+
+// FX07: Sets VX to the value of the delay timer
+void Chip8::op_fx07(const Instruction& op) {
+    V[op.x] = delay_timer;
+}
+
+// FX0A: A key press is awaited, and then stored in VX
+void Chip8::op_fx0a(const Instruction& op) {
+    bool key_pressed = false;
+
+    for (int i = 0; i < 16; i++) {
+        if (keys[i] != 0) {
+            V[op.x] = i;
+            key_pressed = true;
+        }
+    }
+
+    // No key is pressed, run this instruction again next cycle. The
+    // scheduler ends the frame here rather than spinning on it.
+    waiting_for_key = !key_pressed;
+    if (!key_pressed) {
+        pc -= 2;
+    }
+}
+
+// FX15: Sets the delay timer to VX
+void Chip8::op_fx15(const Instruction& op) {
+    delay_timer = V[op.x];
+}
+
+// FX18: Sets the sound timer to VX
+void Chip8::op_fx18(const Instruction& op) {
+    sound_timer = V[op.x];
+}
+
+// FX1E: Adds VX to I
+// (With the index overflow quirk, as on the Amiga interpreter: set VF to 1
+// if there is range overflow (when (I + VX) > 0xFFF), set VF to 0 if there
+// is not)
+template <bool IndexOverflow>
+void Chip8::op_fx1e(const Instruction& op) {
+    if constexpr (IndexOverflow) {
+        if (I + V[op.x] > 0xFFF) {
+            V[0xF] = 1;
+        } else {
+            V[0xF] = 0;
+        }
+    }
+    I += V[op.x];
+}
+
+// FX29: Sets I to the location of the sprite in character VX. Characters
+// 0-F (in hexadecimal) are represented by a 4x5 font
+void Chip8::op_fx29(const Instruction& op) {
+    I = V[op.x] * 5;
+}
+
+// FX30 (Super-CHIP): Sets I to the location of the sprite in digit VX.
+// Digits 0-F are represented by an 8x10 font
+void Chip8::op_fx30(const Instruction& op) {
+    I = FONT_LARGE_ADDRESS + (V[op.x] & 0xF) * 10;
+}
+
+// FX33: Stores the binary-coded decimal representation of VX, with the most
+// significant of three digits at the address in I, the middle digit at I
+// plus 1, and the least significant digit at I plus 2
+void Chip8::op_fx33(const Instruction& op) {
+    memory[I & address_mask]       = V[op.x] / 100;
+    memory[(I + 1) & address_mask] = (V[op.x] / 10) % 10;
+    memory[(I + 2) & address_mask] = (V[op.x] % 100) % 10;
+    invalidate(I, 3);
+}
+
+// FX3A (XO-CHIP): Sets the audio pitch to VX
+void Chip8::op_fx3a(const Instruction& op) {
+    audio_pitch = V[op.x];
+}
+
+// FX55: Stores V0 to VX (including VX) in memory starting at address I.
+// I is left past the last value written, or with the load/store quirk
+// unmodified
+template <bool LoadStore>
+void Chip8::op_fx55(const Instruction& op) {
+    int count = op.x + 1;
+    for (int i = 0; i < count; i++) {
+        memory[(I + i) & address_mask] = V[i];
+    }
+    invalidate(I, count);
+    if constexpr (!LoadStore) I += count;
+}
+
+// FX65: Fills V0 to VX (including VX) with values from memory starting at
+// address I. I is left past the last value read, or with the load/store
+// quirk unmodified
+template <bool LoadStore>
+void Chip8::op_fx65(const Instruction& op) {
+    for (int i = 0; i <= op.x; i++) {
+        V[i] = memory[(I + i) & address_mask];
+    }
+    if constexpr (!LoadStore) I += op.x + 1;
+}
+
+// FX75 (Super-CHIP): Stores V0 to VX (including VX) in the RPL user flags
+void Chip8::op_fx75(const Instruction& op) {
+    for (int i = 0; i <= op.x; i++) {
+        rpl_flags[i] = V[i];
+    }
+}
+
+// FX85 (Super-CHIP): Fills V0 to VX (including VX) from the RPL user flags
+void Chip8::op_fx85(const Instruction& op) {
+    for (int i = 0; i <= op.x; i++) {
+        V[i] = rpl_flags[i];
+    }
+}
+
+// Save state layout, all values little-endian:
+//   "C8SS", u16 version, first 4 KB of memory, V, I, pc, stack, sp, delay
+//   timer, sound timer, keys, plane 0 of gfx, plane 0 of gfx_extended,
+//   u8 flags
+// Version 2 appends the four u32 words of the RNG state, version 3 the
+// audio pattern and pitch, version 4 the 16 RPL user flags. Version 5
+// appends the selected planes (u8), plane 1 of gfx and gfx_extended, the
+// memory size (u32) and the memory past 4 KB.
+const char STATE_MAGIC[4] = {'C', '8', 'S', 'S'};
+const uint16_t STATE_VERSION = 5;
+
+const uint8_t STATE_DRAW = 1 << 0;
+const uint8_t STATE_RUNNING = 1 << 1;
+const uint8_t STATE_EXTENDED = 1 << 2;
+
+static void put(uint8_t*& out, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        *out++ = value >> (8 * i);
+    }
+}
+
+template <typename T>
+static void put(uint8_t*& out, const T* values, size_t count) {
+    if (sizeof(T) == 1) {
+        std::memcpy(out, values, count);
+        out += count;
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        put(out, values[i], sizeof(T));
+    }
+}
+
+template <typename T, size_t N>
+static void put(uint8_t*& out, const std::array<T, N>& values) {
+    put(out, values.data(), N);
+}
+
+static uint64_t get(const uint8_t*& in, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value |= uint64_t(*in++) << (8 * i);
+    }
+    return value;
+}
+
+template <typename T>
+static void get(const uint8_t*& in, T* values, size_t count) {
+    if (sizeof(T) == 1) {
+        std::memcpy(values, in, count);
+        in += count;
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        values[i] = get(in, sizeof(T));
+    }
+}
+
+template <typename T, size_t N>
+static void get(const uint8_t*& in, std::array<T, N>& values) {
+    get(in, values.data(), N);
+}
+
+const size_t PLANE_BYTES = sizeof(Framebuffer) / 2;
+const size_t PLANE_BYTES_EXTENDED = sizeof(FramebufferExtended) / 2;
+
+// Size of a whole state; the memory size only counts from version 5
+size_t Chip8::state_size(uint16_t version, size_t memory_size) {
+    size_t size = 4 + 2 + 4096 + 16 + 2 + 2 + 16 * 2 + 2 + 1 + 1 + 16
+                + PLANE_BYTES + PLANE_BYTES_EXTENDED + 1;
+    if (version >= 2) size += 4 * 4;
+    if (version >= 3) size += 16 + 1;
+    if (version >= 4) size += 16;
+    if (version >= 5) size += 1 + PLANE_BYTES + PLANE_BYTES_EXTENDED + 4
+                           + memory_size - 4096;
+    return size;
+}
+
+void Chip8::save_state(std::vector<uint8_t>& state) const {
+    state.resize(state_size(STATE_VERSION, memory.size()));
+    uint8_t* out = state.data();
+
+    std::memcpy(out, STATE_MAGIC, 4);
+    out += 4;
+    put(out, STATE_VERSION, 2);
+    put(out, memory.data(), 4096);
+    put(out, V);
+    put(out, I, 2);
+    put(out, pc, 2);
+    put(out, stack);
+    put(out, sp, 2);
+    put(out, delay_timer, 1);
+    put(out, sound_timer, 1);
+    put(out, keys);
+    put(out, gfx.data(), gfx.size() / 2);
+    put(out, gfx_extended.data(), gfx_extended.size() / 2);
+    put(out, (draw_flag ? STATE_DRAW : 0)
+             | (is_running ? STATE_RUNNING : 0)
+             | (extended_resolution ? STATE_EXTENDED : 0), 1);
+    put(out, rng);
+    put(out, audio_pattern);
+    put(out, audio_pitch, 1);
+    put(out, rpl_flags);
+    put(out, planes, 1);
+    put(out, gfx.data() + gfx.size() / 2, gfx.size() / 2);
+    put(out, gfx_extended.data() + gfx_extended.size() / 2, gfx_extended.size() / 2);
+    put(out, memory.size(), 4);
+    put(out, memory.data() + 4096, memory.size() - 4096);
+}
+
+bool Chip8::load_state(const uint8_t* data, size_t size) {
+    if (size < 6 || std::memcmp(data, STATE_MAGIC, 4) != 0) {
+        std::cerr << "Error: Not a save state" << std::endl;
+        return false;
+    }
+
+    const uint8_t* in = data + 4;
+    uint16_t version = get(in, 2);
+    if (version < 1 || version > STATE_VERSION) {
+        std::cerr << "Error: Unsupported save state version" << std::endl;
+        return false;
+    }
+    // Versions before 5 are all 4 KB machines
+    size_t memory_size = 4096;
+    size_t memory_size_at = state_size(version, 4096) - 4;
+    if (version >= 5 && size >= memory_size_at + 4) {
+        const uint8_t* field = data + memory_size_at;
+        memory_size = get(field, 4);
+    }
+    if (memory_size != memory.size()) {
+        std::cerr << "Error: Save state is for a different memory size" << std::endl;
+        return false;
+    }
+    if (size != state_size(version, memory_size)) {
+        std::cerr << "Error: Truncated save state" << std::endl;
+        return false;
+    }
+
+    // Check the fields that index into the machine before changing it: sp
+    // follows memory, V, I, pc and the stack, and version 5 adds the plane
+    // mask right after everything version 4 had
+    const uint8_t* field = data + 4 + 2 + 4096 + 16 + 2 + 2 + 16 * 2;
+    bool corrupt = get(field, 2) > stack.size();
+    if (version >= 5) {
+        field = data + state_size(4, 4096);
+        corrupt |= get(field, 1) > 3;
+    }
+    if (corrupt) {
+        std::cerr << "Error: Corrupt save state" << std::endl;
+        return false;
+    }
+
+    get(in, memory.data(), 4096);
+    get(in, V);
+    I = get(in, 2);
+    pc = get(in, 2);
+    get(in, stack);
+    sp = get(in, 2);
+    delay_timer = get(in, 1);
+    sound_timer = get(in, 1);
+    get(in, keys);
+    get(in, gfx.data(), gfx.size() / 2);
+    get(in, gfx_extended.data(), gfx_extended.size() / 2);
+
+    uint8_t flags = get(in, 1);
+    draw_flag = (flags & STATE_DRAW) != 0;
+    is_running = (flags & STATE_RUNNING) != 0;
+    extended_resolution = (flags & STATE_EXTENDED) != 0;
+    waiting_for_key = false;    // Found again when FX0A next runs
+
+    // Older states keep the current RNG stream, audio settings and flags
+    if (version >= 2) get(in, rng);
+    if (version >= 3) {
+        get(in, audio_pattern);
+        audio_pitch = get(in, 1);
+    }
+    if (version >= 4) get(in, rpl_flags);
+
+    // Older states only had plane 0
+    if (version >= 5) {
+        planes = get(in, 1);
+        get(in, gfx.data() + gfx.size() / 2, gfx.size() / 2);
+        get(in, gfx_extended.data() + gfx_extended.size() / 2, gfx_extended.size() / 2);
+        get(in, 4);
+        get(in, memory.data() + 4096, memory.size() - 4096);
+    } else {
+        planes = 1;
+        clear(gfx, 2);
+        clear(gfx_extended, 2);
+    }
+
+    // All of memory may have changed under the decoded instructions, and
+    // the whole screen needs redrawing
+    invalidate(0, memory.size());
+    dirty_rows = ~uint64_t(0);
+
+    return true;
 }
@@ -1,15 +1,67 @@
 #ifndef CHIP8_H
 #define CHIP8_H
 #include <array>
+#include <cstddef>
 #include <cstdint>
+#include <vector>
+
+#include "framebuffer.h"
+
+class Chip8;
+
+// Behaviours that differ between CHIP-8 interpreters, as bit flags
+const uint32_t QUIRK_SHIFT = 1 << 0;        // 8XY6/8XYE shift VX, ignoring VY
+const uint32_t QUIRK_LOAD_STORE = 1 << 1;   // FX55/FX65 leave I unchanged
+const uint32_t QUIRK_JUMP = 1 << 2;         // BNNN jumps to NNN + VX, X from NNN
+const uint32_t QUIRK_VF_RESET = 1 << 3;     // 8XY1/8XY2/8XY3 clear VF
+const uint32_t QUIRK_WRAP = 1 << 4;         // Sprites wrap at the edges instead of clipping
+const uint32_t QUIRK_INDEX_OVERFLOW = 1 << 5; // FX1E sets VF when I passes 0xFFF
+
+// The quirks of the common interpreters: the COSMAC VIP original, CHIP-48
+// on the HP48, Super-CHIP 1.1 and Octo's XO-CHIP
+const uint32_t PROFILE_CHIP8 = QUIRK_VF_RESET;
+const uint32_t PROFILE_CHIP48 = QUIRK_SHIFT | QUIRK_JUMP;
+const uint32_t PROFILE_SCHIP = QUIRK_SHIFT | QUIRK_LOAD_STORE | QUIRK_JUMP;
+const uint32_t PROFILE_XO_CHIP = QUIRK_WRAP;
+
+// Largest ROM any machine takes: XO-CHIP's 64 KB less the interpreter area
+const size_t MAX_ROM_SIZE = 65536 - 0x200;
+
+// Built-in 4x5 hex digit sprites, loaded at address 0
+extern std::array<uint8_t, 80> fontset;
+
+// Super-CHIP 8x10 hex digit sprites, loaded after the small font
+extern std::array<uint8_t, 160> fontset_large;
+const uint16_t FONT_LARGE_ADDRESS = 80;
+
+// Longest loop body, in bytes before its backward jump, that is checked
+// for being an idle loop
+const uint16_t MAX_IDLE_BODY = 16;
+
+// Predecoded instruction: operands extracted once, plus the handler that
+// executes them
+struct Instruction {
+    void (*execute)(Chip8&, const Instruction&);
+    uint16_t opcode;
+    uint16_t nnn;
+    uint8_t nn;
+    uint8_t n;
+    uint8_t x;
+    uint8_t y;
+};
 
 class Chip8 {
     private:
-        uint16_t opcode;
         uint16_t I;
         uint16_t pc;
 
-        std::array<uint8_t, 4096> memory;
+        // 4 KB, or 64 KB for XO-CHIP, so classic ROMs keep a small working
+        // set. Addresses wrap with address_mask.
+        std::vector<uint8_t> memory;
+        uint16_t address_mask;
+        bool xo_chip;
+        uint32_t quirks;
+
         std::array<uint8_t, 16> V;
 
         std::array<uint16_t, 16> stack;
@@ -18,17 +70,172 @@ class Chip8 {
         uint8_t delay_timer;
         uint8_t sound_timer;
 
+        // Super-CHIP RPL user flags, saved by FX75 and read back by FX85.
+        // The HP48 had 8; XO-CHIP allows all 16.
+        std::array<uint8_t, 16> rpl_flags;
+
+        // xoshiro128** state for CXNN, so runs repeat exactly given a seed
+        std::array<uint32_t, 4> rng;
+
+        // One decoded entry per address, filled lazily as code executes
+        std::vector<Instruction> decoded;
+
+        // Span of memory written since an execution engine last looked,
+        // empty when written_start == written_end
+        uint32_t written_start;
+        uint32_t written_end;
+
+        // Set by a jump that closes an idle loop, for run() to notice
+        bool idle_jump;
+
+        Instruction decode(uint16_t opcode) const;
+        static size_t state_size(uint16_t version, size_t memory_size);
+        uint32_t random();
+        void invalidate(uint16_t address, uint32_t size);
+        void skip();
+        bool is_idle_loop(uint16_t address, uint16_t target) const;
+
+        // Adapts a member handler to the plain function pointer stored in
+        // an Instruction, so dispatch is a single indirect call
+        template <void (Chip8::*Handler)(const Instruction&)>
+        static void dispatch(Chip8& chip8, const Instruction& op) {
+            (chip8.*Handler)(op);
+        }
+
+        // Instruction handlers. Those whose behaviour depends on a quirk
+        // are templates on it; decode() picks the instantiation, so the
+        // cached instructions never test quirks as they run.
+        void op_decode(const Instruction& op);
+        void op_unknown(const Instruction& op);
+        void op_00cn(const Instruction& op);
+        void op_00dn(const Instruction& op);
+        void op_00e0(const Instruction& op);
+        void op_00ee(const Instruction& op);
+        void op_00fb(const Instruction& op);
+        void op_00fc(const Instruction& op);
+        void op_00fd(const Instruction& op);
+        void op_00fe(const Instruction& op);
+        void op_00ff(const Instruction& op);
+        void op_1nnn(const Instruction& op);
+        void op_1nnn_idle(const Instruction& op);
+        void op_2nnn(const Instruction& op);
+        void op_3xnn(const Instruction& op);
+        void op_4xnn(const Instruction& op);
+        void op_5xy0(const Instruction& op);
+        void op_5xy2(const Instruction& op);
+        void op_5xy3(const Instruction& op);
+        void op_6xnn(const Instruction& op);
+        void op_7xnn(const Instruction& op);
+        void op_8xy0(const Instruction& op);
+        template <bool VfReset> void op_8xy1(const Instruction& op);
+        template <bool VfReset> void op_8xy2(const Instruction& op);
+        template <bool VfReset> void op_8xy3(const Instruction& op);
+        void op_8xy4(const Instruction& op);
+        void op_8xy5(const Instruction& op);
+        template <bool Shift> void op_8xy6(const Instruction& op);
+        void op_8xy7(const Instruction& op);
+        template <bool Shift> void op_8xye(const Instruction& op);
+        void op_9xy0(const Instruction& op);
+        void op_annn(const Instruction& op);
+        template <bool Jump> void op_bnnn(const Instruction& op);
+        void op_cxnn(const Instruction& op);
+        template <bool Wrap> void op_dxy0(const Instruction& op);
+        template <bool Wrap> void op_dxyn(const Instruction& op);
+        void op_ex9e(const Instruction& op);
+        void op_exa1(const Instruction& op);
+        void op_f000(const Instruction& op);
+        void op_fn01(const Instruction& op);
+        void op_f002(const Instruction& op);
+        void op_fx07(const Instruction& op);
+        void op_fx0a(const Instruction& op);
+        void op_fx15(const Instruction& op);
+        void op_fx18(const Instruction& op);
+        template <bool IndexOverflow> void op_fx1e(const Instruction& op);
+        void op_fx29(const Instruction& op);
+        void op_fx30(const Instruction& op);
+        void op_fx33(const Instruction& op);
+        void op_fx3a(const Instruction& op);
+        template <bool LoadStore> void op_fx55(const Instruction& op);
+        template <bool LoadStore> void op_fx65(const Instruction& op);
+        void op_fx75(const Instruction& op);
+        void op_fx85(const Instruction& op);
+
+        friend class Jit;
+        friend class Batch;
+        friend class Reference;
+        friend class Debugger;
+        friend class Aot;
+
     public:
         std::array<uint8_t, 16> keys;
-        std::array<uint8_t, 64 * 32> gfx;
-        std::array<uint8_t, 128 * 64> gfx_extended;
+        Framebuffer gfx;
+        FramebufferExtended gfx_extended;
+        uint64_t dirty_rows;    // Rows changed since the renderer last cleared this
         bool draw_flag;
         bool is_running;
+        bool waiting_for_key;   // Stopped at FX0A until a key is pressed
+
+        // Buzzer: on for every frame the sound timer was non-zero at the
+        // last tick, playing the 128-bit pattern at 4000*2^((pitch-64)/48)
+        // bits per second (the XO-CHIP audio model)
+        bool sound_on;
+        std::array<uint8_t, 16> audio_pattern;
+        uint8_t audio_pitch;
         bool extended_resolution;
+        uint8_t planes;         // Bitplanes drawn to, bit N for plane N
 
-        Chip8();
+        // An XO-CHIP machine has 64 KB of memory and decodes the XO-CHIP
+        // instructions; otherwise the instruction set is Super-CHIP's.
+        // quirks holds QUIRK_* bits, usually one of the PROFILE_* sets.
+        Chip8(uint64_t seed = 0, bool xo_chip = false, uint32_t quirks = PROFILE_CHIP8);
         bool load(const char* filepath);
+        bool load(const uint8_t* data, size_t size);
+
+        // Execute one instruction from the predecoded cache
         void cycle();
+
+        // Execute one instruction, decoding it from memory every time
+        void cycle_uncached();
+
+        // Execute up to count instructions, stopping early only if the ROM
+        // exits, and return how many were executed. Passes round an idle
+        // loop that leave the machine as they found it, and repeats of an
+        // FX0A with no key pressed, are counted without being run; the
+        // state afterwards is the same as from count calls to cycle().
+        uint64_t run(uint64_t count);
+
+        // Count the delay and sound timers down, once per 60 Hz frame
+        void tick_timers();
+
+        // True while either timer is still counting down
+        bool timers_active() const { return delay_timer != 0 || sound_timer != 0; }
+
+        // Restart the random number generator from a seed
+        void seed(uint64_t seed);
+
+        // Pressed keys as a bitmask, bit N for key N
+        uint16_t key_mask() const;
+        void set_key_mask(uint16_t mask);
+
+        bool is_xo_chip() const { return xo_chip; }
+        uint32_t get_quirks() const { return quirks; }
+
+        // Switch to other quirks. Decoded instructions are dropped so they
+        // are decoded again with the new handlers.
+        void set_quirks(uint32_t quirks);
+        const std::vector<uint8_t>& get_memory() const { return memory; }
+        uint16_t get_pc() const { return pc; }
+
+        // Compare all architectural state with another machine
+        bool state_equals(const Chip8& other) const;
+
+        // Serialize the full machine state in the versioned save state
+        // format, replacing the contents of state
+        void save_state(std::vector<uint8_t>& state) const;
+
+        // Restore a save state. Fails, leaving the machine untouched, if the
+        // data is not a save state of a supported version.
+        bool load_state(const uint8_t* data, size_t size);
 };
 
 #endif // CHIP8_H
@@ -0,0 +1,475 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "debugger.h"
+
+const int REGISTER_COUNT = 21;
+const int REGISTER_I = 16;
+const int REGISTER_PC = 17;
+const int REGISTER_SP = 18;
+const int REGISTER_DELAY = 19;
+const int REGISTER_SOUND = 20;
+
+// How long poll() waits for commands while the machine is stopped
+const int STOPPED_POLL_MS = 16;
+
+static int register_bytes(int number) {
+    return number == REGISTER_I || number == REGISTER_PC ? 2 : 1;
+}
+
+// A value as little-endian hex bytes, the protocol's register encoding
+static std::string hex_bytes(uint32_t value, int bytes) {
+    std::string out;
+    char digits[3];
+    for (int i = 0; i < bytes; i++) {
+        std::snprintf(digits, sizeof(digits), "%02x", (value >> (8 * i)) & 0xFF);
+        out += digits;
+    }
+    return out;
+}
+
+// Read bytes little-endian hex bytes starting at text[at]; false if they
+// are not there
+static bool parse_bytes(const std::string& text, size_t& at, int bytes, uint32_t& value) {
+    value = 0;
+    for (int i = 0; i < bytes; i++) {
+        if (at + 2 > text.size() || !std::isxdigit(text[at]) || !std::isxdigit(text[at + 1])) {
+            return false;
+        }
+        value |= std::strtoul(text.substr(at, 2).c_str(), nullptr, 16) << (8 * i);
+        at += 2;
+    }
+    return true;
+}
+
+Debugger::Debugger(size_t memory_size)
+    : listener {-1}
+    , client {-1}
+    , breakpoints(memory_size, false)
+    , address_mask {uint16_t(memory_size - 1)}
+    , stopped {false}
+    , stepping {false}
+    , resuming {false}
+    , stop_reply {"S05"}
+    , acknowledge {true}
+{
+}
+
+Debugger::~Debugger() {
+#ifndef _WIN32
+    disconnect();
+    if (listener >= 0) close(listener);
+    if (!socket_path.empty()) unlink(socket_path.c_str());
+#endif
+}
+
+bool Debugger::open(const char* address) {
+#ifdef _WIN32
+    std::cerr << "Error: The GDB stub needs POSIX sockets" << std::endl;
+    return false;
+#else
+    bool tcp = *address != '\0' && std::all_of(address, address + std::strlen(address), ::isdigit);
+    if (tcp) {
+        listener = socket(AF_INET, SOCK_STREAM, 0);
+        int reuse = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        sockaddr_in local {};
+        local.sin_family = AF_INET;
+        local.sin_port = htons(std::atoi(address));
+        local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&local), sizeof(local)) != 0
+            || listen(listener, 1) != 0) {
+            std::cerr << "Error: Failed to listen on port " << address << std::endl;
+            return false;
+        }
+    } else {
+        sockaddr_un local {};
+        local.sun_family = AF_UNIX;
+        if (std::strlen(address) >= sizeof(local.sun_path)) {
+            std::cerr << "Error: Socket path too long: " << address << std::endl;
+            return false;
+        }
+        std::strcpy(local.sun_path, address);
+
+        // Only replace a stale socket, never a file given by mistake
+        struct stat existing;
+        if (lstat(address, &existing) == 0) {
+            if (!S_ISSOCK(existing.st_mode)) {
+                std::cerr << "Error: Not a socket: " << address << std::endl;
+                return false;
+            }
+            unlink(address);
+        }
+
+        listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&local), sizeof(local)) != 0
+            || listen(listener, 1) != 0) {
+            std::cerr << "Error: Failed to listen on " << address << std::endl;
+            return false;
+        }
+        socket_path = address;
+    }
+
+    std::cout << "Waiting for GDB on " << address << std::endl;
+    return accept();
+#endif
+}
+
+// Take the next connection. A new session starts with the machine stopped.
+bool Debugger::accept() {
+#ifndef _WIN32
+    client = ::accept(listener, nullptr, nullptr);
+    if (client < 0) {
+        std::cerr << "Error: Failed to accept a GDB connection" << std::endl;
+        return false;
+    }
+    int no_delay = 1;
+    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+#endif
+    input.clear();
+    acknowledge = true;
+    stopped = true;
+    stepping = false;
+    stop_reply = "S05";
+    return true;
+}
+
+// GDB detached or went away: drop breakpoints and watchpoints and let the
+// machine run until someone connects again
+void Debugger::disconnect() {
+#ifndef _WIN32
+    if (client >= 0) close(client);
+#endif
+    client = -1;
+    std::fill(breakpoints.begin(), breakpoints.end(), false);
+    watchpoints.clear();
+    stopped = false;
+    stepping = false;
+}
+
+void Debugger::send(const std::string& packet) {
+#ifndef _WIN32
+    if (client < 0) return;
+
+    uint8_t checksum = 0;
+    for (char c : packet) checksum += c;
+    char trailer[4];
+    std::snprintf(trailer, sizeof(trailer), "#%02x", checksum);
+    std::string framed = "$" + packet + trailer;
+
+    size_t sent = 0;
+    while (sent < framed.size()) {
+        ssize_t count = ::send(client, framed.data() + sent, framed.size() - sent, MSG_NOSIGNAL);
+        if (count <= 0) {
+            disconnect();
+            return;
+        }
+        sent += count;
+    }
+#endif
+}
+
+void Debugger::stop(const std::string& reply) {
+    stopped = true;
+    stepping = false;
+    stop_reply = reply;
+    send(reply);
+}
+
+void Debugger::check_watchpoints(const Chip8& chip8) {
+    const std::vector<uint8_t>& memory = chip8.get_memory();
+    for (Watchpoint& watch : watchpoints) {
+        auto start = memory.begin() + watch.address;
+        if (std::equal(watch.value.begin(), watch.value.end(), start)) continue;
+
+        std::copy(start, start + watch.length, watch.value.begin());
+        char reply[32];
+        std::snprintf(reply, sizeof(reply), "T05watch:%x;", watch.address);
+        stop(reply);
+        return;
+    }
+}
+
+bool Debugger::poll(Chip8& chip8) {
+#ifndef _WIN32
+    // Detached: look for a new connection without holding up the machine
+    if (client < 0) {
+        pollfd waiting {listener, POLLIN, 0};
+        if (listener >= 0 && ::poll(&waiting, 1, 0) > 0) accept();
+        if (client < 0) return true;
+    }
+
+    pollfd readable {client, POLLIN, 0};
+    if (::poll(&readable, 1, stopped ? STOPPED_POLL_MS : 0) > 0) {
+        char buffer[4096];
+        ssize_t received = recv(client, buffer, sizeof(buffer), 0);
+        if (received <= 0) {
+            disconnect();
+            return true;
+        }
+        input.append(buffer, received);
+    }
+
+    // Packets are $data#checksum. Ctrl-C arrives as a lone 0x03 byte; the
+    // acknowledgements GDB sends back need no action.
+    while (!input.empty()) {
+        if (input[0] == '\x03') {
+            input.erase(0, 1);
+            if (!stopped) stop("S02");
+            continue;
+        }
+        if (input[0] != '$') {
+            input.erase(0, 1);
+            continue;
+        }
+        size_t end = input.find('#');
+        if (end == std::string::npos || end + 3 > input.size()) break;
+
+        std::string packet = input.substr(1, end - 1);
+        unsigned checksum = std::strtoul(input.substr(end + 1, 2).c_str(), nullptr, 16);
+        input.erase(0, end + 3);
+
+        uint8_t sum = 0;
+        for (char c : packet) sum += c;
+        if (acknowledge) {
+            const char* ack = sum == checksum ? "+" : "-";
+            if (::send(client, ack, 1, MSG_NOSIGNAL) != 1) {
+                disconnect();
+                return true;
+            }
+        }
+        if (sum == checksum) handle(chip8, packet);
+        if (client < 0) return true;
+    }
+#endif
+    return !stopped;
+}
+
+std::string Debugger::read_register(const Chip8& chip8, int number) const {
+    switch (number) {
+        case REGISTER_I: return hex_bytes(chip8.I, 2);
+        case REGISTER_PC: return hex_bytes(chip8.pc, 2);
+        case REGISTER_SP: return hex_bytes(chip8.sp, 1);
+        case REGISTER_DELAY: return hex_bytes(chip8.delay_timer, 1);
+        case REGISTER_SOUND: return hex_bytes(chip8.sound_timer, 1);
+        default: return hex_bytes(chip8.V[number], 1);
+    }
+}
+
+// The stack pointer may only take values the stack can hold
+bool Debugger::write_register(Chip8& chip8, int number, uint32_t value) {
+    switch (number) {
+        case REGISTER_I: chip8.I = value; break;
+        case REGISTER_PC: chip8.pc = value; break;
+        case REGISTER_SP:
+            if (value > chip8.stack.size()) return false;
+            chip8.sp = value;
+            break;
+        case REGISTER_DELAY: chip8.delay_timer = value; break;
+        case REGISTER_SOUND: chip8.sound_timer = value; break;
+        default: chip8.V[number] = value;
+    }
+    return true;
+}
+
+void Debugger::handle(Chip8& chip8, const std::string& packet) {
+    const std::vector<uint8_t>& memory = chip8.get_memory();
+    const char* args = packet.c_str() + 1;
+    char* end;
+
+    switch (packet.empty() ? '\0' : packet[0]) {
+        case '?':
+            send(stop_reply);
+            break;
+
+        case 'g': {
+            std::string registers;
+            for (int number = 0; number < REGISTER_COUNT; number++) {
+                registers += read_register(chip8, number);
+            }
+            send(registers);
+            break;
+        }
+
+        case 'G': {
+            size_t at = 1;
+            bool valid = true;
+            for (int number = 0; number < REGISTER_COUNT && valid; number++) {
+                uint32_t value;
+                valid = parse_bytes(packet, at, register_bytes(number), value)
+                     && write_register(chip8, number, value);
+            }
+            send(valid ? "OK" : "E01");
+            break;
+        }
+
+        case 'p': {
+            unsigned long number = std::strtoul(args, nullptr, 16);
+            send(number < REGISTER_COUNT ? read_register(chip8, number) : "E01");
+            break;
+        }
+
+        case 'P': {
+            unsigned long number = std::strtoul(args, &end, 16);
+            size_t at = end - packet.c_str() + 1;
+            uint32_t value;
+            bool valid = *end == '=' && number < REGISTER_COUNT
+                      && parse_bytes(packet, at, register_bytes(number), value)
+                      && write_register(chip8, number, value);
+            send(valid ? "OK" : "E01");
+            break;
+        }
+
+        // maddr,length and Maddr,length:bytes
+        case 'm':
+        case 'M': {
+            size_t address = std::strtoul(args, &end, 16);
+            size_t length = *end == ',' ? std::strtoul(end + 1, &end, 16) : 0;
+            if (address > memory.size() || length > memory.size() - address) {
+                send("E01");
+                break;
+            }
+            if (packet[0] == 'm') {
+                std::string bytes;
+                for (size_t i = 0; i < length; i++) bytes += hex_bytes(memory[address + i], 1);
+                send(bytes);
+                break;
+            }
+
+            size_t at = end - packet.c_str() + 1;
+            std::vector<uint8_t> bytes(length);
+            bool valid = *end == ':';
+            for (size_t i = 0; i < length && valid; i++) {
+                uint32_t value;
+                valid = parse_bytes(packet, at, 1, value);
+                bytes[i] = value;
+            }
+            if (!valid) {
+                send("E01");
+                break;
+            }
+            std::copy(bytes.begin(), bytes.end(), chip8.memory.begin() + address);
+            chip8.invalidate(address, length);
+
+            // Only the ROM's own writes should trigger watchpoints
+            for (Watchpoint& watch : watchpoints) {
+                std::copy(memory.begin() + watch.address,
+                          memory.begin() + watch.address + watch.length,
+                          watch.value.begin());
+            }
+            send("OK");
+            break;
+        }
+
+        // c[addr] and s[addr]: the reply comes when the machine stops
+        case 'c':
+        case 's':
+            if (*args != '\0') chip8.pc = std::strtoul(args, nullptr, 16);
+            stopped = false;
+            stepping = packet[0] == 's';
+            resuming = true;
+            break;
+
+        // Ztype,addr,kind: 0 and 1 are breakpoints, 2 write watchpoints
+        case 'Z':
+        case 'z': {
+            unsigned long type = std::strtoul(args, &end, 16);
+            size_t address = *end == ',' ? std::strtoul(end + 1, &end, 16) : memory.size();
+            size_t length = *end == ',' ? std::strtoul(end + 1, nullptr, 16) : 0;
+            bool insert = packet[0] == 'Z';
+
+            if (type == 0 || type == 1) {
+                if (address >= memory.size()) {
+                    send("E01");
+                    break;
+                }
+                breakpoints[address] = insert;
+                send("OK");
+            } else if (type == 2) {
+                if (length == 0 || address > memory.size() || length > memory.size() - address) {
+                    send("E01");
+                    break;
+                }
+                auto same = [&](const Watchpoint& watch) {
+                    return watch.address == address && watch.length == length;
+                };
+                watchpoints.erase(std::remove_if(watchpoints.begin(), watchpoints.end(), same),
+                                  watchpoints.end());
+                if (insert) {
+                    watchpoints.push_back({uint16_t(address), uint16_t(length),
+                                           std::vector<uint8_t>(memory.begin() + address,
+                                                                memory.begin() + address + length)});
+                }
+                send("OK");
+            } else {
+                send("");
+            }
+            break;
+        }
+
+        case 'D':
+            send("OK");
+            disconnect();
+            break;
+
+        case 'k':
+            chip8.is_running = false;
+            disconnect();
+            break;
+
+        // There is only one thread to select
+        case 'H':
+            send("OK");
+            break;
+
+        case 'q':
+            if (packet.compare(0, 10, "qSupported") == 0) {
+                send("PacketSize=4000;QStartNoAckMode+;swbreak+");
+            } else if (packet == "qAttached") {
+                send("1");
+            } else {
+                send("");
+            }
+            break;
+
+        case 'Q':
+            if (packet == "QStartNoAckMode") {
+                send("OK");
+                acknowledge = false;
+            } else {
+                send("");
+            }
+            break;
+
+        default:
+            send("");
+    }
+}
+
+void Debugger::run_frame(Chip8& chip8, int instructions_per_frame) {
+    for (int i = 0; i < instructions_per_frame && chip8.is_running; i++) {
+        if (!cycle(chip8)) return;
+        if (chip8.waiting_for_key) break;
+    }
+    if (!stopped) chip8.tick_timers();
+}
+
+void Debugger::exited() {
+    send("W00");
+}
@@ -0,0 +1,99 @@
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "chip8.h"
+
+// Server for the GDB remote serial protocol, so a ROM can be debugged from
+// GDB (target remote) or any client speaking the protocol. It listens on a
+// TCP port on localhost or on a Unix socket.
+//
+// Registers, all little-endian: 0-15 are V0-VF, 16 is I and 17 pc (16 bits
+// each), 18 the stack pointer, 19 the delay timer and 20 the sound timer
+// (8 bits each). Memory is the machine's whole address space. Supported
+// are reading and writing registers and memory, continue, single step,
+// interrupt (Ctrl-C), software breakpoints (Z0/Z1) and write watchpoints
+// (Z2).
+//
+// Breakpoints are a bitmap over addresses and watchpoints compare the
+// watched bytes after every instruction. Instructions only reach them when
+// they are run through Debugger::cycle(), so Chip8::cycle() and the normal
+// frame loop pay nothing for either.
+class Debugger {
+    private:
+        struct Watchpoint {
+            uint16_t address;
+            uint16_t length;
+            std::vector<uint8_t> value;     // Contents after the last check
+        };
+
+        int listener;
+        int client;
+        std::string socket_path;    // Unix socket to remove when done
+
+        std::vector<bool> breakpoints;      // One bit per address
+        uint16_t address_mask;
+        std::vector<Watchpoint> watchpoints;
+
+        bool stopped;
+        bool stepping;
+        bool resuming;      // Run the instruction at pc even if it has a breakpoint
+        std::string stop_reply;
+
+        std::string input;  // Received bytes not yet handled
+        bool acknowledge;   // Off once GDB asks for no-ack mode
+
+        bool accept();
+        void disconnect();
+        void send(const std::string& packet);
+        void stop(const std::string& reply);
+        void check_watchpoints(const Chip8& chip8);
+        void handle(Chip8& chip8, const std::string& packet);
+        std::string read_register(const Chip8& chip8, int number) const;
+        bool write_register(Chip8& chip8, int number, uint32_t value);
+
+    public:
+        Debugger(size_t memory_size = 4096);
+        ~Debugger();
+        Debugger(const Debugger&) = delete;
+        Debugger& operator=(const Debugger&) = delete;
+
+        // Listen on address, a port number for localhost or otherwise the
+        // path of a Unix socket, and wait for GDB to connect. The machine
+        // starts stopped, as GDB expects.
+        bool open(const char* address);
+
+        // Handle whatever GDB has sent. While the machine is stopped this
+        // waits up to a frame for commands. Returns true if the machine may
+        // run.
+        bool poll(Chip8& chip8);
+
+        // Execute one instruction, unless the machine is stopped or a
+        // breakpoint stops it first. Returns true if it ran.
+        inline bool cycle(Chip8& chip8);
+
+        // One frame's instructions through cycle(), then a timer tick. A
+        // frame cut short by a stop leaves the timers alone.
+        void run_frame(Chip8& chip8, int instructions_per_frame);
+
+        // Tell GDB the ROM has exited
+        void exited();
+};
+
+inline bool Debugger::cycle(Chip8& chip8) {
+    if (stopped) return false;
+    if (breakpoints[chip8.get_pc() & address_mask] && !resuming) {
+        stop("T05swbreak:;");
+        return false;
+    }
+    resuming = false;
+
+    chip8.cycle();
+    if (!watchpoints.empty()) check_watchpoints(chip8);
+    if (stepping && !stopped) stop("S05");
+    return true;
+}
+
+#endif // DEBUGGER_H
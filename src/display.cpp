@@ -1,6 +1,7 @@
 #include <iostream>
 #include <cstdint>
 #include <SDL2/SDL.h>
+#include "chip8.h"
 #include "display.h"
 
 const int SCREEN_WIDTH = 1024;
@@ -9,8 +10,14 @@ const int SCREEN_HEIGHT = 768;
 SDL_Window *window;
 SDL_Renderer *renderer;
 SDL_Texture *texture;
+SDL_Texture *texture_extended;
 
-bool setup_graphics() {
+// Texture presented last; switching resolution re-uploads the whole frame
+SDL_Texture *shown_texture;
+
+std::vector<std::pair<uint16_t, double>> overlay;
+
+bool setup_graphics(bool vsync) {
     // Initialize SDL
     if (SDL_Init(SDL_INIT_EVERYTHING) < 0) {
         std::cout << "SDL initialization failure. SDL_Error: "
@@ -29,7 +36,8 @@ bool setup_graphics() {
     }
 
     // Create renderer
-    renderer = SDL_CreateRenderer(window, -1, 0);
+    renderer = SDL_CreateRenderer(window, -1,
+                                  vsync ? SDL_RENDERER_PRESENTVSYNC : 0);
     SDL_RenderSetLogicalSize(renderer, SCREEN_WIDTH, SCREEN_HEIGHT);
     if (renderer == nullptr) {
         std::cout << "Failed to create renderer. SDL_Error: " 
@@ -37,12 +45,16 @@ bool setup_graphics() {
         return false;
     }
 
-    // Create texture that stores frame buffer
+    // Create textures that store the frame buffer, one per resolution
     texture = SDL_CreateTexture(renderer,
                                 SDL_PIXELFORMAT_ARGB8888,
                                 SDL_TEXTUREACCESS_STREAMING,
                                 64, 32);
-    if (texture == nullptr) {
+    texture_extended = SDL_CreateTexture(renderer,
+                                         SDL_PIXELFORMAT_ARGB8888,
+                                         SDL_TEXTUREACCESS_STREAMING,
+                                         128, 64);
+    if (texture == nullptr || texture_extended == nullptr) {
         std::cout << "Failed to create texture. SDL_Error: " 
                   << SDL_GetError() << std::endl;
         return false;
@@ -51,41 +63,118 @@ bool setup_graphics() {
     return true;
 }
 
-void draw(std::array<uint8_t, 64 * 32> gfx) {
-    std::array<uint32_t, 64 * 32> pixels;
+// Write each run of dirty rows straight into the locked texture
+template <size_t Words>
+static void upload(SDL_Texture* target, const std::array<uint64_t, Words>& gfx,
+                   int width, int height, uint64_t dirty_rows) {
+    const int words_per_row = width / 64;
 
-    // Store pixels in temporary buffer
-    for (int i = 0; i < 64 * 32; ++i) {
-        uint8_t pixel = gfx[i];
-        pixels[i] = (0x00FFFFFF * pixel) | 0xFF000000;
+    // Another texture was on screen, so this one may be stale
+    if (target != shown_texture) {
+        dirty_rows = ~uint64_t(0);
+        shown_texture = target;
     }
 
-    // Update texture
-    SDL_UpdateTexture(texture, NULL, pixels.data(), 64 * sizeof(uint32_t));
-
-    // Clear screen and render
-    SDL_RenderClear(renderer);  
-    SDL_RenderCopy(renderer, texture, NULL, NULL);
-    SDL_RenderPresent(renderer);
+    int row = 0;
+    while (row < height) {
+        if ((dirty_rows >> row & 1) == 0) {
+            row++;
+            continue;
+        }
+
+        int first = row;
+        while (row < height && (dirty_rows >> row & 1) != 0) {
+            row++;
+        }
+
+        SDL_Rect rect {0, first, width, row - first};
+        void* locked;
+        int pitch;
+        if (SDL_LockTexture(target, &rect, &locked, &pitch) != 0) {
+            continue;
+        }
+
+        uint8_t* line = static_cast<uint8_t*>(locked);
+        for (int y = first; y < row; y++, line += pitch) {
+            uint32_t* pixels = reinterpret_cast<uint32_t*>(line);
+            for (int word = 0; word < words_per_row; word++) {
+                uint64_t low = gfx[y * words_per_row + word];
+                uint64_t high = gfx[Words / 2 + y * words_per_row + word];
+                for (int x = 0; x < 64; x++) {
+                    int colour = (low >> (63 - x) & 1) | (high >> (63 - x) & 1) << 1;
+                    pixels[word * 64 + x] = PALETTE[colour];
+                }
+            }
+        }
+
+        SDL_UnlockTexture(target);
+    }
 }
 
-void draw(std::array<uint8_t, 128 * 64> gfx) {
-    std::array<uint32_t, 128 * 64> pixels;
+void set_overlay(const std::vector<std::pair<uint16_t, double>>& hot) {
+    overlay = hot;
+}
 
-    // Store pixels in temporary buffer
-    for (int i = 0; i < 128 * 64; ++i) {
-        uint8_t pixel = gfx[i];
-        pixels[i] = (0x00FFFFFF * pixel) | 0xFF000000;
+// Hot address list: each line is the address in the CHIP-8 font followed
+// by a bar as long as its share of cycles
+static void draw_overlay() {
+    const int scale = 4;                // Screen pixels per font pixel
+    const int line_height = 6 * scale;
+    const int bar_width = 256;          // Bar length at 100%
+
+    SDL_Rect panel {0, 0, 5 * 4 * scale + bar_width + 2 * scale,
+                    int(overlay.size()) * line_height + scale};
+    SDL_SetRenderDrawColor(renderer, 0x20, 0x20, 0x20, 0xFF);
+    SDL_RenderFillRect(renderer, &panel);
+
+    SDL_SetRenderDrawColor(renderer, 0xFF, 0xC0, 0x00, 0xFF);
+    for (size_t line = 0; line < overlay.size(); line++) {
+        int top = line * line_height + scale;
+        uint16_t address = overlay[line].first;
+
+        for (int digit = 0; digit < 4; digit++) {
+            const uint8_t* glyph = &fontset[(address >> (12 - 4 * digit) & 0xF) * 5];
+            int left = scale + digit * 5 * scale;
+            for (int y = 0; y < 5; y++) {
+                for (int x = 0; x < 4; x++) {
+                    if (glyph[y] & (0x80 >> x)) {
+                        SDL_Rect pixel {left + x * scale, top + y * scale,
+                                        scale, scale};
+                        SDL_RenderFillRect(renderer, &pixel);
+                    }
+                }
+            }
+        }
+
+        SDL_Rect bar {scale + 4 * 5 * scale + scale, top + scale,
+                      int(overlay[line].second * bar_width) + 1, 3 * scale};
+        SDL_RenderFillRect(renderer, &bar);
     }
 
-    // Update texture
-    SDL_UpdateTexture(texture, NULL, pixels.data(), 64 * sizeof(uint32_t));
+    // SDL_RenderClear uses the draw colour
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0xFF);
+}
 
+static void present(SDL_Texture* target) {
     // Clear screen and render
     SDL_RenderClear(renderer);  
-    SDL_RenderCopy(renderer, texture, NULL, NULL);
+    SDL_RenderCopy(renderer, target, NULL, NULL);
+    if (!overlay.empty()) draw_overlay();
     SDL_RenderPresent(renderer);
+}
+
+void draw(const Framebuffer& gfx, uint64_t dirty_rows) {
+    upload(texture, gfx, 64, 32, dirty_rows);
+    present(texture);
+}
+
+void draw(const FramebufferExtended& gfx, uint64_t dirty_rows) {
+    upload(texture_extended, gfx, 128, 64, dirty_rows);
+    present(texture_extended);
+}
 
+void redraw() {
+    if (shown_texture != nullptr) present(shown_texture);
 }
 
 void close_window() {
@@ -95,5 +184,8 @@ void close_window() {
     renderer = nullptr;
     SDL_DestroyTexture(texture);
     texture = nullptr;
+    SDL_DestroyTexture(texture_extended);
+    texture_extended = nullptr;
+    shown_texture = nullptr;
     SDL_Quit();
 }
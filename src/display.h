@@ -1,10 +1,24 @@
 #ifndef DISPLAY_H
 #define DISPLAY_H
-#include <array>
+#include <cstdint>
+#include <utility>
+#include <vector>
 
-bool setup_graphics();
-void draw(std::array<uint8_t, 64 * 32> gfx);
-void draw(std::array<uint8_t, 128 * 64> gfx); // Overload for extended resolution
+#include "framebuffer.h"
+
+// With vsync, presenting blocks until the display's next refresh
+bool setup_graphics(bool vsync);
+
+// Upload the rows flagged in dirty_rows and present the frame
+void draw(const Framebuffer& gfx, uint64_t dirty_rows);
+void draw(const FramebufferExtended& gfx, uint64_t dirty_rows); // Overload for extended resolution
+
+// Present the last frame drawn again
+void redraw();
 void close_window();
 
+// Addresses to list over the frame with a bar for their share of cycles,
+// hottest first. An empty list hides the overlay.
+void set_overlay(const std::vector<std::pair<uint16_t, double>>& hot);
+
 #endif // DISPLAY_H
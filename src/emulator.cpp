@@ -0,0 +1,148 @@
+#include "emulator.h"
+
+Emulator::Emulator(Chip8& chip8, InputLog& log, bool recording, bool replaying,
+                   bool paced, Profiler* profiler, Debugger* debugger,
+                   Capture* capture)
+    : chip8 {chip8}
+    , scheduler {log.instructions_per_frame, paced}
+    , rewind {8 << 20}  // Several minutes of history in a few MB
+    , log {log}
+    , recording {recording}
+    , replaying {replaying}
+    , profiler {profiler}
+    , debugger {debugger}
+    , capture {capture}
+    , keys {0}
+    , tapped {0}
+    , rewinding {false}
+    , frame {0}
+    , running {false}
+{
+}
+
+Emulator::~Emulator() {
+    stop();
+}
+
+void Emulator::start() {
+    running = true;
+    thread = std::thread(&Emulator::run, this);
+}
+
+void Emulator::stop() {
+    running = false;
+    notify_input();
+    if (thread.joinable()) thread.join();
+}
+
+void Emulator::notify_input() {
+    std::lock_guard<std::mutex> guard(input_lock);
+    input_ready.notify_one();
+}
+
+// Sleep until a key event arrives or the thread is stopped
+void Emulator::wait_for_input() {
+    std::unique_lock<std::mutex> lock(input_lock);
+    input_ready.wait(lock, [this] {
+        KeyEvent event;
+        return !running || events.peek(event);
+    });
+}
+
+// Apply key events that happened before the frame started; later ones wait
+// for the next frame
+void Emulator::apply_events(std::chrono::steady_clock::time_point until) {
+    KeyEvent event;
+    while (events.peek(event) && event.time <= until) {
+        events.pop(event);
+        if (event.key == KEY_REWIND) {
+            rewinding = event.pressed;
+        } else if (event.pressed) {
+            keys |= 1 << event.key;
+            tapped |= 1 << event.key;
+        } else {
+            keys &= ~(1 << event.key);
+        }
+    }
+}
+
+void Emulator::publish() {
+    Frame& out = frames.write_buffer();
+    out.gfx = chip8.gfx;
+    out.gfx_extended = chip8.gfx_extended;
+    out.extended_resolution = chip8.extended_resolution;
+
+    out.hot_count = 0;
+    if (profiler) {
+        for (const auto& hot : profiler->hottest(out.hot.size())) {
+            out.hot[out.hot_count++] = hot;
+        }
+    }
+
+    frames.publish();
+    if (on_frame) on_frame();
+}
+
+void Emulator::run() {
+    // The initial screen
+    publish();
+
+    while (running && chip8.is_running) {
+        // Stopped in the debugger: wait for its commands, not frames
+        if (debugger && !debugger->poll(chip8)) continue;
+
+        // Input is sampled once per frame. A key tapped and released
+        // within one frame still counts as down for that frame.
+        apply_events(std::chrono::steady_clock::now());
+        chip8.set_key_mask(replaying ? log.mask_at(frame) : keys | tapped);
+        tapped = 0;
+
+        // Emulate one frame, or step one frame back while rewinding
+        if (rewinding && rewind.frames() > 1) {
+            rewind.restore(chip8, 1);
+            chip8.draw_flag = true;
+            chip8.sound_on = false;
+            frame--;
+        } else {
+            if (recording) {
+                log.record(frame, chip8.key_mask());
+            }
+            if (debugger) {
+                debugger->run_frame(chip8, log.instructions_per_frame);
+            } else if (profiler) {
+                scheduler.run_frame(chip8, *profiler);
+                if (chip8.draw_flag) profiler->present();
+            } else {
+                scheduler.run_frame(chip8);
+            }
+            rewind.capture(chip8);
+            frame++;
+        }
+        audio.push(audio_frame(chip8));
+        if (capture) capture->push(chip8);
+
+        // The render thread works out dirty rows itself, since it may skip
+        // frames. The overlay is refreshed once a second.
+        if (chip8.draw_flag || (profiler && frame % 60 == 0)) {
+            chip8.draw_flag = false;
+            chip8.dirty_rows = 0;
+            publish();
+        }
+
+        // Blocked on FX0A with the timers stopped, every frame would be
+        // the same until a key arrives, so sleep instead of running them.
+        // Skipped frames are not counted, which keeps recordings in step
+        // with replays; replays never wait, as their keys come from the log.
+        // The debugger must keep reading commands, so it never sleeps here.
+        if (chip8.waiting_for_key && !chip8.timers_active() && !replaying && !debugger) {
+            wait_for_input();
+            scheduler.resync();
+        } else {
+            scheduler.wait_for_next_frame();
+        }
+    }
+
+    if (debugger && !chip8.is_running) debugger->exited();
+    running = false;
+    if (on_frame) on_frame();
+}
@@ -0,0 +1,102 @@
+#ifndef EMULATOR_H
+#define EMULATOR_H
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "audio.h"
+#include "capture.h"
+#include "chip8.h"
+#include "debugger.h"
+#include "input.h"
+#include "inputlog.h"
+#include "profiler.h"
+#include "rewind.h"
+#include "scheduler.h"
+#include "triplebuffer.h"
+
+// Screen contents handed from the emulation thread to the render thread
+struct Frame {
+    Framebuffer gfx;
+    FramebufferExtended gfx_extended;
+    bool extended_resolution;
+
+    // Hottest addresses while profiling, for the overlay
+    std::array<std::pair<uint16_t, double>, 8> hot;
+    size_t hot_count;
+};
+
+// Runs the machine on its own thread, paced in 60 Hz frames. Key events
+// come in through an SPSC queue and finished frames go out through a
+// triple buffer, so a slow present never holds up emulation. Each frame's
+// buzzer state goes to the audio queue; if it is full the frame is dropped
+// rather than waiting.
+class Emulator {
+    private:
+        Chip8& chip8;
+        Scheduler scheduler;
+        Rewind rewind;
+
+        InputLog& log;
+        bool recording;
+        bool replaying;
+        Profiler* profiler;
+        Debugger* debugger;
+        Capture* capture;
+
+        uint16_t keys;          // Keypad state built from events
+        uint16_t tapped;        // Pressed since the last frame, even if released
+        bool rewinding;
+        uint64_t frame;
+
+        std::atomic<bool> running;
+        std::thread thread;
+
+        // Signalled when key events arrive or the thread is stopped
+        std::mutex input_lock;
+        std::condition_variable input_ready;
+
+        void apply_events(std::chrono::steady_clock::time_point until);
+        void wait_for_input();
+        void publish();
+        void run();
+
+    public:
+        KeyEventQueue events;
+        TripleBuffer<Frame> frames;
+        AudioQueue audio;
+
+        // Called on the emulation thread after each frame is published and
+        // once when the thread finishes, to wake the render thread. Set it
+        // before start().
+        std::function<void()> on_frame;
+
+        // The log supplies the seed and frame length; with recording set
+        // the frames' keys are added to it, with replaying set they come
+        // from it. The profiler, debugger and capture may be null; a
+        // debugger takes over running the frames from the profiler. The
+        // capture gets every frame shown, rewound ones included.
+        Emulator(Chip8& chip8, InputLog& log, bool recording, bool replaying,
+                 bool paced, Profiler* profiler, Debugger* debugger = nullptr,
+                 Capture* capture = nullptr);
+        ~Emulator();
+
+        void start();
+
+        // Wake the emulation thread after pushing key events
+        void notify_input();
+
+        // Stop the thread and wait for it; the machine, log and profiler
+        // may be used again afterwards
+        void stop();
+
+        // False once stopped or the ROM halted
+        bool is_running() const { return running; }
+};
+
+#endif // EMULATOR_H
@@ -0,0 +1,254 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "audio.h"
+#include "capture.h"
+#include "chip8.h"
+#include "fleet.h"
+#include "romfile.h"
+#include "hash.h"
+#include "inputlog.h"
+#include "jit.h"
+#include "scheduler.h"
+
+// Per-thread job queue. The owner pops from the back and idle threads
+// steal from the front, so contention only happens once a queue runs dry.
+struct WorkQueue {
+    std::mutex lock;
+    std::deque<size_t> jobs;
+};
+
+static bool pop_local(WorkQueue& queue, size_t& job) {
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (queue.jobs.empty()) return false;
+    job = queue.jobs.back();
+    queue.jobs.pop_back();
+    return true;
+}
+
+static bool steal(std::vector<WorkQueue>& queues, size_t thief, size_t& job) {
+    for (size_t i = 1; i < queues.size(); i++) {
+        WorkQueue& victim = queues[(thief + i) % queues.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.jobs.empty()) {
+            job = victim.jobs.front();
+            victim.jobs.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+// Map a ROM file the first time a job names it, or null if it cannot be
+// opened
+static const RomFile* map_rom(FleetRoms& roms, const std::string& rom) {
+    auto entry = roms.find(rom);
+    if (entry != roms.end()) return &entry->second;
+
+    RomFile& file = roms[rom];
+    if (!file.open(rom.c_str(), MAX_ROM_SIZE)) {
+        std::cerr << "Error: Failed to open ROM " << rom << std::endl;
+        roms.erase(rom);
+        return nullptr;
+    }
+    return &file;
+}
+
+bool read_manifest(const char* filepath, std::vector<FleetJob>& jobs, FleetRoms& roms,
+                   uint64_t seed, const RomDatabase* database) {
+    std::ifstream manifest(filepath);
+
+    if (!manifest) {
+        std::cerr << "Error: Failed to open manifest " << filepath << std::endl;
+        return false;
+    }
+
+    // Database entry of each ROM, looked up once
+    std::map<std::string, const RomInfo*> known;
+    std::string line;
+    int line_number = 0;
+    while (std::getline(manifest, line)) {
+        line_number++;
+        line = line.substr(0, line.find('#'));
+
+        std::istringstream fields(line);
+        FleetJob job;
+        if (!(fields >> job.rom)) continue; // Blank or comment line
+
+        job.instructions_per_frame = 0;     // Not given yet
+        job.seed = seed;
+        job.platform = Platform::Chip8;
+        job.quirks = PROFILE_CHIP8;
+
+        // The optional fields are told apart by whether they are numeric
+        std::string field;
+        bool valid = bool(fields >> job.cycles);
+        while (valid && fields >> field) {
+            char* end;
+            long ipf = std::strtol(field.c_str(), &end, 10);
+            if (*end == '\0' && job.input_log.empty()) {
+                job.instructions_per_frame = ipf;
+                valid = ipf > 0;
+            } else if (job.input_log.empty()) {
+                job.input_log = field;
+            } else {
+                valid = false;
+            }
+        }
+        if (!valid) {
+            std::cerr << "Error: " << filepath << ":" << line_number
+                      << ": expected <rom> <cycles> [instructions per frame]"
+                         " [input log]" << std::endl;
+            return false;
+        }
+
+        auto entry = known.find(job.rom);
+        if (entry == known.end()) {
+            const RomFile* file = map_rom(roms, job.rom);
+            entry = known.emplace(job.rom, file && database ? database->find(file->hash())
+                                                            : nullptr).first;
+        }
+        const RomInfo* info = entry->second;
+        if (info != nullptr) {
+            job.platform = info->platform;
+            job.quirks = rom_quirks(*info);
+            if (job.instructions_per_frame == 0) {
+                job.instructions_per_frame = info->instructions_per_frame;
+            }
+        }
+        if (job.instructions_per_frame == 0) {
+            job.instructions_per_frame = DEFAULT_INSTRUCTIONS_PER_FRAME;
+        }
+        jobs.push_back(job);
+    }
+
+    return true;
+}
+
+static FleetResult run_job(const FleetJob& job, const RomFile* rom,
+                          Engine engine) {
+    FleetResult result {job.rom, false, false, 0, 0, 0, 0.0};
+    auto start = std::chrono::steady_clock::now();
+
+    InputLog log(job.seed, job.instructions_per_frame);
+    bool replay = !job.input_log.empty();
+    if (replay && !log.load(job.input_log.c_str())) {
+        rom = nullptr;
+    }
+
+    // Chip8 is large, keep it off the worker stack
+    bool xo_chip = job.platform == Platform::XoChip;
+    auto chip8 = std::make_unique<Chip8>(log.seed, xo_chip, job.quirks);
+    if (rom != nullptr && chip8->load(rom->data(), rom->size())) {
+        result.loaded = true;
+
+        WavSink wav;
+        Capture capture;
+        if (!job.capture.empty() && !capture.open(job.capture.c_str())) {
+            result.loaded = false;
+            return result;
+        }
+        // The JIT maps its code arena, so only build it for the engines
+        // that use it
+        std::unique_ptr<Jit> jit;
+        if (engine != Engine::Interpreter) jit = std::make_unique<Jit>();
+        std::unique_ptr<Chip8> reference;
+        if (engine == Engine::Differential) {
+            reference = std::make_unique<Chip8>(log.seed, xo_chip, job.quirks);
+            reference->load(rom->data(), rom->size());
+        }
+
+        // Run in frames, ticking the timers between them
+        for (uint64_t frames = 0;
+             result.cycles < job.cycles && chip8->is_running; frames++) {
+            uint64_t frame = job.cycles - result.cycles;
+            if (frame > uint64_t(log.instructions_per_frame)) {
+                frame = log.instructions_per_frame;
+            }
+
+            if (replay) {
+                chip8->set_key_mask(log.mask_at(frames));
+                if (reference) reference->set_key_mask(log.mask_at(frames));
+            }
+
+            if (engine == Engine::Interpreter) {
+                result.cycles += chip8->run(frame);
+            } else if (engine == Engine::Jit) {
+                result.cycles += jit->run(*chip8, frame);
+            } else {
+                uint64_t diverged_at = 0;
+                if (!jit->verify(*chip8, *reference, frame, diverged_at)) {
+                    result.diverged = true;
+                    result.cycles += diverged_at;
+                    break;
+                }
+                result.cycles += frame;
+                reference->tick_timers();
+            }
+
+            chip8->tick_timers();
+            if (!job.wav.empty()) wav.push(audio_frame(*chip8));
+            if (!job.capture.empty()) capture.push(*chip8);
+        }
+
+        if (!job.wav.empty()) wav.save(job.wav.c_str());
+        if (!job.capture.empty() && capture.close() && capture.frames_dropped() > 0) {
+            std::cerr << job.capture << ": " << capture.frames_dropped() << " of "
+                      << capture.frames_pushed() << " frames dropped" << std::endl;
+        }
+    }
+
+    const auto& memory = chip8->get_memory();
+    result.memory_hash = hash64(memory.data(), memory.size());
+    result.gfx_hash = chip8->extended_resolution
+        ? hash64(chip8->gfx_extended.data(), chip8->gfx_extended.size())
+        : hash64(chip8->gfx.data(), chip8->gfx.size());
+
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    result.wall_ms = elapsed.count();
+
+    return result;
+}
+
+std::vector<FleetResult> run_fleet(const std::vector<FleetJob>& jobs, const FleetRoms& roms,
+                                   unsigned threads, Engine engine) {
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    if (threads == 0) threads = 1;
+
+    // Deal jobs round-robin so every queue starts with a similar mix
+    std::vector<WorkQueue> queues(threads);
+    for (size_t i = 0; i < jobs.size(); i++) {
+        queues[i % threads].jobs.push_back(i);
+    }
+
+    std::vector<FleetResult> results(jobs.size());
+    auto worker = [&](size_t id) {
+        size_t job;
+        while (pop_local(queues[id], job) || steal(queues, id, job)) {
+            auto rom = roms.find(jobs[job].rom);
+            results[job] = run_job(jobs[job],
+                                   rom == roms.end() ? nullptr : &rom->second,
+                                   engine);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < threads; i++) {
+        pool.emplace_back(worker, i);
+    }
+    worker(0);
+    for (std::thread& thread : pool) {
+        thread.join();
+    }
+
+    return results;
+}
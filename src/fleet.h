@@ -0,0 +1,64 @@
+#ifndef FLEET_H
+#define FLEET_H
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "romdb.h"
+#include "romfile.h"
+
+// How each instance executes instructions
+enum class Engine {
+    Interpreter,    // Chip8::cycle()
+    Jit,            // Basic-block recompiler
+    Differential    // Recompiler checked against the interpreter in lock step
+};
+
+// One ROM instance to run headless for a fixed number of cycles, ticking
+// the timers every instructions_per_frame cycles. With an input log the
+// recorded keys, seed and frame length replace the defaults. With a WAV
+// path the buzzer output is written there, and with a capture path the
+// screen (see Capture).
+struct FleetJob {
+    std::string rom;
+    uint64_t cycles;
+    int instructions_per_frame;
+    uint64_t seed;
+    Platform platform;
+    uint32_t quirks;        // QUIRK_* bits
+    std::string input_log;
+    std::string wav;
+    std::string capture;
+};
+
+// Outcome of a single headless instance
+struct FleetResult {
+    std::string rom;
+    bool loaded;
+    bool diverged;
+    uint64_t cycles;
+    uint64_t memory_hash;
+    uint64_t gfx_hash;
+    double wall_ms;
+};
+
+// ROM files by path, each mapped once and shared by all its instances
+typedef std::map<std::string, RomFile> FleetRoms;
+
+// Read a manifest of "<rom path> <cycles> [instructions per frame]
+// [input log]" lines; '#' starts a comment. Jobs get the given seed. Each
+// ROM is mapped into roms the first time it appears; one that cannot be
+// opened is reported and left out, and its jobs fail to load. ROMs found
+// in the database take their platform and quirks from it, and their
+// instructions per frame unless the line gives them. Others run as CHIP-8.
+bool read_manifest(const char* filepath, std::vector<FleetJob>& jobs, FleetRoms& roms,
+                   uint64_t seed = 0, const RomDatabase* database = nullptr);
+
+// Run every job on a work-stealing pool of the given number of threads
+// (0 selects one thread per hardware core), on the ROMs read_manifest
+// mapped. Results keep manifest order.
+std::vector<FleetResult> run_fleet(const std::vector<FleetJob>& jobs, const FleetRoms& roms,
+                                   unsigned threads, Engine engine);
+
+#endif // FLEET_H
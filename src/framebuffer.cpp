@@ -0,0 +1,313 @@
+#include <algorithm>
+
+#include "framebuffer.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Words in one plane
+const int PLANE_WORDS = 32;
+const int PLANE_WORDS_EXTENDED = 64 * 2;
+
+// Place a sprite row, left-aligned in the top bits of value, at column x of
+// a 64 pixel row. With Wrap the part past the right edge comes back on the
+// left.
+template <bool Wrap>
+static inline uint64_t place_row(uint64_t value, int x) {
+    if (Wrap && x > 0) return value >> x | value << (64 - x);
+    return value >> x;
+}
+
+// Split a sprite row, left-aligned in the top bits of value, into the left
+// and right words of a 128 pixel row at column x
+template <bool Wrap>
+static inline void split_row(uint64_t value, int x, uint64_t& left, uint64_t& right) {
+    if (x < 64) {
+        left = value >> x;
+        right = x > 0 ? value << (64 - x) : 0;
+    } else {
+        left = Wrap && x > 64 ? value << (128 - x) : 0;
+        right = value >> (x - 64);
+    }
+}
+
+template <bool Wrap>
+bool draw_sprite(Framebuffer& gfx, int plane, int x, int y, const uint8_t* rows, int height) {
+    x %= 64;
+    y %= 32;
+    if (!Wrap && height > 32 - y) height = 32 - y;
+
+    // A whole sprite row is one shift, collision one AND. Only wrapped
+    // sprites run past the bottom edge; their rows continue at the top.
+    uint64_t* target = gfx.data() + plane * PLANE_WORDS;
+    uint64_t collision = 0;
+    for (int row = 0; row < height; row++) {
+        uint64_t bits = place_row<Wrap>(uint64_t(rows[row]) << 56, x);
+        uint64_t& word = target[Wrap ? (y + row) & 31 : y + row];
+        collision |= word & bits;
+        word ^= bits;
+    }
+
+    return collision != 0;
+}
+
+// XOR 128-bit row masks, laid out like the framebuffer, onto a 128x64
+// plane from row y down, wrapping as for draw_sprite
+template <bool Wrap>
+static bool xor_rows(uint64_t* target, int y, const uint64_t* masks, int height) {
+    uint64_t collision = 0;
+    for (int row = 0; row < height; row++) {
+        uint64_t* words = target + (Wrap ? (y + row) & 63 : y + row) * 2;
+        collision |= (words[0] & masks[row * 2]) | (words[1] & masks[row * 2 + 1]);
+        words[0] ^= masks[row * 2];
+        words[1] ^= masks[row * 2 + 1];
+    }
+    return collision != 0;
+}
+
+template <bool Wrap>
+bool draw_sprite(FramebufferExtended& gfx, int plane, int x, int y, const uint8_t* rows, int height) {
+    x %= 128;
+    y %= 64;
+    if (!Wrap && height > 64 - y) height = 64 - y;
+
+    uint64_t* target = gfx.data() + plane * PLANE_WORDS_EXTENDED;
+    uint64_t collision = 0;
+    for (int row = 0; row < height; row++) {
+        uint64_t left, right;
+        split_row<Wrap>(uint64_t(rows[row]) << 56, x, left, right);
+        uint64_t* words = target + (Wrap ? (y + row) & 63 : y + row) * 2;
+        collision |= (words[0] & left) | (words[1] & right);
+        words[0] ^= left;
+        words[1] ^= right;
+    }
+
+    return collision != 0;
+}
+
+template <bool Wrap>
+bool draw_sprite16(Framebuffer& gfx, int plane, int x, int y, const uint8_t* rows) {
+    x %= 64;
+    y %= 32;
+    int height = !Wrap && 32 - y < 16 ? 32 - y : 16;
+
+    uint64_t* target = gfx.data() + plane * PLANE_WORDS;
+    uint64_t collision = 0;
+    for (int row = 0; row < height; row++) {
+        uint64_t value = uint64_t(rows[row * 2] << 8 | rows[row * 2 + 1]) << 48;
+        uint64_t bits = place_row<Wrap>(value, x);
+        uint64_t& word = target[Wrap ? (y + row) & 31 : y + row];
+        collision |= word & bits;
+        word ^= bits;
+    }
+
+    return collision != 0;
+}
+
+template <bool Wrap>
+bool draw_sprite16(FramebufferExtended& gfx, int plane, int x, int y, const uint8_t* rows) {
+    x %= 128;
+    y %= 64;
+    int height = !Wrap && 64 - y < 16 ? 64 - y : 16;
+
+    // Build the 128-bit mask for every row, laid out like the framebuffer
+    alignas(32) uint64_t masks[16 * 2];
+    for (int row = 0; row < height; row++) {
+        uint64_t value = uint64_t(rows[row * 2] << 8 | rows[row * 2 + 1]) << 48;
+        split_row<Wrap>(value, x, masks[row * 2], masks[row * 2 + 1]);
+    }
+
+    // A sprite wrapping past the bottom edge is not contiguous in memory
+    uint64_t* plane_words = gfx.data() + plane * PLANE_WORDS_EXTENDED;
+    if (Wrap && y > 64 - 16) {
+        return xor_rows<true>(plane_words, y, masks, height);
+    }
+
+    uint64_t* target = plane_words + y * 2;
+    int row = 0;
+
+#if defined(__AVX2__)
+    // Two rows per step
+    __m256i hits = _mm256_setzero_si256();
+    for (; row + 2 <= height; row += 2) {
+        __m256i mask = _mm256_load_si256(reinterpret_cast<const __m256i*>(masks + row * 2));
+        __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(target + row * 2));
+        hits = _mm256_or_si256(hits, _mm256_and_si256(pixels, mask));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(target + row * 2),
+                            _mm256_xor_si256(pixels, mask));
+    }
+    bool collision = !_mm256_testz_si256(hits, hits);
+#elif defined(__SSE2__)
+    // One 128 pixel row per step
+    __m128i hits = _mm_setzero_si128();
+    for (; row < height; row++) {
+        __m128i mask = _mm_load_si128(reinterpret_cast<const __m128i*>(masks + row * 2));
+        __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(target + row * 2));
+        hits = _mm_or_si128(hits, _mm_and_si128(pixels, mask));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(target + row * 2),
+                         _mm_xor_si128(pixels, mask));
+    }
+    bool collision = _mm_movemask_epi8(_mm_cmpeq_epi8(hits, _mm_setzero_si128())) != 0xFFFF;
+#else
+    bool collision = false;
+#endif
+
+    // Scalar rows left over, or all of them without SIMD
+    uint64_t tail = 0;
+    for (; row < height; row++) {
+        tail |= (target[row * 2] & masks[row * 2]) | (target[row * 2 + 1] & masks[row * 2 + 1]);
+        target[row * 2] ^= masks[row * 2];
+        target[row * 2 + 1] ^= masks[row * 2 + 1];
+    }
+
+    return collision || tail != 0;
+}
+
+template bool draw_sprite<false>(Framebuffer&, int, int, int, const uint8_t*, int);
+template bool draw_sprite<true>(Framebuffer&, int, int, int, const uint8_t*, int);
+template bool draw_sprite<false>(FramebufferExtended&, int, int, int, const uint8_t*, int);
+template bool draw_sprite<true>(FramebufferExtended&, int, int, int, const uint8_t*, int);
+template bool draw_sprite16<false>(Framebuffer&, int, int, int, const uint8_t*);
+template bool draw_sprite16<true>(Framebuffer&, int, int, int, const uint8_t*);
+template bool draw_sprite16<false>(FramebufferExtended&, int, int, int, const uint8_t*);
+template bool draw_sprite16<true>(FramebufferExtended&, int, int, int, const uint8_t*);
+
+void clear(Framebuffer& gfx, int planes) {
+    for (int plane = 0; plane < 2; plane++) {
+        if ((planes >> plane & 1) == 0) continue;
+        uint64_t* words = gfx.data() + plane * PLANE_WORDS;
+        std::fill(words, words + PLANE_WORDS, 0);
+    }
+}
+
+void clear(FramebufferExtended& gfx, int planes) {
+    for (int plane = 0; plane < 2; plane++) {
+        if ((planes >> plane & 1) == 0) continue;
+        uint64_t* words = gfx.data() + plane * PLANE_WORDS_EXTENDED;
+        std::fill(words, words + PLANE_WORDS_EXTENDED, 0);
+    }
+}
+
+// Vertical scrolls move whole rows of words_per_row words within each
+// selected plane of plane_words words
+static void scroll_rows(uint64_t* gfx, int plane_words, int words_per_row,
+                        int planes, int rows, bool down) {
+    int shift = std::min(rows * words_per_row, plane_words);
+    for (int plane = 0; plane < 2; plane++) {
+        if ((planes >> plane & 1) == 0) continue;
+        uint64_t* begin = gfx + plane * plane_words;
+        uint64_t* end = begin + plane_words;
+        if (down) {
+            std::copy_backward(begin, end - shift, end);
+            std::fill(begin, begin + shift, 0);
+        } else {
+            std::copy(begin + shift, end, begin);
+            std::fill(end - shift, end, 0);
+        }
+    }
+}
+
+void scroll_up(Framebuffer& gfx, int planes, int rows) {
+    scroll_rows(gfx.data(), PLANE_WORDS, 1, planes, rows, false);
+}
+
+void scroll_up(FramebufferExtended& gfx, int planes, int rows) {
+    scroll_rows(gfx.data(), PLANE_WORDS_EXTENDED, 2, planes, rows, false);
+}
+
+void scroll_down(Framebuffer& gfx, int planes, int rows) {
+    scroll_rows(gfx.data(), PLANE_WORDS, 1, planes, rows, true);
+}
+
+void scroll_down(FramebufferExtended& gfx, int planes, int rows) {
+    scroll_rows(gfx.data(), PLANE_WORDS_EXTENDED, 2, planes, rows, true);
+}
+
+void scroll_right(Framebuffer& gfx, int planes, int pixels) {
+    for (int plane = 0; plane < 2; plane++) {
+        if ((planes >> plane & 1) == 0) continue;
+        uint64_t* words = gfx.data() + plane * PLANE_WORDS;
+        for (int y = 0; y < 32; y++) {
+            words[y] >>= pixels;
+        }
+    }
+}
+
+// Shifting by 64 is undefined, so a zero shift is left alone
+void scroll_right(FramebufferExtended& gfx, int planes, int pixels) {
+    if (pixels == 0) return;
+    for (int plane = 0; plane < 2; plane++) {
+        if ((planes >> plane & 1) == 0) continue;
+        uint64_t* words = gfx.data() + plane * PLANE_WORDS_EXTENDED;
+        for (int y = 0; y < 64; y++) {
+            words[y * 2 + 1] = words[y * 2 + 1] >> pixels | words[y * 2] << (64 - pixels);
+            words[y * 2] >>= pixels;
+        }
+    }
+}
+
+void scroll_left(Framebuffer& gfx, int planes, int pixels) {
+    for (int plane = 0; plane < 2; plane++) {
+        if ((planes >> plane & 1) == 0) continue;
+        uint64_t* words = gfx.data() + plane * PLANE_WORDS;
+        for (int y = 0; y < 32; y++) {
+            words[y] <<= pixels;
+        }
+    }
+}
+
+void scroll_left(FramebufferExtended& gfx, int planes, int pixels) {
+    if (pixels == 0) return;
+    for (int plane = 0; plane < 2; plane++) {
+        if ((planes >> plane & 1) == 0) continue;
+        uint64_t* words = gfx.data() + plane * PLANE_WORDS_EXTENDED;
+        for (int y = 0; y < 64; y++) {
+            words[y * 2] = words[y * 2] << pixels | words[y * 2 + 1] >> (64 - pixels);
+            words[y * 2 + 1] <<= pixels;
+        }
+    }
+}
+
+uint64_t changed_rows(const Framebuffer& a, const Framebuffer& b) {
+    uint64_t rows = 0;
+    for (int y = 0; y < 32; y++) {
+        uint64_t diff = (a[y] ^ b[y]) | (a[PLANE_WORDS + y] ^ b[PLANE_WORDS + y]);
+        rows |= uint64_t(diff != 0) << y;
+    }
+    return rows;
+}
+
+uint64_t changed_rows(const FramebufferExtended& a, const FramebufferExtended& b) {
+    uint64_t rows = 0;
+    for (int i = 0; i < 64 * 2; i++) {
+        uint64_t diff = (a[i] ^ b[i])
+                      | (a[PLANE_WORDS_EXTENDED + i] ^ b[PLANE_WORDS_EXTENDED + i]);
+        rows |= uint64_t(diff != 0) << (i / 2);
+    }
+    return rows;
+}
+
+std::array<uint8_t, 64 * 32> expand(const Framebuffer& gfx) {
+    std::array<uint8_t, 64 * 32> pixels;
+
+    for (int i = 0; i < 64 * 32; i++) {
+        pixels[i] = (gfx[i / 64] >> (63 - i % 64) & 1)
+                  | (gfx[PLANE_WORDS + i / 64] >> (63 - i % 64) & 1) << 1;
+    }
+
+    return pixels;
+}
+
+std::array<uint8_t, 128 * 64> expand(const FramebufferExtended& gfx) {
+    std::array<uint8_t, 128 * 64> pixels;
+
+    for (int i = 0; i < 128 * 64; i++) {
+        pixels[i] = (gfx[i / 64] >> (63 - i % 64) & 1)
+                  | (gfx[PLANE_WORDS_EXTENDED + i / 64] >> (63 - i % 64) & 1) << 1;
+    }
+
+    return pixels;
+}
@@ -0,0 +1,68 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+#include <array>
+#include <cstdint>
+
+// Packed framebuffers: one bit per pixel, most significant bit leftmost.
+// The two XO-CHIP bitplanes sit one after the other in the same array; a
+// pixel's colour is its plane 0 bit plus twice its plane 1 bit. Classic
+// ROMs only draw on plane 0.
+typedef std::array<uint64_t, 32 * 2> Framebuffer;               // 64x32, one word per row
+typedef std::array<uint64_t, 64 * 2 * 2> FramebufferExtended;   // 128x64, two words per row
+
+// ARGB colour of each plane combination
+const uint32_t PALETTE[4] = {0xFF000000, 0xFFFFFFFF, 0xFFAAAAAA, 0xFF555555};
+
+// XOR an 8 pixel wide sprite of the given height onto one plane of the
+// framebuffer. The position wraps to the screen; pixels past the right or
+// bottom edge are clipped, or with Wrap set drawn at the opposite edge.
+// Returns true if any set pixel was cleared.
+template <bool Wrap = false>
+bool draw_sprite(Framebuffer& gfx, int plane, int x, int y, const uint8_t* rows, int height);
+template <bool Wrap = false>
+bool draw_sprite(FramebufferExtended& gfx, int plane, int x, int y, const uint8_t* rows, int height);
+
+// XOR a 16x16 sprite (two bytes per row, big-endian) onto one plane, with
+// the same wrapping, clipping and collision rules
+template <bool Wrap = false>
+bool draw_sprite16(Framebuffer& gfx, int plane, int x, int y, const uint8_t* rows);
+template <bool Wrap = false>
+bool draw_sprite16(FramebufferExtended& gfx, int plane, int x, int y, const uint8_t* rows);
+
+// Clear the planes set in the planes mask (bit N for plane N)
+void clear(Framebuffer& gfx, int planes);
+void clear(FramebufferExtended& gfx, int planes);
+
+// Scroll the planes set in the planes mask up or down by rows, or sideways
+// by pixels (at most 63), clearing what scrolls in. Rows move as whole
+// words, so a scroll costs a block move plus one shift per word.
+void scroll_up(Framebuffer& gfx, int planes, int rows);
+void scroll_up(FramebufferExtended& gfx, int planes, int rows);
+void scroll_down(Framebuffer& gfx, int planes, int rows);
+void scroll_down(FramebufferExtended& gfx, int planes, int rows);
+void scroll_right(Framebuffer& gfx, int planes, int pixels);
+void scroll_right(FramebufferExtended& gfx, int planes, int pixels);
+void scroll_left(Framebuffer& gfx, int planes, int pixels);
+void scroll_left(FramebufferExtended& gfx, int planes, int pixels);
+
+// Bit mask of the rows [y, y + height) of a screen with the given number of
+// rows, clipped at the bottom edge or with Wrap set continuing at the top
+template <bool Wrap = false>
+inline uint64_t row_mask(int y, int height, int screen_rows) {
+    y %= screen_rows;
+    int below = height - (screen_rows - y);     // Rows past the bottom edge
+    if (below > 0) height -= below;
+    uint64_t mask = height >= 64 ? ~uint64_t(0) : ((uint64_t(1) << height) - 1) << y;
+    if (Wrap && below > 0) mask |= (uint64_t(1) << below) - 1;
+    return mask;
+}
+
+// Bit mask of the rows that differ between two frames on either plane
+uint64_t changed_rows(const Framebuffer& a, const Framebuffer& b);
+uint64_t changed_rows(const FramebufferExtended& a, const FramebufferExtended& b);
+
+// Expand to one byte per pixel holding its colour (0-3)
+std::array<uint8_t, 64 * 32> expand(const Framebuffer& gfx);
+std::array<uint8_t, 128 * 64> expand(const FramebufferExtended& gfx);
+
+#endif // FRAMEBUFFER_H
@@ -0,0 +1,82 @@
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "chip8.h"
+#include "jit.h"
+#include "reference.h"
+
+// libFuzzer target running arbitrary programs through every execution
+// engine in lock step with the reference interpreter. The first four bytes
+// choose the machine: bit 0 of byte 0 selects XO-CHIP and bits 1-6 are the
+// QUIRK_* bits, byte 1 is the seed and bytes 2-3 the keys held on odd
+// frames. The rest is the ROM.
+//
+// The predecoded interpreter is compared with the reference after every
+// instruction. Decoding from memory every cycle, Chip8::run() with its idle
+// loop skipping, and the JIT are compared with it at the end of every
+// frame. The first divergence is printed and aborts.
+
+const int FRAMES = 8;
+const int INSTRUCTIONS_PER_FRAME = 64;
+
+static void diverged(const char* engine, int frame, int instruction, const std::string& what) {
+    std::cout << "Divergence: " << engine << " in frame " << frame
+              << " at instruction " << instruction << ": " << what << std::endl;
+    std::abort();
+}
+
+extern "C" int LLVMFuzzerInitialize(int*, char***) {
+    // Random programs run unknown opcodes all the time, each with an error
+    std::cerr.rdbuf(nullptr);
+    return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    if (size < 4) return 0;
+    bool xo_chip = data[0] & 1;
+    uint32_t quirks = (data[0] >> 1) & 0x3F;
+    uint64_t seed = data[1];
+    uint16_t keys = data[2] | data[3] << 8;
+
+    auto chip8 = std::make_unique<Chip8>(seed, xo_chip, quirks);
+    if (!chip8->load(data + 4, size - 4)) return 0;
+    auto uncached = std::make_unique<Chip8>(*chip8);
+    auto skipping = std::make_unique<Chip8>(*chip8);
+    auto compiled = std::make_unique<Chip8>(*chip8);
+    Reference reference(*chip8);
+    Jit jit;
+
+    for (int frame = 0; frame < FRAMES; frame++) {
+        uint16_t mask = frame % 2 ? keys : 0;
+        chip8->set_key_mask(mask);
+        uncached->set_key_mask(mask);
+        skipping->set_key_mask(mask);
+        compiled->set_key_mask(mask);
+        reference.set_key_mask(mask);
+
+        for (int i = 0; i < INSTRUCTIONS_PER_FRAME && chip8->is_running; i++) {
+            chip8->cycle();
+            uncached->cycle_uncached();
+            reference.cycle();
+            std::string difference = reference.compare(*chip8, false);
+            if (!difference.empty()) diverged("interpreter", frame, i, difference);
+        }
+        skipping->run(INSTRUCTIONS_PER_FRAME);
+        jit.run(*compiled, INSTRUCTIONS_PER_FRAME);
+
+        std::string difference = reference.compare(*chip8, true);
+        if (!difference.empty()) diverged("interpreter", frame, INSTRUCTIONS_PER_FRAME, difference);
+        if (!uncached->state_equals(*chip8)) diverged("uncached", frame, INSTRUCTIONS_PER_FRAME, "state");
+        if (!skipping->state_equals(*chip8)) diverged("run()", frame, INSTRUCTIONS_PER_FRAME, "state");
+        if (!compiled->state_equals(*chip8)) diverged("JIT", frame, INSTRUCTIONS_PER_FRAME, "state");
+
+        chip8->tick_timers();
+        uncached->tick_timers();
+        skipping->tick_timers();
+        compiled->tick_timers();
+        reference.tick_timers();
+    }
+    return 0;
+}
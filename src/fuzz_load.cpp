@@ -0,0 +1,45 @@
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "chip8.h"
+#include "scheduler.h"
+
+// libFuzzer target for the loaders. Each input is loaded as a ROM image
+// and then as a save state, into a CHIP-8 and an XO-CHIP machine, and
+// whatever loads is run for a few frames. A save state that loads must
+// save and load again to the same state.
+
+const int FRAMES = 4;
+
+extern "C" int LLVMFuzzerInitialize(int*, char***) {
+    // Most inputs are rejected or run unknown opcodes, each with an error
+    std::cerr.rdbuf(nullptr);
+    return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    Scheduler scheduler(DEFAULT_INSTRUCTIONS_PER_FRAME, false);
+
+    for (bool xo_chip : {false, true}) {
+        auto chip8 = std::make_unique<Chip8>(0, xo_chip);
+        if (chip8->load(data, size)) {
+            for (int frame = 0; frame < FRAMES; frame++) scheduler.run_frame(*chip8);
+        }
+
+        auto restored = std::make_unique<Chip8>(0, xo_chip);
+        if (!restored->load_state(data, size)) continue;
+
+        std::vector<uint8_t> state;
+        restored->save_state(state);
+        auto reloaded = std::make_unique<Chip8>(1, xo_chip);
+        if (!reloaded->load_state(state.data(), state.size())
+            || !reloaded->state_equals(*restored)) {
+            std::cout << "Save state did not survive saving and loading again" << std::endl;
+            std::abort();
+        }
+        for (int frame = 0; frame < FRAMES; frame++) scheduler.run_frame(*restored);
+    }
+    return 0;
+}
@@ -0,0 +1,40 @@
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <vector>
+
+// Stand-in for libFuzzer's main() in builds without it: runs a fuzz target
+// once on every file named on the command line, or found in a directory
+// named there, to replay a crash or a corpus
+
+extern "C" int LLVMFuzzerInitialize(int* argc, char*** argv);
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+static void run_file(const std::filesystem::path& path) {
+    std::ifstream file(path, std::ifstream::binary);
+    std::vector<uint8_t> input(std::istreambuf_iterator<char>(file),
+                               (std::istreambuf_iterator<char>()));
+    LLVMFuzzerTestOneInput(input.data(), input.size());
+}
+
+int main(int argc, char** argv) {
+    LLVMFuzzerInitialize(&argc, &argv);
+
+    size_t inputs = 0;
+    for (int i = 1; i < argc; i++) {
+        if (std::filesystem::is_directory(argv[i])) {
+            for (const auto& entry : std::filesystem::directory_iterator(argv[i])) {
+                if (!entry.is_regular_file()) continue;
+                run_file(entry.path());
+                inputs++;
+            }
+        } else {
+            run_file(argv[i]);
+            inputs++;
+        }
+    }
+    std::cout << "Ran " << inputs << " inputs" << std::endl;
+    return 0;
+}
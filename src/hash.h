@@ -0,0 +1,9 @@
+#ifndef HASH_H
+#define HASH_H
+#include <cstddef>
+#include <cstdint>
+
+// 64-bit xxHash (XXH64) of a block of bytes
+uint64_t hash64(const void* data, size_t size, uint64_t seed = 0);
+
+#endif // HASH_H
@@ -0,0 +1,119 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "fleet.h"
+
+static void usage() {
+    std::cout << "Usage: chip8-headless [--engine interp|jit|diff] "
+                 "[--seed RNG seed] [--wav output prefix] [--capture output file] [--platform chip8|chip48|schip|xochip] "
+                 "[--db ROM database] [manifest file] [threads]" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    Engine engine = Engine::Interpreter;
+    uint64_t seed = 0;
+    const char* wav = nullptr;
+    const char* capture = nullptr;
+    const char* platform_arg = nullptr;
+    const char* database_path = nullptr;
+    std::vector<const char*> args;
+
+    // Parse command line arguments
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+            const char* name = argv[++i];
+            if (std::strcmp(name, "interp") == 0) {
+                engine = Engine::Interpreter;
+            } else if (std::strcmp(name, "jit") == 0) {
+                engine = Engine::Jit;
+            } else if (std::strcmp(name, "diff") == 0) {
+                engine = Engine::Differential;
+            } else {
+                usage();
+                return -1;
+            }
+        } else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = std::strtoull(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--wav") == 0 && i + 1 < argc) {
+            wav = argv[++i];
+        } else if (std::strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+            capture = argv[++i];
+        } else if (std::strcmp(argv[i], "--platform") == 0 && i + 1 < argc) {
+            platform_arg = argv[++i];
+        } else if (std::strcmp(argv[i], "--db") == 0 && i + 1 < argc) {
+            database_path = argv[++i];
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+
+    Platform platform = Platform::Chip8;
+    if ((args.size() != 1 && args.size() != 2)
+        || (platform_arg && !parse_platform(platform_arg, platform))) {
+        usage();
+        return -1;
+    }
+
+    RomDatabase database;
+    if (!database.load(database_path ? database_path : DEFAULT_ROM_DATABASE,
+                       database_path != nullptr)) {
+        return -1;
+    }
+
+    std::vector<FleetJob> jobs;
+    FleetRoms roms;
+    if (!read_manifest(args[0], jobs, roms, seed, &database)) {
+        return -1;
+    }
+
+    // A platform on the command line overrides the database
+    if (platform_arg != nullptr) {
+        for (FleetJob& job : jobs) {
+            job.platform = platform;
+            job.quirks = platform_quirks(platform);
+        }
+    }
+
+    // Buzzer output of each instance to <prefix><manifest index>.wav
+    if (wav != nullptr) {
+        for (size_t i = 0; i < jobs.size(); i++) {
+            jobs[i].wav = wav + std::to_string(i) + ".wav";
+        }
+    }
+
+    // Screen of each instance to the capture file name with the manifest
+    // index before its extension
+    if (capture != nullptr) {
+        std::string name = capture;
+        size_t dot = name.find_last_of('.');
+        if (dot == std::string::npos || name.find('/', dot) != std::string::npos) dot = name.size();
+        for (size_t i = 0; i < jobs.size(); i++) {
+            jobs[i].capture = name.substr(0, dot) + std::to_string(i) + name.substr(dot);
+        }
+    }
+
+    unsigned threads = args.size() == 2 ? std::strtoul(args[1], nullptr, 10) : 0;
+
+    std::vector<FleetResult> results = run_fleet(jobs, roms, threads, engine);
+
+    // One tab-separated line per instance, in manifest order
+    std::cout << "rom\tstatus\tcycles\tmemory_hash\tgfx_hash\twall_ms\n";
+    bool all_ok = true;
+    for (const FleetResult& result : results) {
+        all_ok &= result.loaded && !result.diverged;
+        std::cout << result.rom << '\t'
+                  << (!result.loaded ? "error"
+                      : result.diverged ? "diverged" : "ok") << '\t'
+                  << std::dec << result.cycles << '\t'
+                  << std::hex << std::setfill('0')
+                  << std::setw(16) << result.memory_hash << '\t'
+                  << std::setw(16) << result.gfx_hash << '\t'
+                  << std::dec << std::fixed << std::setprecision(3)
+                  << result.wall_ms << '\n';
+    }
+
+    return all_ok ? 0 : 1;
+}
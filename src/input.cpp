@@ -1,53 +1,82 @@
+#include <iostream>
+#include <sstream>
 #include <array>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
 #include <SDL2/SDL.h>
 #include "input.h"
 
-// CHIP-8 hex keyboard
-std::array<uint8_t, 16> keyboard {
-    SDLK_1,
-    SDLK_2,
-    SDLK_3,
-    SDLK_4,
-    SDLK_q,
-    SDLK_w,
-    SDLK_e,
-    SDLK_r,
-    SDLK_a,
-    SDLK_s,
-    SDLK_d,
-    SDLK_f,
-    SDLK_z,
-    SDLK_x,
-    SDLK_c,
-    SDLK_v
-};
+// Keypad key for each scancode, -1 where none is mapped
+std::array<int8_t, SDL_NUM_SCANCODES> keypad;
+
+bool set_keymap(const char* keymap) {
+    std::vector<std::string> names;
+    if (std::strchr(keymap, ',') != nullptr) {
+        std::istringstream fields(keymap);
+        std::string name;
+        while (std::getline(fields, name, ',')) names.push_back(name);
+    } else {
+        for (const char* c = keymap; *c != '\0'; c++) {
+            names.push_back(std::string(1, *c));
+        }
+    }
+    if (names.size() != 16) {
+        std::cerr << "Error: Key map needs 16 keys" << std::endl;
+        return false;
+    }
+
+    std::array<int8_t, SDL_NUM_SCANCODES> mapped;
+    mapped.fill(-1);
+    for (int i = 0; i < 16; i++) {
+        SDL_Scancode scancode = SDL_GetScancodeFromName(names[i].c_str());
+        if (scancode == SDL_SCANCODE_UNKNOWN) {
+            std::cerr << "Error: Unknown key \"" << names[i] << "\"" << std::endl;
+            return false;
+        }
+        mapped[scancode] = i;
+    }
+    keypad = mapped;
+    return true;
+}
+
+// Events the queue had no room for, oldest first. They go out ahead of
+// any newer event, so a key is never left held by a lost key-up.
+std::deque<KeyEvent> backlog;
+
+static void forward(KeyEventQueue& events, const KeyEvent& event) {
+    if (!backlog.empty() || !events.push(event)) backlog.push_back(event);
+}
 
 // Receive input from keyboard
-// Sets Chip8::is_running to false if user requests quit
-void process_input(Chip8& chip8) {
+bool process_input(KeyEventQueue& events) {
     SDL_Event e;
+    bool running = true;
+
+    while (!backlog.empty() && events.push(backlog.front())) backlog.pop_front();
 
     while (SDL_PollEvent(&e) != 0) {
-        if (e.type == SDL_QUIT) chip8.is_running = false; // Quit
+        if (e.type == SDL_QUIT) running = false;
+        if (e.type != SDL_KEYDOWN && e.type != SDL_KEYUP) continue;
 
-        // Keydown events
-        if (e.type == SDL_KEYDOWN) {
-            if (e.key.keysym.sym == SDLK_ESCAPE) chip8.is_running = false; // Quit
+        // Auto-repeat carries no new state
+        if (e.key.repeat) continue;
 
-            for (int i = 0; i < 16; i++) {
-                if (e.key.keysym.sym == keyboard[i]) {
-                    chip8.keys[i] = 1;
-                }
-            }
-        }
+        bool pressed = e.type == SDL_KEYDOWN;
+        if (pressed && e.key.keysym.sym == SDLK_ESCAPE) running = false;
 
-        // Keyup events
-        if (e.type == SDL_KEYUP) {
-            for (int i = 0; i < 16; i++) {
-                if (e.key.keysym.sym == keyboard[i]) {
-                    chip8.keys[i] = 0;
-                }
-            }
+        KeyEvent event {std::chrono::steady_clock::now(), 0, pressed};
+        if (e.key.keysym.sym == SDLK_BACKSPACE) {
+            event.key = KEY_REWIND;
+            forward(events, event);
+        }
+        SDL_Scancode scancode = e.key.keysym.scancode;
+        if (scancode >= 0 && scancode < SDL_NUM_SCANCODES && keypad[scancode] >= 0) {
+            event.key = keypad[scancode];
+            forward(events, event);
         }
     }
+
+    return running;
 }
@@ -1,7 +1,32 @@
 #ifndef INPUT_H
 #define INPUT_H
-#include "chip8.h"
+#include <chrono>
+#include <cstdint>
 
-void process_input(Chip8& chip8);
+#include "spsc.h"
+
+// Key value for the rewind key (Backspace) in a KeyEvent
+const uint8_t KEY_REWIND = 16;
+
+// A key going down or up, as seen by the SDL thread
+struct KeyEvent {
+    std::chrono::steady_clock::time_point time;
+    uint8_t key;        // Keypad key 0-F, or KEY_REWIND
+    bool pressed;
+};
+
+typedef SpscQueue<KeyEvent, 256> KeyEventQueue;
+
+// Keyboard keys for keypad keys 0-F: either 16 single-character key names
+// or 16 comma-separated SDL key names (e.g. "Keypad 0,Keypad 1,...")
+const char* const DEFAULT_KEYMAP = "1234qwerasdfzxcv";
+
+// Map keyboard keys to the keypad. Fails on unknown key names.
+bool set_keymap(const char* keymap);
+
+// Forward keypad and rewind key changes to the emulation thread. Changes
+// that find the queue full are held and sent, in order, on later calls.
+// Returns false when the user asks to quit.
+bool process_input(KeyEventQueue& events);
 
 #endif // INPUT_H
@@ -0,0 +1,143 @@
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+#include "inputlog.h"
+
+const char INPUT_LOG_MAGIC[4] = {'C', '8', 'I', 'L'};
+const uint16_t INPUT_LOG_VERSION = 1;
+
+static void put(std::vector<uint8_t>& out, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        out.push_back(value >> (8 * i));
+    }
+}
+
+static void put_varint(std::vector<uint8_t>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(value | 0x80);
+        value >>= 7;
+    }
+    out.push_back(value);
+}
+
+// Readers fail instead of running past the end of the data
+static bool get(const uint8_t*& in, const uint8_t* end, uint64_t& value,
+                int bytes) {
+    if (end - in < bytes) return false;
+    value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value |= uint64_t(*in++) << (8 * i);
+    }
+    return true;
+}
+
+static bool get_varint(const uint8_t*& in, const uint8_t* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (in == end) return false;
+        uint8_t byte = *in++;
+        value |= uint64_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+InputLog::InputLog(uint64_t seed, int instructions_per_frame)
+    : length {0}
+    , seed {seed}
+    , instructions_per_frame {instructions_per_frame}
+{
+}
+
+void InputLog::record(uint64_t frame, uint16_t mask) {
+    if (frame < length) {
+        while (!changes.empty() && changes.back().frame >= frame) {
+            changes.pop_back();
+        }
+    }
+    length = frame + 1;
+
+    uint16_t previous = changes.empty() ? 0 : changes.back().mask;
+    if (mask != previous) {
+        changes.push_back({frame, mask});
+    }
+}
+
+uint16_t InputLog::mask_at(uint64_t frame) const {
+    auto after = std::upper_bound(changes.begin(), changes.end(), frame,
+        [](uint64_t frame, const Change& change) {
+            return frame < change.frame;
+        });
+    return after == changes.begin() ? 0 : (after - 1)->mask;
+}
+
+bool InputLog::save(const char* filepath) const {
+    std::vector<uint8_t> data(INPUT_LOG_MAGIC, INPUT_LOG_MAGIC + 4);
+    put(data, INPUT_LOG_VERSION, 2);
+    put(data, seed, 8);
+    put(data, instructions_per_frame, 2);
+    put_varint(data, length);
+
+    uint64_t previous = 0;
+    for (const Change& change : changes) {
+        put_varint(data, change.frame - previous);
+        put(data, change.mask, 2);
+        previous = change.frame;
+    }
+
+    std::ofstream file(filepath, std::ofstream::binary);
+    file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    if (!file) {
+        std::cerr << "Error: Failed to write input log " << filepath << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool InputLog::load(const char* filepath) {
+    std::ifstream file(filepath, std::ifstream::binary);
+    if (!file) {
+        std::cerr << "Error: Failed to open input log " << filepath << std::endl;
+        return false;
+    }
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)),
+                              std::istreambuf_iterator<char>());
+
+    const uint8_t* in = data.data();
+    const uint8_t* end = in + data.size();
+    if (data.size() < 4 || std::memcmp(in, INPUT_LOG_MAGIC, 4) != 0) {
+        std::cerr << "Error: Not an input log: " << filepath << std::endl;
+        return false;
+    }
+    in += 4;
+
+    uint64_t version = 0, log_seed = 0, ipf = 0, log_length = 0;
+    if (!get(in, end, version, 2) || version != INPUT_LOG_VERSION) {
+        std::cerr << "Error: Unsupported input log version" << std::endl;
+        return false;
+    }
+
+    std::vector<Change> log_changes;
+    bool valid = get(in, end, log_seed, 8) && get(in, end, ipf, 2)
+              && ipf != 0 && get_varint(in, end, log_length);
+    uint64_t frame = 0;
+    while (valid && in < end) {
+        uint64_t delta = 0, mask = 0;
+        valid = get_varint(in, end, delta) && get(in, end, mask, 2);
+        frame += delta;
+        log_changes.push_back({frame, uint16_t(mask)});
+    }
+    if (!valid || (!log_changes.empty() && frame >= log_length)) {
+        std::cerr << "Error: Corrupt input log " << filepath << std::endl;
+        return false;
+    }
+
+    changes = std::move(log_changes);
+    length = log_length;
+    seed = log_seed;
+    instructions_per_frame = ipf;
+    return true;
+}
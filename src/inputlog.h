@@ -0,0 +1,44 @@
+#ifndef INPUTLOG_H
+#define INPUTLOG_H
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Per-frame keypad input of one run, together with the RNG seed and frame
+// length it ran with, so the run can be reproduced bit-exactly. Only
+// frames where the key bitmask changes are stored.
+class InputLog {
+    private:
+        struct Change {
+            uint64_t frame;
+            uint16_t mask;
+        };
+
+        std::vector<Change> changes;
+        uint64_t length;    // Frames recorded
+
+    public:
+        uint64_t seed;
+        int instructions_per_frame;
+
+        InputLog(uint64_t seed = 0, int instructions_per_frame = 0);
+
+        // Record the key mask applied before emulating the given frame.
+        // Recording an earlier frame than the last one (after a rewind)
+        // discards everything from that frame on.
+        void record(uint64_t frame, uint16_t mask);
+
+        // Key mask to apply before emulating the given frame
+        uint16_t mask_at(uint64_t frame) const;
+
+        uint64_t frames() const { return length; }
+
+        // File format, all values little-endian:
+        //   "C8IL", u16 version, u64 seed, u16 instructions per frame,
+        //   varint frames, then per change: varint frames since the
+        //   previous change, u16 key mask
+        bool save(const char* filepath) const;
+        bool load(const char* filepath);
+};
+
+#endif // INPUTLOG_H
@@ -0,0 +1,443 @@
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+
+#include "jit.h"
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#define JIT_X86_64
+#include <sys/mman.h>
+#endif
+
+const size_t ARENA_SIZE = 1 << 20;
+const int MAX_BLOCK_LENGTH = 64;
+
+#ifdef JIT_X86_64
+// Byte emitter for the handful of x86-64 forms the translator needs.
+// Generated code follows the System V ABI: rdi = V, rsi = &I, r8 = entry
+// table, r9 = budget pointer, next pc in eax. Only caller-saved registers
+// are touched.
+class Emitter {
+    private:
+        std::vector<uint8_t> code;
+        std::vector<size_t> dispatch_fixups;
+
+        void bytes(std::initializer_list<uint8_t> values) {
+            code.insert(code.end(), values);
+        }
+
+        void imm32(uint32_t value) {
+            for (int i = 0; i < 4; i++) {
+                code.push_back(value >> (8 * i));
+            }
+        }
+
+    public:
+        const std::vector<uint8_t>& data() const { return code; }
+
+        // Positions of rel32 operands that must point at the dispatcher
+        const std::vector<size_t>& fixups() const { return dispatch_fixups; }
+
+        // movzx eax/ecx, byte [rdi + reg]
+        void load_al(uint8_t reg) { bytes({0x0F, 0xB6, 0x47, reg}); }
+        void load_cl(uint8_t reg) { bytes({0x0F, 0xB6, 0x4F, reg}); }
+
+        // mov byte [rdi + reg], al/cl
+        void store_al(uint8_t reg) { bytes({0x88, 0x47, reg}); }
+        void store_cl(uint8_t reg) { bytes({0x88, 0x4F, reg}); }
+
+        // mov/add/cmp byte [rdi + reg], imm8
+        void store_imm(uint8_t reg, uint8_t value) { bytes({0xC6, 0x47, reg, value}); }
+        void add_imm(uint8_t reg, uint8_t value) { bytes({0x80, 0x47, reg, value}); }
+        void cmp_imm(uint8_t reg, uint8_t value) { bytes({0x80, 0x7F, reg, value}); }
+
+        // cmp al, byte [rdi + reg]
+        void cmp_al_reg(uint8_t reg) { bytes({0x3A, 0x47, reg}); }
+
+        // mov word [rsi], imm16
+        void store_i(uint16_t value) {
+            bytes({0x66, 0xC7, 0x06, uint8_t(value), uint8_t(value >> 8)});
+        }
+
+        void or_al_cl() { bytes({0x08, 0xC8}); }
+        void and_al_cl() { bytes({0x20, 0xC8}); }
+        void xor_al_cl() { bytes({0x30, 0xC8}); }
+        void sub_al_cl() { bytes({0x28, 0xC8}); }
+        void sub_cl_al() { bytes({0x28, 0xC1}); }
+        void add_eax_ecx() { bytes({0x01, 0xC8}); }
+        void cmp_al_cl() { bytes({0x38, 0xC8}); }
+        void cmp_cl_al() { bytes({0x38, 0xC1}); }
+        void cmp_eax_imm(uint32_t value) { bytes({0x3D}); imm32(value); }
+        void seta_al() { bytes({0x0F, 0x97, 0xC0}); }
+        void setbe_al() { bytes({0x0F, 0x96, 0xC0}); }
+        void and_al_1() { bytes({0x24, 0x01}); }
+        void shr_al_1() { bytes({0xD0, 0xE8}); }
+        void shr_al_7() { bytes({0xC0, 0xE8, 0x07}); }
+        void shl_al_1() { bytes({0xD0, 0xE0}); }
+
+        // Charge the block's length against the budget. If it does not fit,
+        // undo the charge and return to the caller at the block's own pc.
+        void prologue(uint16_t pc, uint8_t length) {
+            bytes({0x41, 0x83, 0x29, length});  // sub dword [r9], length
+            bytes({0x73, 0x0A});                // jae body
+            bytes({0x41, 0x83, 0x01, length});  // add dword [r9], length
+            bytes({0xB8});                      // mov eax, pc
+            imm32(pc);
+            bytes({0xC3});                      // ret
+        }
+
+        // jmp dispatch
+        void jump_dispatch() {
+            bytes({0xE9});
+            dispatch_fixups.push_back(code.size());
+            imm32(0);
+        }
+
+        // Continue at a fixed pc
+        void exit(uint16_t pc) {
+            bytes({0xB8});
+            imm32(pc);
+            jump_dispatch();
+        }
+
+        // Continue at skip_pc if the flags say equal (or not equal), else
+        // at next_pc
+        void exit_if(bool equal, uint16_t next_pc, uint16_t skip_pc) {
+            bytes({0xB8});
+            imm32(next_pc);
+            bytes({0xB9});
+            imm32(skip_pc);
+            bytes({0x0F, uint8_t(equal ? 0x44 : 0x45), 0xC1});
+            jump_dispatch();
+        }
+
+        // Shared tail of every block: enter the block translated at pc eax,
+        // or return eax to the caller if there is none
+        void dispatch() {
+            bytes({0x3D, 0xFF, 0x0F, 0x00, 0x00});  // cmp eax, 0xFFF
+            bytes({0x77, 0x0C});                    // ja out
+            bytes({0x4D, 0x8B, 0x14, 0xC0});        // mov r10, [r8 + rax*8]
+            bytes({0x4D, 0x85, 0xD2});              // test r10, r10
+            bytes({0x74, 0x03});                    // jz out
+            bytes({0x41, 0xFF, 0xE2});              // jmp r10
+            bytes({0xC3});                          // out: ret
+        }
+};
+#endif
+
+Jit::Jit()
+    : arena {nullptr}
+    , arena_used {0}
+    , dispatch_size {0}
+{
+    blocks.fill(Block {0, false});
+    entries.fill(nullptr);
+
+#ifdef JIT_X86_64
+    void* mapping = mmap(nullptr, ARENA_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) return;
+
+    // The dispatcher lives at the start of the arena for the JIT's lifetime
+    Emitter e;
+    e.dispatch();
+    std::memcpy(mapping, e.data().data(), e.data().size());
+    dispatch_size = arena_used = e.data().size();
+
+    if (mprotect(mapping, ARENA_SIZE, PROT_READ | PROT_EXEC) == 0) {
+        arena = static_cast<uint8_t*>(mapping);
+    } else {
+        munmap(mapping, ARENA_SIZE);
+    }
+#endif
+}
+
+Jit::~Jit() {
+#ifdef JIT_X86_64
+    if (arena != nullptr) {
+        munmap(arena, ARENA_SIZE);
+    }
+#endif
+}
+
+// Drop every translation and start the arena over
+void Jit::flush() {
+    blocks.fill(Block {0, false});
+    entries.fill(nullptr);
+    compiled_starts.clear();
+    arena_used = dispatch_size;
+}
+
+// Drop translations that overlap memory written since the last check
+void Jit::discard_writes(Chip8& chip8) {
+    if (chip8.written_start == chip8.written_end) return;
+
+    uint32_t start = chip8.written_start;
+    uint32_t end = chip8.written_end;
+    chip8.written_start = chip8.written_end = 0;
+
+    size_t kept = 0;
+    for (uint16_t block_start : compiled_starts) {
+        Block& block = blocks[block_start];
+        uint32_t block_end = block_start + 2 * (block.length > 0 ? block.length : 1);
+        if (block_start < end && block_end > start) {
+            block = Block {0, false};
+            entries[block_start] = nullptr;
+        } else {
+            compiled_starts[kept++] = block_start;
+        }
+    }
+    compiled_starts.resize(kept);
+}
+
+// Translate the run of instructions starting at start. Blocks end after a
+// jump or skip, or before any instruction the translator leaves to the
+// interpreter.
+void Jit::compile(const Chip8& chip8, uint16_t start) {
+    Block& block = blocks[start];
+    block = Block {0, true};
+    compiled_starts.push_back(start);
+
+#ifdef JIT_X86_64
+    if (arena == nullptr) return;
+
+    // Translate the body first; the prologue needs the final length
+    Emitter e;
+    uint16_t pc = start;
+    bool ended = false;
+
+    while (!ended && block.length < MAX_BLOCK_LENGTH && pc + 1 < 4096) {
+        uint16_t opcode = chip8.memory[pc] << 8 | chip8.memory[pc + 1];
+        uint8_t x = (opcode & 0x0F00) >> 8;
+        uint8_t y = (opcode & 0x00F0) >> 4;
+        uint16_t nnn = opcode & 0x0FFF;
+        uint8_t nn = opcode & 0x00FF;
+
+        // 8XY6/8XYE shift VY, or VX with the shift quirk
+        uint8_t source = chip8.quirks & QUIRK_SHIFT ? x : y;
+
+        // On XO-CHIP how far a skip goes depends on the instruction after
+        // it, which lies outside the block, so skips stay interpreted
+        bool skip = (opcode & 0xF000) == 0x3000 || (opcode & 0xF000) == 0x4000
+                 || (opcode & 0xF000) == 0x5000 || (opcode & 0xF000) == 0x9000;
+        if (skip && chip8.xo_chip) break;
+
+        bool translated = true;
+        switch (opcode & 0xF000) {
+            case 0x1000:
+                e.exit(nnn);
+                ended = true;
+                break;
+
+            case 0x3000:
+                e.cmp_imm(x, nn);
+                e.exit_if(true, pc + 2, pc + 4);
+                ended = true;
+                break;
+
+            case 0x4000:
+                e.cmp_imm(x, nn);
+                e.exit_if(false, pc + 2, pc + 4);
+                ended = true;
+                break;
+
+            case 0x5000:
+            case 0x9000:
+                e.load_al(x);
+                e.cmp_al_reg(y);
+                e.exit_if((opcode & 0xF000) == 0x5000, pc + 2, pc + 4);
+                ended = true;
+                break;
+
+            case 0x6000:
+                e.store_imm(x, nn);
+                break;
+
+            case 0x7000:
+                e.add_imm(x, nn);
+                break;
+
+            case 0xA000:
+                e.store_i(nnn);
+                break;
+
+            // Each 8XYN form reloads its operands after every store so that
+            // X, Y and F aliasing behaves exactly like the interpreter
+            case 0x8000:
+                switch (opcode & 0x000F) {
+                    case 0x0:
+                        e.load_al(y);
+                        e.store_al(x);
+                        break;
+
+                    case 0x1:
+                    case 0x2:
+                    case 0x3:
+                        e.load_al(x);
+                        e.load_cl(y);
+                        if ((opcode & 0xF) == 0x1) e.or_al_cl();
+                        if ((opcode & 0xF) == 0x2) e.and_al_cl();
+                        if ((opcode & 0xF) == 0x3) e.xor_al_cl();
+                        e.store_al(x);
+                        if (chip8.quirks & QUIRK_VF_RESET) e.store_imm(0xF, 0);
+                        break;
+
+                    case 0x4:
+                        e.load_al(x);
+                        e.load_cl(y);
+                        e.add_eax_ecx();
+                        e.store_al(x);
+                        e.cmp_eax_imm(0xFF);
+                        e.seta_al();
+                        e.store_al(0xF);
+                        break;
+
+                    case 0x5:
+                        e.load_al(x);
+                        e.load_cl(y);
+                        e.cmp_cl_al();
+                        e.setbe_al();
+                        e.store_al(0xF);
+                        e.load_al(x);
+                        e.load_cl(y);
+                        e.sub_al_cl();
+                        e.store_al(x);
+                        break;
+
+                    case 0x6:
+                        e.load_al(source);
+                        e.and_al_1();
+                        e.store_al(0xF);
+                        e.load_al(source);
+                        e.shr_al_1();
+                        e.store_al(x);
+                        break;
+
+                    case 0x7:
+                        e.load_al(x);
+                        e.load_cl(y);
+                        e.cmp_al_cl();
+                        e.setbe_al();
+                        e.store_al(0xF);
+                        e.load_al(x);
+                        e.load_cl(y);
+                        e.sub_cl_al();
+                        e.store_cl(x);
+                        break;
+
+                    case 0xE:
+                        e.load_al(source);
+                        e.shr_al_7();
+                        e.store_al(0xF);
+                        e.load_al(source);
+                        e.shl_al_1();
+                        e.store_al(x);
+                        break;
+
+                    default:
+                        translated = false;
+                }
+                break;
+
+            default:
+                translated = false;
+        }
+
+        if (!translated) break;
+        block.length++;
+        pc += 2;
+    }
+
+    if (block.length == 0) return;
+    if (!ended) e.exit(pc);
+
+    Emitter prologue;
+    prologue.prologue(start, block.length);
+    size_t size = prologue.data().size() + e.data().size();
+
+    // Out of room: start over, keeping only this block
+    if (arena_used + size > ARENA_SIZE) {
+        uint16_t length = block.length;
+        flush();
+        blocks[start] = Block {length, true};
+        compiled_starts.push_back(start);
+    }
+
+    // Keep the arena W^X: writable only while code is copied in
+    if (mprotect(arena, ARENA_SIZE, PROT_READ | PROT_WRITE) != 0) {
+        blocks[start].length = 0;
+        return;
+    }
+
+    uint8_t* code = arena + arena_used;
+    std::memcpy(code, prologue.data().data(), prologue.data().size());
+    uint8_t* body = code + prologue.data().size();
+    std::memcpy(body, e.data().data(), e.data().size());
+
+    // Point each exit's jmp at the dispatcher
+    for (size_t fixup : e.fixups()) {
+        int32_t rel = arena - (body + fixup + 4);
+        std::memcpy(body + fixup, &rel, sizeof(rel));
+    }
+
+    mprotect(arena, ARENA_SIZE, PROT_READ | PROT_EXEC);
+
+    entries[start] = code;
+    arena_used += size;
+#else
+    (void)chip8;
+#endif
+}
+
+uint64_t Jit::step(Chip8& chip8, uint64_t max_cycles) {
+    // Catch writes made outside the JIT, such as a ROM load
+    discard_writes(chip8);
+
+    if (chip8.pc < 4096) {
+        if (!blocks[chip8.pc].compiled) compile(chip8, chip8.pc);
+
+        if (entries[chip8.pc] != nullptr) {
+            uint32_t budget = max_cycles < 0x7FFFFFFF ? max_cycles : 0x7FFFFFFF;
+            uint32_t start_budget = budget;
+            BlockFn block = reinterpret_cast<BlockFn>(entries[chip8.pc]);
+
+            chip8.pc = block(chip8.V.data(), &chip8.I, 0, 0, entries.data(),
+                             &budget);
+
+            uint32_t executed = start_budget - budget;
+            if (executed > 0) {
+                return executed;
+            }
+        }
+    }
+
+    chip8.cycle();
+    discard_writes(chip8);
+    return 1;
+}
+
+uint64_t Jit::run(Chip8& chip8, uint64_t cycles) {
+    uint64_t executed = 0;
+    while (executed < cycles && chip8.is_running) {
+        executed += step(chip8, cycles - executed);
+    }
+    return executed;
+}
+
+bool Jit::verify(Chip8& chip8, Chip8& reference, uint64_t cycles,
+                 uint64_t& diverged_at) {
+    uint64_t executed = 0;
+    while (executed < cycles && chip8.is_running) {
+        uint64_t steps = step(chip8, cycles - executed);
+        for (uint64_t i = 0; i < steps; i++) {
+            reference.cycle();
+        }
+        executed += steps;
+
+        if (!chip8.state_equals(reference)) {
+            diverged_at = executed;
+            return false;
+        }
+    }
+    return true;
+}
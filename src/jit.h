@@ -0,0 +1,64 @@
+#ifndef JIT_H
+#define JIT_H
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "chip8.h"
+
+// Basic-block recompiler to x86-64. Straight-line runs of register and
+// branch instructions become native code; everything else (DXYN, FX0A,
+// stores, timers, calls) runs through Chip8::cycle(). Blocks chain into
+// each other through a per-address entry table without returning to C++
+// until the cycle budget runs out or an untranslated address is reached.
+// Only the first 4 KB is translated; XO-CHIP code above it is interpreted.
+// Shifts and logic ops are translated for the machine's quirks; changing
+// the quirks counts as a write to all memory, so every block is redone.
+// On other hosts every instruction goes to the interpreter.
+class Jit {
+    private:
+        // Generated code takes the register file, I, the entry table used to
+        // chain into further blocks and the remaining instruction budget. It
+        // returns the pc where native execution stopped.
+        typedef uint32_t (*BlockFn)(uint8_t* V, uint16_t* I, uint64_t, uint64_t,
+                                    void* const* entries, uint32_t* budget);
+
+        struct Block {
+            uint16_t length;    // Instructions in the block, 0 = interpret
+            bool compiled;      // Translation was attempted
+        };
+
+        std::array<Block, 4096> blocks;
+        std::array<void*, 4096> entries;    // Native entry point per address
+        std::vector<uint16_t> compiled_starts;
+
+        uint8_t* arena;
+        size_t arena_used;
+        size_t dispatch_size;
+
+        void compile(const Chip8& chip8, uint16_t start);
+        void flush();
+        void discard_writes(Chip8& chip8);
+
+    public:
+        Jit();
+        ~Jit();
+        Jit(const Jit&) = delete;
+        Jit& operator=(const Jit&) = delete;
+
+        // Execute a chain of translated blocks, or one interpreted
+        // instruction, within max_cycles. Returns the instructions executed.
+        uint64_t step(Chip8& chip8, uint64_t max_cycles);
+
+        // Execute up to the given number of instructions
+        uint64_t run(Chip8& chip8, uint64_t cycles);
+
+        // Run chip8 through the JIT and reference through the interpreter in
+        // lock step, comparing full state after every step. Returns false
+        // at the first divergence, with the cycle count in diverged_at.
+        bool verify(Chip8& chip8, Chip8& reference, uint64_t cycles,
+                    uint64_t& diverged_at);
+};
+
+#endif // JIT_H
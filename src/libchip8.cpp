@@ -0,0 +1,170 @@
+#include <new>
+#include <vector>
+
+#include "chip8.h"
+#include "libchip8.h"
+#include "scheduler.h"
+
+static_assert(CHIP8_QUIRK_SHIFT == QUIRK_SHIFT
+              && CHIP8_QUIRK_LOAD_STORE == QUIRK_LOAD_STORE
+              && CHIP8_QUIRK_JUMP == QUIRK_JUMP
+              && CHIP8_QUIRK_VF_RESET == QUIRK_VF_RESET
+              && CHIP8_QUIRK_WRAP == QUIRK_WRAP
+              && CHIP8_QUIRK_INDEX_OVERFLOW == QUIRK_INDEX_OVERFLOW,
+              "C API quirk bits must match chip8.h");
+
+struct Watch {
+    uint16_t address;
+    uint16_t length;
+    uint64_t before;
+    uint64_t after;
+};
+
+struct chip8_env {
+    Chip8 chip8;
+    Chip8 snapshot;     // Reset copies this back, decoded instructions and all
+    Scheduler scheduler;
+    std::vector<Watch> watches;
+    uint32_t changed;
+
+    chip8_env(uint64_t seed, const chip8_config& config)
+        : chip8 {seed, config.xo_chip != 0, config.quirks}
+        , scheduler {config.instructions_per_frame, false}
+        , changed {0}
+    {
+        watches.reserve(CHIP8_MAX_WATCHES);
+    }
+
+    uint64_t read(const Watch& watch) const {
+        const std::vector<uint8_t>& memory = chip8.get_memory();
+        uint64_t value = 0;
+        for (int i = 0; i < watch.length; i++) {
+            value = value << 8 | memory[(watch.address + i) & (memory.size() - 1)];
+        }
+        return value;
+    }
+};
+
+int chip8_api_version(void) {
+    return CHIP8_API_VERSION;
+}
+
+void chip8_default_config(chip8_config* config) {
+    config->xo_chip = 0;
+    config->quirks = CHIP8_PROFILE_CHIP8;
+    config->instructions_per_frame = DEFAULT_INSTRUCTIONS_PER_FRAME;
+}
+
+chip8_env* chip8_create(const uint8_t* rom, size_t size, uint64_t seed,
+                        const chip8_config* config) {
+    chip8_config defaults;
+    chip8_default_config(&defaults);
+    // No exception may cross the C API, so running out of memory is NULL
+    // like a ROM that does not fit
+    chip8_env* env = nullptr;
+    try {
+        env = new chip8_env(seed, config ? *config : defaults);
+        if (!env->chip8.load(rom, size)) {
+            delete env;
+            return nullptr;
+        }
+        env->snapshot = env->chip8;
+    } catch (const std::bad_alloc&) {
+        delete env;
+        return nullptr;
+    }
+    return env;
+}
+
+void chip8_destroy(chip8_env* env) {
+    delete env;
+}
+
+const uint64_t* chip8_step(chip8_env* env, uint16_t key_mask, int frames) {
+    for (Watch& watch : env->watches) watch.before = env->read(watch);
+
+    env->chip8.set_key_mask(key_mask);
+    for (int frame = 0; frame < frames; frame++) {
+        env->scheduler.run_frame(env->chip8);
+    }
+
+    env->changed = 0;
+    for (size_t i = 0; i < env->watches.size(); i++) {
+        Watch& watch = env->watches[i];
+        watch.after = env->read(watch);
+        if (watch.after != watch.before) env->changed |= 1u << i;
+    }
+    return chip8_screen(env, nullptr, nullptr);
+}
+
+void chip8_step_many(chip8_env* const* envs, const uint16_t* key_masks,
+                     size_t count, int frames, const uint64_t** screens) {
+    for (size_t i = 0; i < count; i++) {
+        const uint64_t* screen = chip8_step(envs[i], key_masks[i], frames);
+        if (screens) screens[i] = screen;
+    }
+}
+
+const uint64_t* chip8_screen(const chip8_env* env, int* width, int* height) {
+    bool extended = env->chip8.extended_resolution;
+    if (width) *width = extended ? 128 : 64;
+    if (height) *height = extended ? 64 : 32;
+    return extended ? env->chip8.gfx_extended.data() : env->chip8.gfx.data();
+}
+
+const uint8_t* chip8_memory(const chip8_env* env, size_t* size) {
+    const std::vector<uint8_t>& memory = env->chip8.get_memory();
+    if (size) *size = memory.size();
+    return memory.data();
+}
+
+int chip8_done(const chip8_env* env) {
+    return !env->chip8.is_running;
+}
+
+int chip8_sound(const chip8_env* env) {
+    return env->chip8.sound_on;
+}
+
+int chip8_watch(chip8_env* env, uint16_t address, uint16_t length) {
+    if (length < 1 || length > 8 || env->watches.size() >= CHIP8_MAX_WATCHES
+        || address + length > env->chip8.get_memory().size()) {
+        return -1;
+    }
+    Watch watch {address, length, 0, 0};
+    watch.before = watch.after = env->read(watch);
+    env->watches.push_back(watch);
+    return env->watches.size() - 1;
+}
+
+uint32_t chip8_watches_changed(const chip8_env* env) {
+    return env->changed;
+}
+
+static bool has_watch(const chip8_env* env, int watch) {
+    return watch >= 0 && size_t(watch) < env->watches.size();
+}
+
+uint64_t chip8_watch_value(const chip8_env* env, int watch) {
+    if (!has_watch(env, watch)) return 0;
+    return env->watches[watch].after;
+}
+
+int64_t chip8_watch_delta(const chip8_env* env, int watch) {
+    if (!has_watch(env, watch)) return 0;
+    const Watch& w = env->watches[watch];
+    return int64_t(w.after - w.before);
+}
+
+void chip8_snapshot(chip8_env* env) {
+    env->snapshot = env->chip8;
+}
+
+void chip8_reset(chip8_env* env, uint64_t seed) {
+    env->chip8 = env->snapshot;
+    env->chip8.seed(seed);
+
+    // Watches start the episode unchanged
+    env->changed = 0;
+    for (Watch& watch : env->watches) watch.before = watch.after = env->read(watch);
+}
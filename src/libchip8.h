@@ -0,0 +1,112 @@
+#ifndef LIBCHIP8_H
+#define LIBCHIP8_H
+#include <stddef.h>
+#include <stdint.h>
+
+// C API of libchip8, for driving many emulators from another program (an
+// agent, a search) without SDL. Frames are run back to back; nothing
+// sleeps. An environment must only be used by one thread at a time.
+
+#if defined(_WIN32)
+#define CHIP8_API __declspec(dllexport)
+#else
+#define CHIP8_API __attribute__((visibility("default")))
+#endif
+
+// Bumped whenever a function or the layout of a struct changes
+#define CHIP8_API_VERSION 1
+
+// Quirk bits and profiles, the same values as QUIRK_* and PROFILE_* in chip8.h
+#define CHIP8_QUIRK_SHIFT           (1u << 0)
+#define CHIP8_QUIRK_LOAD_STORE      (1u << 1)
+#define CHIP8_QUIRK_JUMP            (1u << 2)
+#define CHIP8_QUIRK_VF_RESET        (1u << 3)
+#define CHIP8_QUIRK_WRAP            (1u << 4)
+#define CHIP8_QUIRK_INDEX_OVERFLOW  (1u << 5)
+
+#define CHIP8_PROFILE_CHIP8     CHIP8_QUIRK_VF_RESET
+#define CHIP8_PROFILE_CHIP48    (CHIP8_QUIRK_SHIFT | CHIP8_QUIRK_JUMP)
+#define CHIP8_PROFILE_SCHIP     (CHIP8_QUIRK_SHIFT | CHIP8_QUIRK_LOAD_STORE | CHIP8_QUIRK_JUMP)
+#define CHIP8_PROFILE_XO_CHIP   CHIP8_QUIRK_WRAP
+
+// Most watches an environment can hold
+#define CHIP8_MAX_WATCHES 32
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct chip8_env chip8_env;
+
+typedef struct chip8_config {
+    int xo_chip;                    // 64 KB of memory and the XO-CHIP instructions
+    uint32_t quirks;                // CHIP8_QUIRK_* bits
+    int instructions_per_frame;
+} chip8_config;
+
+CHIP8_API int chip8_api_version(void);
+
+// Plain CHIP-8 at 10 instructions per frame
+CHIP8_API void chip8_default_config(chip8_config* config);
+
+// Load a ROM image into a new environment; config may be NULL for the
+// defaults. The state right after loading becomes the reset snapshot.
+// Returns NULL if the ROM does not fit in memory or allocation fails.
+CHIP8_API chip8_env* chip8_create(const uint8_t* rom, size_t size, uint64_t seed,
+                                  const chip8_config* config);
+CHIP8_API void chip8_destroy(chip8_env* env);
+
+// Hold the keys in key_mask (bit N for key N) and run the given number of
+// frames, ticking the timers after each. A frame ends early while the ROM
+// waits for a key. Returns the live framebuffer (see chip8_screen).
+CHIP8_API const uint64_t* chip8_step(chip8_env* env, uint16_t key_mask, int frames);
+
+// Step count environments, each with its own keys, for the same number of
+// frames. If screens is not NULL it receives each one's framebuffer. This
+// is a convenience loop calling chip8_step on each in turn, on the calling
+// thread, so the environments may run different ROMs and configs; it is
+// no faster than stepping them one by one.
+CHIP8_API void chip8_step_many(chip8_env* const* envs, const uint16_t* key_masks,
+                               size_t count, int frames, const uint64_t** screens);
+
+// The framebuffer the ROM currently shows, without copying: one 64-bit
+// word per 64 pixels, most significant bit leftmost, row after row, plane 1
+// after plane 0. 64x32 is one word per row, 128x64 two. The pointer stays
+// valid until the environment is destroyed, but which buffer is shown
+// changes when the ROM switches resolution.
+CHIP8_API const uint64_t* chip8_screen(const chip8_env* env, int* width, int* height);
+
+// Memory, also without copying. size receives its length.
+CHIP8_API const uint8_t* chip8_memory(const chip8_env* env, size_t* size);
+
+// Non-zero once the ROM has exited (00FD)
+CHIP8_API int chip8_done(const chip8_env* env);
+
+// Non-zero while the buzzer sounded during the last frame
+CHIP8_API int chip8_sound(const chip8_env* env);
+
+// Watch length bytes (1 to 8) at address, read as a big-endian number, e.g.
+// a score. Returns the watch's index, or -1 for a bad region or when
+// CHIP8_MAX_WATCHES are set.
+CHIP8_API int chip8_watch(chip8_env* env, uint16_t address, uint16_t length);
+
+// Bit N set if watch N changed during the last step
+CHIP8_API uint32_t chip8_watches_changed(const chip8_env* env);
+
+// A watch's value now, and its change over the last step; 0 for an index
+// chip8_watch did not return
+CHIP8_API uint64_t chip8_watch_value(const chip8_env* env, int watch);
+CHIP8_API int64_t chip8_watch_delta(const chip8_env* env, int watch);
+
+// Make the current state the one chip8_reset returns to
+CHIP8_API void chip8_snapshot(chip8_env* env);
+
+// Return to the snapshot, restarting the random numbers from seed so that
+// episodes can differ
+CHIP8_API void chip8_reset(chip8_env* env, uint64_t seed);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LIBCHIP8_H
@@ -1,56 +1,254 @@
 #include <iostream>
+#include <fstream>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
+#include <atomic>
+#include <memory>
+#include <string>
 #include <SDL2/SDL.h>
 
 #include "input.h"
+#include "inputlog.h"
+#include "capture.h"
+#include "debugger.h"
+#include "profiler.h"
+#include "romdb.h"
+#include "romfile.h"
 #include "display.h"
 #include "chip8.h"
+#include "emulator.h"
+#include "scheduler.h"
+#include "speaker.h"
+
+static void usage() {
+    std::cout << "Usage: chip8 [--ipf instructions per frame] [--turbo] "
+                 "[--vsync] [--seed RNG seed] [--record input log] "
+                 "[--replay input log] [--profile output prefix] [--keymap keys] "
+                 "[--gdb port or socket path] [--capture output file] "
+                 "[--platform chip8|chip48|schip|xochip] [--db ROM database] "
+                 "[path to ROM file]" << std::endl;
+}
 
 int main(int argc, char **argv) {
+    int instructions_per_frame = 0;     // From the ROM database unless given
+    bool turbo = false;
+    bool vsync = false;
+    uint64_t seed = time(NULL);
+    const char* record = nullptr;
+    const char* replay = nullptr;
+    const char* profile = nullptr;
+    const char* gdb = nullptr;
+    const char* capture_path = nullptr;
+    const char* keymap = DEFAULT_KEYMAP;
+    Platform platform = Platform::Chip8;
+    bool platform_given = false;
+    const char* database_path = nullptr;
+    const char* rom = nullptr;
+
     // Check command line arguments
-    if (argc != 2) {
-        std::cout << "Usage: chip8 [path to ROM file]" << std::endl;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--ipf") == 0 && i + 1 < argc) {
+            instructions_per_frame = std::atoi(argv[++i]);
+            if (instructions_per_frame <= 0) {
+                usage();
+                return -1;
+            }
+        } else if (std::strcmp(argv[i], "--turbo") == 0) {
+            turbo = true;
+        } else if (std::strcmp(argv[i], "--vsync") == 0) {
+            vsync = true;
+        } else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = std::strtoull(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record = argv[++i];
+        } else if (std::strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay = argv[++i];
+        } else if (std::strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            profile = argv[++i];
+        } else if (std::strcmp(argv[i], "--gdb") == 0 && i + 1 < argc) {
+            gdb = argv[++i];
+        } else if (std::strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+            capture_path = argv[++i];
+        } else if (std::strcmp(argv[i], "--keymap") == 0 && i + 1 < argc) {
+            keymap = argv[++i];
+        } else if (std::strcmp(argv[i], "--platform") == 0 && i + 1 < argc) {
+            if (!parse_platform(argv[++i], platform)) {
+                usage();
+                return -1;
+            }
+            platform_given = true;
+        } else if (std::strcmp(argv[i], "--db") == 0 && i + 1 < argc) {
+            database_path = argv[++i];
+        } else if (rom == nullptr) {
+            rom = argv[i];
+        } else {
+            usage();
+            return -1;
+        }
+    }
+    if (rom == nullptr) {
+        usage();
+        return -1;
+    }
+
+    // Map the ROM once; it is copied into memory when the machine exists
+    std::cout << "Loading ROM: " << rom << std::endl;
+    RomFile file;
+    if (!file.open(rom, MAX_ROM_SIZE)) {
+        return -1;
+    }
+
+    // A known ROM gets its platform, quirks and frame length from the
+    // database; the command line wins over them, a platform given there
+    // bringing its usual quirks
+    uint32_t quirks = platform_quirks(platform);
+    RomDatabase database;
+    if (!database.load(database_path ? database_path : DEFAULT_ROM_DATABASE,
+                       database_path != nullptr)) {
+        return -1;
+    }
+    if (const RomInfo* info = database.find(file.hash())) {
+        std::cout << "ROM database: " << info->name << " ("
+                  << platform_name(info->platform) << ", "
+                  << info->instructions_per_frame << " instructions per frame)"
+                  << std::endl;
+        if (!platform_given) {
+            platform = info->platform;
+            quirks = rom_quirks(*info);
+        }
+        if (instructions_per_frame == 0) {
+            instructions_per_frame = info->instructions_per_frame;
+        }
+    }
+    if (instructions_per_frame == 0) {
+        instructions_per_frame = DEFAULT_INSTRUCTIONS_PER_FRAME;
+    }
+
+    // A replayed run takes its seed and frame length from the log
+    InputLog log(seed, instructions_per_frame);
+    if (replay != nullptr && !log.load(replay)) {
         return -1;
     }
+    std::cout << "RNG seed: " << log.seed << std::endl;
 
     // Initialize Chip-8
-    Chip8 chip8 = Chip8();
+    Chip8 chip8(log.seed, platform == Platform::XoChip, quirks);
 
     // Load ROM
-    if (!chip8.load(argv[1])) {
+    if (!chip8.load(file.data(), file.size())) {
         return -1;
     }
 
-    // RNG seed
-    srand(time(NULL));
-    
+    // With --gdb, wait for the debugger before opening the window
+    std::unique_ptr<Debugger> debugger;
+    if (gdb != nullptr) {
+        debugger = std::make_unique<Debugger>(chip8.get_memory().size());
+        if (!debugger->open(gdb)) {
+            return -1;
+        }
+    }
+
     // Setup SDL
-    if (!setup_graphics()) {
+    if (!setup_graphics(vsync) || !set_keymap(keymap)) {
         return -1;
     }
 
-    // Emulation cycled
-    while (chip8.is_running) {
-        // Emulate one cycle
-        chip8.cycle();
-        
-        // Receive input from keyboard
-        process_input(chip8);
+    // Profiling runs every instruction through the profiler
+    std::unique_ptr<Profiler> profiler;
+    if (profile != nullptr) {
+        profiler = std::make_unique<Profiler>(chip8.get_memory().size());
+    }
+
+    // Video is encoded on a thread of its own
+    std::unique_ptr<Capture> capture;
+    if (capture_path != nullptr) {
+        capture = std::make_unique<Capture>();
+        if (!capture->open(capture_path)) {
+            close_window();
+            return -1;
+        }
+    }
+
+    // Emulation runs on its own thread at 60 Hz, uncapped with turbo; this
+    // thread only handles input and presents frames
+    Emulator emulator(chip8, log, record != nullptr, replay != nullptr,
+                      !turbo, profiler.get(), debugger.get(), capture.get());
+    // Run silent if there is no audio device
+    bool audio = setup_audio(emulator.audio);
+
+    // The emulation thread wakes this one with an SDL event when it has a
+    // frame, at most one outstanding at a time
+    Uint32 frame_event = SDL_RegisterEvents(1);
+    std::atomic<bool> frame_signalled {false};
+    emulator.on_frame = [&frame_signalled, frame_event] {
+        if (frame_signalled.exchange(true)) return;
+        SDL_Event event {};
+        event.type = frame_event;
+        SDL_PushEvent(&event);
+    };
+    emulator.start();
+
+    auto shown = std::make_unique<Frame>();
+    while (emulator.is_running()) {
+        if (!process_input(emulator.events)) break;
+        emulator.notify_input();
 
-        if (chip8.draw_flag) {
-            chip8.draw_flag = false;
-            if (chip8.extended_resolution) {
-                draw(chip8.gfx_extended);
+        frame_signalled = false;
+        if (!emulator.frames.update()) {
+            // With vsync, presenting again waits for the next refresh.
+            // Otherwise sleep until a frame or input arrives; the timeout
+            // only guards against a missed wakeup.
+            if (vsync) {
+                redraw();
             } else {
-                draw(chip8.gfx);
+                SDL_WaitEventTimeout(nullptr, 100);
             }
+            continue;
         }
 
-        SDL_Delay(2.5);
+        // Upload only rows that changed since the last presented frame.
+        // Frames may have been skipped, so compare rather than trusting
+        // the machine's dirty rows.
+        const Frame& frame = emulator.frames.read_buffer();
+        set_overlay(std::vector<std::pair<uint16_t, double>>(
+            frame.hot.begin(), frame.hot.begin() + frame.hot_count));
+        if (frame.extended_resolution) {
+            draw(frame.gfx_extended,
+                 changed_rows(frame.gfx_extended, shown->gfx_extended));
+        } else {
+            draw(frame.gfx, changed_rows(frame.gfx, shown->gfx));
+        }
+        *shown = frame;
     }
 
+    emulator.stop();
+    if (audio) close_audio();
     close_window();
 
+    if (capture) {
+        if (!capture->close()) return -1;
+        std::cout << "Captured " << capture->frames_pushed() << " frames, "
+                  << capture->frames_dropped() << " dropped" << std::endl;
+    }
+
+    if (profiler) {
+        std::string prefix = profile;
+        std::ofstream json(prefix + ".json");
+        std::ofstream flat(prefix + ".txt");
+        profiler->write_json(json);
+        profiler->write_flat(flat);
+        if (!json || !flat) {
+            std::cerr << "Error: Failed to write profile " << prefix << std::endl;
+            return -1;
+        }
+    }
+
+    // Rewound frames were dropped from the log, so it replays the run as
+    // it finally played out
+    if (record != nullptr && !log.save(record)) {
+        return -1;
+    }
+
     return 0;
 }
@@ -0,0 +1,189 @@
+#include <iomanip>
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <string>
+
+#include "profiler.h"
+
+// Calls nested deeper than this are not tracked; CHIP-8 has 16 stack slots
+const size_t MAX_CALL_DEPTH = 64;
+
+// Name of the instruction class an opcode belongs to
+static std::string opcode_class(uint16_t opcode) {
+    const char* digits = "0123456789ABCDEF";
+    std::string low_nibble(1, digits[opcode & 0xF]);
+    std::string low_byte = digits[opcode >> 4 & 0xF] + low_nibble;
+
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            if ((opcode & 0xFFF0) == 0x00C0) return "00CN";
+            if (opcode == 0x00E0 || opcode == 0x00EE || opcode >= 0x00FB) {
+                return "00" + low_byte;
+            }
+            return "0NNN";
+        case 0x1000: return "1NNN";
+        case 0x2000: return "2NNN";
+        case 0x3000: return "3XNN";
+        case 0x4000: return "4XNN";
+        case 0x5000: return "5XY" + low_nibble;
+        case 0x6000: return "6XNN";
+        case 0x7000: return "7XNN";
+        case 0x8000: return "8XY" + low_nibble;
+        case 0x9000: return "9XY0";
+        case 0xA000: return "ANNN";
+        case 0xB000: return "BNNN";
+        case 0xC000: return "CXNN";
+        case 0xD000: return "DXYN";
+        case 0xE000: return "EX" + low_byte;
+        default:     return "FX" + low_byte;
+    }
+}
+
+Profiler::Profiler(size_t memory_size)
+    : address_mask {uint16_t(memory_size - 1)}
+    , opcode_counts(65536, 0)
+    , pc_counts(memory_size, 0)
+    , pc_opcodes(memory_size, 0)
+    , calls(memory_size, 0)
+    , inclusive(memory_size, 0)
+    , instructions {0}
+    , presents {0}
+    , draws {0}
+    , draw_time {0}
+{
+}
+
+void Profiler::enter(uint16_t address) {
+    calls[address]++;
+    if (call_stack.size() < MAX_CALL_DEPTH) {
+        call_stack.push_back({address, instructions});
+    }
+}
+
+void Profiler::leave() {
+    if (call_stack.empty()) return;
+    const Call& call = call_stack.back();
+    inclusive[call.address] += instructions - call.entered_at;
+    call_stack.pop_back();
+}
+
+std::vector<uint64_t> Profiler::inclusive_so_far() const {
+    std::vector<uint64_t> totals = inclusive;
+    for (const Call& call : call_stack) {
+        totals[call.address] += instructions - call.entered_at;
+    }
+    return totals;
+}
+
+std::vector<std::pair<uint16_t, double>> Profiler::hottest(size_t count) const {
+    std::vector<std::pair<uint16_t, double>> hot;
+    for (size_t pc = 0; pc < pc_counts.size(); pc++) {
+        if (pc_counts[pc] != 0) {
+            hot.push_back({pc, double(pc_counts[pc]) / instructions});
+        }
+    }
+
+    count = std::min(count, hot.size());
+    std::partial_sort(hot.begin(), hot.begin() + count, hot.end(),
+        [](const std::pair<uint16_t, double>& a,
+           const std::pair<uint16_t, double>& b) {
+            return a.second > b.second || (a.second == b.second && a.first < b.first);
+        });
+    hot.resize(count);
+    return hot;
+}
+
+// Addresses that executed, most cycles first
+static std::vector<uint16_t> by_count(const std::vector<uint64_t>& counts) {
+    std::vector<uint16_t> addresses;
+    for (size_t pc = 0; pc < counts.size(); pc++) {
+        if (counts[pc] != 0) addresses.push_back(pc);
+    }
+    std::stable_sort(addresses.begin(), addresses.end(),
+        [&](uint16_t a, uint16_t b) { return counts[a] > counts[b]; });
+    return addresses;
+}
+
+static std::string hex(unsigned value, int digits) {
+    std::ostringstream text;
+    text << "0x" << std::uppercase << std::hex << std::setfill('0')
+         << std::setw(digits) << value;
+    return text.str();
+}
+
+void Profiler::write_json(std::ostream& out) const {
+    int digits = pc_counts.size() > 4096 ? 4 : 3;
+    std::map<std::string, uint64_t> classes;
+    for (int opcode = 0; opcode < 65536; opcode++) {
+        if (opcode_counts[opcode] != 0) {
+            classes[opcode_class(opcode)] += opcode_counts[opcode];
+        }
+    }
+    std::chrono::duration<double, std::nano> draw_ns = draw_time;
+
+    out << "{\n"
+        << "  \"instructions\": " << instructions << ",\n"
+        << "  \"presents\": " << presents << ",\n"
+        << "  \"dxyn\": {\"count\": " << draws << ", \"ns\": " << draw_ns.count()
+        << ", \"ns_per_draw\": " << (draws ? draw_ns.count() / draws : 0.0)
+        << "},\n"
+        << "  \"opcodes\": {";
+    const char* separator = "\n";
+    for (const auto& entry : classes) {
+        out << separator << "    \"" << entry.first << "\": " << entry.second;
+        separator = ",\n";
+    }
+
+    out << "\n  },\n  \"addresses\": [";
+    separator = "\n";
+    for (uint16_t pc : by_count(pc_counts)) {
+        out << separator << "    {\"pc\": \"" << hex(pc, digits)
+            << "\", \"cycles\": " << pc_counts[pc] << "}";
+        separator = ",\n";
+    }
+
+    std::vector<uint64_t> totals = inclusive_so_far();
+    out << "\n  ],\n  \"subroutines\": [";
+    separator = "\n";
+    for (uint16_t address : by_count(totals)) {
+        out << separator << "    {\"address\": \"" << hex(address, digits)
+            << "\", \"calls\": " << calls[address]
+            << ", \"inclusive_cycles\": " << totals[address] << "}";
+        separator = ",\n";
+    }
+    out << "\n  ]\n}\n";
+}
+
+void Profiler::write_flat(std::ostream& out) const {
+    int digits = pc_counts.size() > 4096 ? 4 : 3;
+    std::chrono::duration<double, std::nano> draw_ns = draw_time;
+    double total = instructions ? double(instructions) : 1.0;
+
+    out << "Flat profile: " << instructions << " instructions, " << presents
+        << " presents, " << draws << " draws ("
+        << std::fixed << std::setprecision(1)
+        << (draws ? draw_ns.count() / draws : 0.0) << " ns each)\n\n"
+        << "%time    cumul%   self cycles     pc opcode  class\n";
+
+    double cumulative = 0;
+    for (uint16_t pc : by_count(pc_counts)) {
+        uint16_t opcode = pc_opcodes[pc];
+        double share = pc_counts[pc] / total * 100;
+        cumulative += share;
+        out << std::setw(5) << std::setprecision(2) << share
+            << std::setw(10) << cumulative
+            << std::setw(14) << pc_counts[pc] << "  " << hex(pc, digits)
+            << "   " << hex(opcode, 4).substr(2) << "    "
+            << opcode_class(opcode) << "\n";
+    }
+
+    std::vector<uint64_t> totals = inclusive_so_far();
+    out << "\nSubroutines (inclusive):\n"
+        << "%time     inclusive      calls  address\n";
+    for (uint16_t address : by_count(totals)) {
+        out << std::setw(5) << std::setprecision(2) << totals[address] / total * 100
+            << std::setw(14) << totals[address]
+            << std::setw(11) << calls[address] << "  " << hex(address, digits) << "\n";
+    }
+}
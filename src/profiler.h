@@ -0,0 +1,89 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+#include "chip8.h"
+
+// Execution profile of a ROM: executions per opcode and per address,
+// inclusive cycles of every subroutine, time spent drawing and the number
+// of frames presented. Instructions only reach the profiler when they are
+// run through Profiler::cycle(), so Chip8::cycle() and the normal frame
+// loop carry no instrumentation at all.
+class Profiler {
+    private:
+        struct Call {
+            uint16_t address;
+            uint64_t entered_at;    // Instructions executed before the call
+        };
+
+        // Per-address tables cover the machine's whole memory
+        uint16_t address_mask;
+        std::vector<uint64_t> opcode_counts;    // One per 16-bit opcode
+        std::vector<uint64_t> pc_counts;
+        std::vector<uint16_t> pc_opcodes;       // Last opcode run at each address
+        std::vector<uint64_t> calls;
+        std::vector<uint64_t> inclusive;        // Cycles inside each subroutine
+        std::vector<Call> call_stack;
+
+        uint64_t instructions;
+        uint64_t presents;
+        uint64_t draws;
+        std::chrono::steady_clock::duration draw_time;
+
+        void enter(uint16_t address);
+        void leave();
+
+        // Inclusive cycles including calls that have not returned yet
+        std::vector<uint64_t> inclusive_so_far() const;
+
+    public:
+        // memory_size is that of the machines that will be profiled
+        Profiler(size_t memory_size = 4096);
+
+        // Execute one instruction, recording it
+        inline void cycle(Chip8& chip8);
+
+        // Count a frame presented because draw_flag was set
+        void present() { presents++; }
+
+        // The hottest addresses and their share of all cycles, hottest first
+        std::vector<std::pair<uint16_t, double>> hottest(size_t count) const;
+
+        void write_json(std::ostream& out) const;
+
+        // gprof-style flat profile over addresses, then subroutines
+        void write_flat(std::ostream& out) const;
+};
+
+inline void Profiler::cycle(Chip8& chip8) {
+    uint16_t pc = chip8.get_pc() & address_mask;
+    const auto& memory = chip8.get_memory();
+    uint16_t opcode = memory[pc] << 8 | memory[(pc + 1) & address_mask];
+
+    instructions++;
+    pc_counts[pc]++;
+    pc_opcodes[pc] = opcode;
+    opcode_counts[opcode]++;
+
+    if ((opcode & 0xF000) == 0xD000) {
+        auto start = std::chrono::steady_clock::now();
+        chip8.cycle();
+        draw_time += std::chrono::steady_clock::now() - start;
+        draws++;
+        return;
+    }
+
+    if ((opcode & 0xF000) == 0x2000) {
+        enter(opcode & 0x0FFF);
+    } else if (opcode == 0x00EE) {
+        leave();
+    }
+    chip8.cycle();
+}
+
+#endif // PROFILER_H
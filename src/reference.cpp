@@ -0,0 +1,439 @@
+#include <sstream>
+
+#include "reference.h"
+
+Reference::Reference(const Chip8& chip8)
+    : memory {chip8.memory}
+    , address_mask {chip8.address_mask}
+    , xo_chip {chip8.xo_chip}
+    , quirks {chip8.quirks}
+    , V {chip8.V}
+    , I {chip8.I}
+    , pc {chip8.pc}
+    , stack {chip8.stack}
+    , sp {chip8.sp}
+    , delay_timer {chip8.delay_timer}
+    , sound_timer {chip8.sound_timer}
+    , rpl_flags {chip8.rpl_flags}
+    , rng {chip8.rng}
+    , keys {chip8.keys}
+    , extended_resolution {chip8.extended_resolution}
+    , planes {chip8.planes}
+    , audio_pattern {chip8.audio_pattern}
+    , audio_pitch {chip8.audio_pitch}
+    , draw_flag {chip8.draw_flag}
+    , is_running {chip8.is_running}
+    , wrote_memory {false}
+    , wrote_screen {false}
+{
+    for (int y = 0; y < 32; y++) {
+        for (int x = 0; x < 64; x++) {
+            screen[y * 64 + x] = (chip8.gfx[y] >> (63 - x) & 1)
+                               | (chip8.gfx[32 + y] >> (63 - x) & 1) << 1;
+        }
+    }
+    for (int y = 0; y < 64; y++) {
+        for (int x = 0; x < 128; x++) {
+            int word = y * 2 + x / 64;
+            int bit = 63 - x % 64;
+            screen_extended[y * 128 + x] = (chip8.gfx_extended[word] >> bit & 1)
+                                         | (chip8.gfx_extended[128 + word] >> bit & 1) << 1;
+        }
+    }
+}
+
+// xoshiro128**, as in Chip8
+uint32_t Reference::random() {
+    auto rotl = [](uint32_t value, int k) { return (value << k) | (value >> (32 - k)); };
+    uint32_t result = rotl(rng[1] * 5, 7) * 9;
+    uint32_t t = rng[1] << 9;
+    rng[2] ^= rng[0];
+    rng[3] ^= rng[1];
+    rng[1] ^= rng[2];
+    rng[0] ^= rng[3];
+    rng[2] ^= t;
+    rng[3] = rotl(rng[3], 11);
+    return result;
+}
+
+void Reference::skip() {
+    pc += xo_chip && read(pc) == 0xF0 && read(pc + 1) == 0x00 ? 4 : 2;
+}
+
+bool Reference::draw(int x, int y, int width, int height) {
+    int screen_width = extended_resolution ? 128 : 64;
+    int screen_height = extended_resolution ? 64 : 32;
+    uint8_t* pixels = extended_resolution ? screen_extended.data() : screen.data();
+    bool wrap = quirks & QUIRK_WRAP;
+    x %= screen_width;
+    y %= screen_height;
+
+    bool collision = false;
+    uint32_t address = I;
+    for (int plane = 0; plane < 2; plane++) {
+        if ((planes >> plane & 1) == 0) continue;
+        for (int row = 0; row < height; row++) {
+            int py = y + row;
+            if (py >= screen_height) {
+                if (!wrap) continue;
+                py -= screen_height;
+            }
+            for (int col = 0; col < width; col++) {
+                uint8_t byte = read(address + row * (width / 8) + col / 8);
+                if ((byte >> (7 - col % 8) & 1) == 0) continue;
+                int px = x + col;
+                if (px >= screen_width) {
+                    if (!wrap) continue;
+                    px -= screen_width;
+                }
+                uint8_t& pixel = pixels[py * screen_width + px];
+                if (pixel >> plane & 1) collision = true;
+                pixel ^= 1 << plane;
+            }
+        }
+        address += height * (width / 8);
+    }
+    draw_flag = true;
+    wrote_screen = true;
+    return collision;
+}
+
+// Move the selected planes of the current screen dx pixels right and dy
+// rows down, clearing what scrolls in. Scrolling a whole screen's height
+// clears it.
+void Reference::scroll(int dx, int dy) {
+    int width = extended_resolution ? 128 : 64;
+    int height = extended_resolution ? 64 : 32;
+    uint8_t* pixels = extended_resolution ? screen_extended.data() : screen.data();
+
+    std::vector<uint8_t> before(pixels, pixels + width * height);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            int from_x = x - dx;
+            int from_y = y - dy;
+            uint8_t source = 0;
+            if (from_x >= 0 && from_x < width && from_y >= 0 && from_y < height) {
+                source = before[from_y * width + from_x];
+            }
+            uint8_t& pixel = pixels[y * width + x];
+            pixel = (pixel & ~planes) | (source & planes);
+        }
+    }
+    draw_flag = true;
+    wrote_screen = true;
+}
+
+void Reference::cycle() {
+    uint16_t opcode = read(pc) << 8 | read(pc + 1);
+    pc += 2;
+    wrote_memory = false;
+    wrote_screen = false;
+
+    int x = (opcode >> 8) & 0xF;
+    int y = (opcode >> 4) & 0xF;
+    int n = opcode & 0xF;
+    uint8_t nn = opcode & 0xFF;
+    uint16_t nnn = opcode & 0xFFF;
+    int source = quirks & QUIRK_SHIFT ? x : y;
+
+    switch (opcode >> 12) {
+        case 0x0:
+            if ((opcode & 0xFFF0) == 0x00C0) {
+                scroll(0, n);
+            } else if ((opcode & 0xFFF0) == 0x00D0 && xo_chip) {
+                scroll(0, -n);
+            } else if (nn == 0xE0) {
+                scroll(0, 64);
+            } else if (nn == 0xEE) {
+                if (sp == 0) {
+                    is_running = false;
+                } else {
+                    sp--;
+                    pc = stack[sp] + 2;
+                }
+            } else if (nn == 0xFB) {
+                scroll(4, 0);
+            } else if (nn == 0xFC) {
+                scroll(-4, 0);
+            } else if (nn == 0xFD) {
+                is_running = false;
+            } else if (nn == 0xFE || nn == 0xFF) {
+                extended_resolution = nn == 0xFF;
+                draw_flag = true;
+            }
+            break;
+
+        case 0x1:
+            pc = nnn;
+            break;
+
+        case 0x2:
+            if (sp == 16) {
+                is_running = false;
+            } else {
+                stack[sp] = pc - 2;
+                sp++;
+                pc = nnn;
+            }
+            break;
+
+        case 0x3:
+            if (V[x] == nn) skip();
+            break;
+
+        case 0x4:
+            if (V[x] != nn) skip();
+            break;
+
+        case 0x5:
+            if (!xo_chip || n == 0) {
+                if (V[x] == V[y]) skip();
+            } else if (n == 2 || n == 3) {
+                int step = x <= y ? 1 : -1;
+                int count = (x <= y ? y - x : x - y) + 1;
+                for (int i = 0; i < count; i++) {
+                    if (n == 2) {
+                        write(I + i, V[x + i * step]);
+                    } else {
+                        V[x + i * step] = read(I + i);
+                    }
+                }
+            }
+            break;
+
+        case 0x6:
+            V[x] = nn;
+            break;
+
+        case 0x7:
+            V[x] += nn;
+            break;
+
+        // VF is written before the result where the handlers do so, which
+        // matters when X or Y is F
+        case 0x8:
+            switch (n) {
+                case 0x0: V[x] = V[y]; break;
+                case 0x1: V[x] |= V[y]; break;
+                case 0x2: V[x] &= V[y]; break;
+                case 0x3: V[x] ^= V[y]; break;
+                case 0x4: {
+                    bool carry = V[x] + V[y] > 0xFF;
+                    V[x] += V[y];
+                    V[0xF] = carry;
+                    break;
+                }
+                case 0x5:
+                    V[0xF] = V[x] >= V[y];
+                    V[x] -= V[y];
+                    break;
+                case 0x6:
+                    V[0xF] = V[source] & 1;
+                    V[x] = V[source] >> 1;
+                    break;
+                case 0x7:
+                    V[0xF] = V[y] >= V[x];
+                    V[x] = V[y] - V[x];
+                    break;
+                case 0xE:
+                    V[0xF] = V[source] >> 7;
+                    V[x] = V[source] << 1;
+                    break;
+            }
+            if (n >= 0x1 && n <= 0x3 && (quirks & QUIRK_VF_RESET)) V[0xF] = 0;
+            break;
+
+        case 0x9:
+            if (V[x] != V[y]) skip();
+            break;
+
+        case 0xA:
+            I = nnn;
+            break;
+
+        case 0xB:
+            pc = nnn + V[quirks & QUIRK_JUMP ? x : 0];
+            break;
+
+        case 0xC:
+            V[x] = (random() >> 24) & nn;
+            break;
+
+        case 0xD: {
+            bool collision;
+            if (n != 0) {
+                collision = draw(V[x], V[y], 8, n);
+            } else if (extended_resolution || xo_chip) {
+                collision = draw(V[x], V[y], 16, 16);
+            } else {
+                collision = draw(V[x], V[y], 8, 16);
+            }
+            V[0xF] = collision;
+            break;
+        }
+
+        case 0xE:
+            if (nn == 0x9E && keys[V[x] & 0xF] != 0) skip();
+            if (nn == 0xA1 && keys[V[x] & 0xF] == 0) skip();
+            break;
+
+        case 0xF:
+            switch (nn) {
+                case 0x00:
+                    if (xo_chip && opcode == 0xF000) {
+                        I = read(pc) << 8 | read(pc + 1);
+                        pc += 2;
+                    }
+                    break;
+                case 0x01:
+                    if (xo_chip) planes = x & 3;
+                    break;
+                case 0x02:
+                    if (xo_chip && opcode == 0xF002) {
+                        for (int i = 0; i < 16; i++) audio_pattern[i] = read(I + i);
+                    }
+                    break;
+                case 0x07:
+                    V[x] = delay_timer;
+                    break;
+                case 0x0A: {
+                    bool pressed = false;
+                    for (int key = 0; key < 16; key++) {
+                        if (keys[key] != 0) {
+                            V[x] = key;
+                            pressed = true;
+                        }
+                    }
+                    if (!pressed) pc -= 2;
+                    break;
+                }
+                case 0x15:
+                    delay_timer = V[x];
+                    break;
+                case 0x18:
+                    sound_timer = V[x];
+                    break;
+                case 0x1E:
+                    if (quirks & QUIRK_INDEX_OVERFLOW) V[0xF] = I + V[x] > 0xFFF;
+                    I += V[x];
+                    break;
+                case 0x29:
+                    I = V[x] * 5;
+                    break;
+                case 0x30:
+                    I = FONT_LARGE_ADDRESS + (V[x] & 0xF) * 10;
+                    break;
+                case 0x33:
+                    write(I, V[x] / 100);
+                    write(I + 1, V[x] / 10 % 10);
+                    write(I + 2, V[x] % 10);
+                    break;
+                case 0x3A:
+                    if (xo_chip) audio_pitch = V[x];
+                    break;
+                case 0x55:
+                    for (int i = 0; i <= x; i++) write(I + i, V[i]);
+                    if (!(quirks & QUIRK_LOAD_STORE)) I += x + 1;
+                    break;
+                case 0x65:
+                    for (int i = 0; i <= x; i++) V[i] = read(I + i);
+                    if (!(quirks & QUIRK_LOAD_STORE)) I += x + 1;
+                    break;
+                case 0x75:
+                    for (int i = 0; i <= x; i++) rpl_flags[i] = V[i];
+                    break;
+                case 0x85:
+                    for (int i = 0; i <= x; i++) V[i] = rpl_flags[i];
+                    break;
+            }
+            break;
+    }
+}
+
+void Reference::tick_timers() {
+    if (delay_timer > 0) delay_timer--;
+    if (sound_timer > 0) sound_timer--;
+}
+
+void Reference::set_key_mask(uint16_t mask) {
+    for (int key = 0; key < 16; key++) keys[key] = mask >> key & 1;
+}
+
+// Pack one row of a plane of the reference screen into 64-bit words, as
+// Chip8 stores it
+static uint64_t pack(const uint8_t* pixels, int plane) {
+    uint64_t word = 0;
+    for (int x = 0; x < 64; x++) word = word << 1 | (pixels[x] >> plane & 1);
+    return word;
+}
+
+std::string Reference::compare(const Chip8& chip8, bool everything) const {
+    std::ostringstream out;
+    out << std::hex << std::uppercase;
+
+    if (pc != chip8.pc) out << "pc 0x" << pc << " != 0x" << chip8.pc;
+    else if (I != chip8.I) out << "I 0x" << I << " != 0x" << chip8.I;
+    else if (sp != chip8.sp || stack != chip8.stack) out << "stack";
+    else if (delay_timer != chip8.delay_timer) out << "delay timer";
+    else if (sound_timer != chip8.sound_timer) out << "sound timer";
+    else if (rng != chip8.rng) out << "random number generator";
+    else if (rpl_flags != chip8.rpl_flags) out << "RPL flags";
+    else if (audio_pattern != chip8.audio_pattern || audio_pitch != chip8.audio_pitch) out << "audio";
+    else if (planes != chip8.planes) out << "planes";
+    else if (extended_resolution != chip8.extended_resolution) out << "resolution";
+    else if (draw_flag != chip8.draw_flag) out << "draw flag";
+    else if (is_running != chip8.is_running) out << "running";
+    if (out.tellp() > 0) return out.str();
+
+    for (int i = 0; i < 16; i++) {
+        if (V[i] != chip8.V[i]) {
+            out << "V" << i << " 0x" << int(V[i]) << " != 0x" << int(chip8.V[i]);
+            return out.str();
+        }
+    }
+
+    if ((everything || wrote_memory) && memory != chip8.memory) {
+        size_t address = 0;
+        while (memory[address] == chip8.memory[address]) address++;
+        out << "memory at 0x" << address;
+        return out.str();
+    }
+
+    if (everything || wrote_screen) {
+        out << std::dec;
+        for (int plane = 0; plane < 2; plane++) {
+            for (int y = 0; y < 32; y++) {
+                if (pack(&screen[y * 64], plane) != chip8.gfx[plane * 32 + y]) {
+                    out << "plane " << plane << " row " << y;
+                    return out.str();
+                }
+            }
+            for (int y = 0; y < 64; y++) {
+                for (int half = 0; half < 2; half++) {
+                    uint64_t word = pack(&screen_extended[y * 128 + half * 64], plane);
+                    if (word != chip8.gfx_extended[plane * 128 + y * 2 + half]) {
+                        out << "plane " << plane << " extended row " << y;
+                        return out.str();
+                    }
+                }
+            }
+        }
+    }
+    return "";
+}
+
+bool Reference::framebuffer(Framebuffer& gfx, FramebufferExtended& gfx_extended) const {
+    for (int plane = 0; plane < 2; plane++) {
+        if (extended_resolution) {
+            for (int y = 0; y < 64; y++) {
+                for (int half = 0; half < 2; half++) {
+                    gfx_extended[plane * 128 + y * 2 + half] =
+                        pack(&screen_extended[y * 128 + half * 64], plane);
+                }
+            }
+        } else {
+            for (int y = 0; y < 32; y++) gfx[plane * 32 + y] = pack(&screen[y * 64], plane);
+        }
+    }
+    return extended_resolution;
+}
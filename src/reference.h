@@ -0,0 +1,84 @@
+#ifndef REFERENCE_H
+#define REFERENCE_H
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "chip8.h"
+
+// Plain interpreter of the same instruction set as Chip8, for differential
+// testing. It decodes every instruction from memory with one switch, tests
+// the quirks as it goes and keeps one byte per pixel, so it shares nothing
+// with the predecoded handlers, the packed framebuffers or the JIT. It is
+// slow and meant to stay obvious rather than fast.
+class Reference {
+    private:
+        std::vector<uint8_t> memory;
+        uint16_t address_mask;
+        bool xo_chip;
+        uint32_t quirks;
+
+        std::array<uint8_t, 16> V;
+        uint16_t I;
+        uint16_t pc;
+        std::array<uint16_t, 16> stack;
+        uint16_t sp;
+        uint8_t delay_timer;
+        uint8_t sound_timer;
+        std::array<uint8_t, 16> rpl_flags;
+        std::array<uint32_t, 4> rng;
+        std::array<uint8_t, 16> keys;
+
+        // Pixel colours, plane 0 in bit 0 and plane 1 in bit 1, row by row
+        std::array<uint8_t, 64 * 32> screen;
+        std::array<uint8_t, 128 * 64> screen_extended;
+        bool extended_resolution;
+        uint8_t planes;
+
+        std::array<uint8_t, 16> audio_pattern;
+        uint8_t audio_pitch;
+        bool draw_flag;
+        bool is_running;
+
+        // What the last instruction wrote, so that compare() can leave the
+        // rest of memory and the screens to a full comparison
+        bool wrote_memory;
+        bool wrote_screen;
+
+        uint8_t read(uint32_t address) const { return memory[address & address_mask]; }
+        void write(uint32_t address, uint8_t value) {
+            memory[address & address_mask] = value;
+            wrote_memory = true;
+        }
+        uint32_t random();
+        void skip();
+
+        // XOR a sprite width pixels wide (8 or 16) onto the selected planes
+        // of the current screen, reading its rows from I. Returns true if
+        // any set pixel was cleared.
+        bool draw(int x, int y, int width, int height);
+        void scroll(int dx, int dy);
+
+    public:
+        // Start from the machine's current state
+        explicit Reference(const Chip8& chip8);
+
+        // Execute one instruction
+        void cycle();
+
+        void tick_timers();
+        void set_key_mask(uint16_t mask);
+
+        // Name the first part of the state that differs from the machine,
+        // or return an empty string if none does. Memory and the screens
+        // are only compared after an instruction that wrote them, unless
+        // everything is set.
+        std::string compare(const Chip8& chip8, bool everything) const;
+
+        // Pack the current screen the way Chip8 keeps it, into the
+        // framebuffer of its resolution. Returns true for 128x64.
+        bool framebuffer(Framebuffer& gfx, FramebufferExtended& gfx_extended) const;
+};
+
+#endif // REFERENCE_H
@@ -0,0 +1,145 @@
+#include "rewind.h"
+
+// Delta encoding: repeated (varint zero run, varint literal length, literal
+// bytes) until the input is consumed. XOR against the keyframe turns
+// unchanged bytes into zero runs.
+static void put_varint(std::vector<uint8_t>& out, size_t value) {
+    while (value >= 0x80) {
+        out.push_back(value | 0x80);
+        value >>= 7;
+    }
+    out.push_back(value);
+}
+
+static size_t get_varint(const uint8_t*& in) {
+    size_t value = 0;
+    int shift = 0;
+    while (*in & 0x80) {
+        value |= size_t(*in++ & 0x7F) << shift;
+        shift += 7;
+    }
+    return value | size_t(*in++) << shift;
+}
+
+// Encode state XOR base (base may be empty, meaning all zeros)
+static void encode(const std::vector<uint8_t>& state,
+                   const std::vector<uint8_t>& base,
+                   std::vector<uint8_t>& out) {
+    auto delta = [&](size_t i) {
+        return uint8_t(state[i] ^ (base.empty() ? 0 : base[i]));
+    };
+
+    out.clear();
+    size_t i = 0;
+    while (i < state.size()) {
+        size_t zeros = i;
+        while (zeros < state.size() && delta(zeros) == 0) zeros++;
+
+        // Literals run until the next stretch of at least 4 zero bytes,
+        // shorter ones cost more as a new run header than as literals
+        size_t end = zeros;
+        while (end < state.size()) {
+            size_t run = end;
+            while (run < state.size() && run - end < 4 && delta(run) == 0) run++;
+            if (run - end >= 4 || run == state.size()) break;
+            end = run + 1;
+        }
+
+        put_varint(out, zeros - i);
+        put_varint(out, end - zeros);
+        for (size_t j = zeros; j < end; j++) {
+            out.push_back(delta(j));
+        }
+        i = end;
+    }
+}
+
+// Decode into out, which must already hold the base state
+static void decode(const std::vector<uint8_t>& data, std::vector<uint8_t>& out) {
+    const uint8_t* in = data.data();
+    const uint8_t* end = in + data.size();
+    size_t i = 0;
+
+    while (in < end) {
+        i += get_varint(in);
+        size_t literals = get_varint(in);
+        for (size_t j = 0; j < literals; j++) {
+            out[i++] ^= *in++;
+        }
+    }
+}
+
+Rewind::Rewind(size_t capacity, int keyframe_interval)
+    : capacity {capacity}
+    , keyframe_interval {keyframe_interval}
+    , stored_bytes {0}
+    , since_keyframe {0}
+{
+}
+
+// Drop the oldest keyframe and the deltas that depend on it
+void Rewind::drop_oldest_group() {
+    do {
+        stored_bytes -= entries.front().data.size();
+        entries.pop_front();
+    } while (!entries.empty() && !entries.front().keyframe);
+}
+
+void Rewind::capture(const Chip8& chip8) {
+    chip8.save_state(state);
+
+    // A new keyframe is due, or the format size changed under us
+    bool is_keyframe = entries.empty() || since_keyframe >= keyframe_interval
+                    || keyframe.size() != state.size();
+
+    Entry entry {is_keyframe, {}};
+    if (is_keyframe) {
+        keyframe = state;
+        since_keyframe = 0;
+        encode(state, {}, entry.data);
+    } else {
+        encode(state, keyframe, entry.data);
+    }
+    since_keyframe++;
+
+    stored_bytes += entry.data.size();
+    entries.push_back(std::move(entry));
+
+    // Evict whole groups from the front, never the one being written to
+    while (stored_bytes > capacity) {
+        size_t next_group = 1;
+        while (next_group < entries.size() && !entries[next_group].keyframe) {
+            next_group++;
+        }
+        if (next_group == entries.size()) break;
+        drop_oldest_group();
+    }
+}
+
+bool Rewind::restore(Chip8& chip8, size_t frames_back) {
+    if (frames_back >= entries.size()) return false;
+
+    size_t target = entries.size() - 1 - frames_back;
+    size_t key = target;
+    while (!entries[key].keyframe) key--;
+
+    // Rebuild the keyframe, then apply the target's delta on top of it
+    std::vector<uint8_t> base(keyframe.size(), 0);
+    decode(entries[key].data, base);
+    decoded = base;
+    if (key != target) {
+        decode(entries[target].data, decoded);
+    }
+
+    if (!chip8.load_state(decoded.data(), decoded.size())) return false;
+
+    // Forget the future and continue the group from the restored frame
+    while (entries.size() > target + 1) {
+        stored_bytes -= entries.back().data.size();
+        entries.pop_back();
+    }
+    keyframe = std::move(base);
+    since_keyframe = target - key + 1;
+
+    return true;
+}
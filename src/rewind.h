@@ -0,0 +1,50 @@
+#ifndef REWIND_H
+#define REWIND_H
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "chip8.h"
+
+// In-memory history of save states, one per frame. Every keyframe_interval
+// frames a keyframe is stored; the frames in between are stored as the XOR
+// of their state against that keyframe, run-length encoded. Restoring any
+// frame decodes at most one keyframe and one delta.
+class Rewind {
+    private:
+        struct Entry {
+            bool keyframe;
+            std::vector<uint8_t> data;  // Encoded XOR against the keyframe
+        };
+
+        size_t capacity;
+        int keyframe_interval;
+        std::deque<Entry> entries;
+        size_t stored_bytes;
+
+        std::vector<uint8_t> keyframe;  // Raw state of the latest keyframe
+        int since_keyframe;
+
+        std::vector<uint8_t> state;     // Scratch buffers
+        std::vector<uint8_t> decoded;
+
+        void drop_oldest_group();
+
+    public:
+        // Keep at most capacity bytes of encoded history
+        Rewind(size_t capacity, int keyframe_interval = 60);
+
+        // Record the machine's state; call once per frame
+        void capture(const Chip8& chip8);
+
+        // Restore the state captured frames_back frames before the latest
+        // one (0 = latest) and forget everything after it, so capturing
+        // continues from there. Fails if history is shorter than that.
+        bool restore(Chip8& chip8, size_t frames_back);
+
+        size_t frames() const { return entries.size(); }
+        size_t bytes() const { return stored_bytes; }
+};
+
+#endif // REWIND_H
@@ -0,0 +1,118 @@
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+#include "chip8.h"
+#include "romdb.h"
+
+struct QuirkName {
+    const char* name;
+    uint32_t bit;
+};
+
+const QuirkName QUIRK_NAMES[] = {
+    {"shift", QUIRK_SHIFT},
+    {"load_store", QUIRK_LOAD_STORE},
+    {"jump", QUIRK_JUMP},
+    {"vf_reset", QUIRK_VF_RESET},
+    {"wrap", QUIRK_WRAP},
+    {"index_overflow", QUIRK_INDEX_OVERFLOW},
+};
+
+const char* platform_name(Platform platform) {
+    switch (platform) {
+        case Platform::Chip48:    return "chip48";
+        case Platform::SuperChip: return "schip";
+        case Platform::XoChip:    return "xochip";
+        default:                  return "chip8";
+    }
+}
+
+bool parse_platform(const std::string& name, Platform& platform) {
+    for (Platform candidate : {Platform::Chip8, Platform::Chip48,
+                               Platform::SuperChip, Platform::XoChip}) {
+        if (name == platform_name(candidate)) {
+            platform = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t platform_quirks(Platform platform) {
+    switch (platform) {
+        case Platform::Chip48:    return PROFILE_CHIP48;
+        case Platform::SuperChip: return PROFILE_SCHIP;
+        case Platform::XoChip:    return PROFILE_XO_CHIP;
+        default:                  return PROFILE_CHIP8;
+    }
+}
+
+// Comma-separated quirk names, or - for none given
+static bool parse_quirks(const std::string& list, RomInfo& info) {
+    info.has_quirks = list != "-";
+    info.quirks = 0;
+    if (!info.has_quirks) return true;
+
+    std::istringstream names(list);
+    std::string name;
+    while (std::getline(names, name, ',')) {
+        bool known = false;
+        for (const QuirkName& quirk : QUIRK_NAMES) {
+            if (name == quirk.name) {
+                info.quirks |= quirk.bit;
+                known = true;
+            }
+        }
+        if (!known) return false;
+    }
+    return true;
+}
+
+bool RomDatabase::load(const char* filepath, bool must_exist) {
+    std::ifstream database(filepath);
+    if (!database) {
+        if (!must_exist) return true;
+        std::cerr << "Error: Failed to open ROM database " << filepath << std::endl;
+        return false;
+    }
+
+    std::string line;
+    int line_number = 0;
+    while (std::getline(database, line)) {
+        line_number++;
+        line = line.substr(0, line.find('#'));
+
+        std::istringstream fields(line);
+        std::string hash_field;
+        if (!(fields >> hash_field)) continue; // Blank or comment line
+
+        std::string platform, quirks;
+        RomInfo info;
+        char* end;
+        uint64_t hash = std::strtoull(hash_field.c_str(), &end, 16);
+        bool valid = hash_field.size() == 16 && *end == '\0'
+                  && fields >> platform >> info.instructions_per_frame >> quirks
+                  && parse_platform(platform, info.platform)
+                  && info.instructions_per_frame > 0
+                  && parse_quirks(quirks, info);
+        if (!valid) {
+            std::cerr << "Error: " << filepath << ":" << line_number
+                      << ": expected <hash> <platform> <instructions per frame> "
+                         "<quirks> <name>" << std::endl;
+            return false;
+        }
+
+        std::getline(fields >> std::ws, info.name);
+        entries[hash] = info;
+    }
+
+    return true;
+}
+
+const RomInfo* RomDatabase::find(uint64_t hash) const {
+    auto entry = entries.find(hash);
+    return entry == entries.end() ? nullptr : &entry->second;
+}
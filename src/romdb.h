@@ -0,0 +1,62 @@
+#ifndef ROMDB_H
+#define ROMDB_H
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+// Database consulted when no path is given
+const char DEFAULT_ROM_DATABASE[] = "data/roms.txt";
+
+enum class Platform {
+    Chip8,
+    Chip48,
+    SuperChip,
+    XoChip
+};
+
+// Settings for one known ROM
+struct RomInfo {
+    Platform platform;
+    int instructions_per_frame;
+    bool has_quirks;        // Otherwise the platform's usual behaviour
+    uint32_t quirks;        // QUIRK_* bits
+    std::string name;
+};
+
+// ROM settings keyed by the XXH64 hash of the ROM image, read from a text
+// file with one entry per line (# starts a comment):
+//
+//   <hash, 16 hex digits> <chip8|chip48|schip|xochip> <instructions per frame>
+//   <quirk,quirk,... or -> <name>
+//
+// The name is the rest of the line and only there for people.
+class RomDatabase {
+    private:
+        std::unordered_map<uint64_t, RomInfo> entries;
+
+    public:
+        // Add the entries of a database file. Fails at the first bad line,
+        // or if the file is missing and must_exist is set.
+        bool load(const char* filepath, bool must_exist = true);
+
+        // Settings for a ROM, or null if it is not in the database
+        const RomInfo* find(uint64_t hash) const;
+
+        size_t size() const { return entries.size(); }
+};
+
+const char* platform_name(Platform platform);
+
+// Platform from its name in the database, false if there is none
+bool parse_platform(const std::string& name, Platform& platform);
+
+// The PROFILE_* quirks of a platform
+uint32_t platform_quirks(Platform platform);
+
+// Quirks a known ROM runs with: its own, or else its platform's
+inline uint32_t rom_quirks(const RomInfo& info) {
+    return info.has_quirks ? info.quirks : platform_quirks(info.platform);
+}
+
+#endif // ROMDB_H
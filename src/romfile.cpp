@@ -0,0 +1,89 @@
+#include <iostream>
+#include <fstream>
+#include <iterator>
+
+#include "hash.h"
+#include "romfile.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+RomFile::RomFile()
+    : bytes {nullptr}
+    , length {0}
+    , mapping {nullptr}
+{
+}
+
+RomFile::~RomFile() {
+    close();
+}
+
+void RomFile::close() {
+#ifndef _WIN32
+    if (mapping != nullptr) munmap(mapping, length);
+#endif
+    mapping = nullptr;
+    buffer.clear();
+    bytes = nullptr;
+    length = 0;
+}
+
+bool RomFile::open(const char* filepath, size_t max_size) {
+    close();
+
+#ifndef _WIN32
+    int fd = ::open(filepath, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        std::cerr << "Error: Failed to open ROM" << std::endl;
+        if (fd >= 0) ::close(fd);
+        return false;
+    }
+    if (size_t(info.st_size) > max_size) {
+        std::cerr << "Error: ROM too large to load into memory" << std::endl;
+        ::close(fd);
+        return false;
+    }
+
+    // An empty file has nothing to map
+    length = info.st_size;
+    if (length > 0) {
+        mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            mapping = nullptr;
+            length = 0;
+            std::cerr << "Error: Failed to map ROM" << std::endl;
+            ::close(fd);
+            return false;
+        }
+        bytes = static_cast<const uint8_t*>(mapping);
+    }
+    ::close(fd);
+#else
+    std::ifstream rom(filepath, std::ifstream::binary | std::ifstream::ate);
+    if (!rom) {
+        std::cerr << "Error: Failed to open ROM" << std::endl;
+        return false;
+    }
+    if (size_t(rom.tellg()) > max_size) {
+        std::cerr << "Error: ROM too large to load into memory" << std::endl;
+        return false;
+    }
+    rom.seekg(0);
+    buffer.assign(std::istreambuf_iterator<char>(rom),
+                  std::istreambuf_iterator<char>());
+    bytes = buffer.data();
+    length = buffer.size();
+#endif
+
+    return true;
+}
+
+uint64_t RomFile::hash() const {
+    return hash64(bytes, length);
+}
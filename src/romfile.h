@@ -0,0 +1,35 @@
+#ifndef ROMFILE_H
+#define ROMFILE_H
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A ROM image mapped read-only into memory. The size is checked before
+// anything is mapped, so an oversized file costs one stat. Where mmap is
+// not available the file is read into a buffer instead.
+class RomFile {
+    private:
+        const uint8_t* bytes;
+        size_t length;
+        void* mapping;
+        std::vector<uint8_t> buffer;
+
+        void close();
+
+    public:
+        RomFile();
+        ~RomFile();
+        RomFile(const RomFile&) = delete;
+        RomFile& operator=(const RomFile&) = delete;
+
+        // Map a ROM of at most max_size bytes, replacing any mapped before
+        bool open(const char* filepath, size_t max_size);
+
+        const uint8_t* data() const { return bytes; }
+        size_t size() const { return length; }
+
+        // Content hash used to look the ROM up in the ROM database
+        uint64_t hash() const;
+};
+
+#endif // ROMFILE_H
@@ -0,0 +1,49 @@
+#include <thread>
+
+#include "scheduler.h"
+
+const std::chrono::steady_clock::duration FRAME_PERIOD =
+    std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(1.0 / 60.0));
+
+// How far behind the scheduler may fall before it stops trying to catch up
+const int MAX_FRAMES_BEHIND = 4;
+
+Scheduler::Scheduler(int instructions_per_frame, bool paced)
+    : instructions_per_frame {instructions_per_frame}
+    , paced {paced}
+    , next_frame {Clock::now() + FRAME_PERIOD}
+{
+}
+
+void Scheduler::run_frame(Chip8& chip8) {
+    chip8.run(instructions_per_frame);
+    chip8.tick_timers();
+}
+
+void Scheduler::run_frame(Chip8& chip8, Profiler& profiler) {
+    for (int i = 0; i < instructions_per_frame && chip8.is_running; i++) {
+        profiler.cycle(chip8);
+        if (chip8.waiting_for_key) break;
+    }
+    chip8.tick_timers();
+}
+
+void Scheduler::wait_for_next_frame() {
+    if (!paced) return;
+
+    // Deadlines advance by exactly one period so rounding never drifts.
+    // After a long stall (window drag, debugger) resync instead of
+    // running a burst of frames.
+    Clock::time_point now = Clock::now();
+    if (now - next_frame > MAX_FRAMES_BEHIND * FRAME_PERIOD) {
+        next_frame = now;
+    }
+
+    std::this_thread::sleep_until(next_frame);
+    next_frame += FRAME_PERIOD;
+}
+
+void Scheduler::resync() {
+    next_frame = Clock::now() + FRAME_PERIOD;
+}
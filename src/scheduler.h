@@ -0,0 +1,40 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+#include <chrono>
+
+#include "chip8.h"
+#include "profiler.h"
+
+// Instructions executed per 60 Hz frame unless configured otherwise
+const int DEFAULT_INSTRUCTIONS_PER_FRAME = 10;
+
+// Paces emulation in 60 Hz frames: a fixed instruction budget per frame,
+// one timer tick per frame, and a sleep until the next frame is due
+class Scheduler {
+    private:
+        typedef std::chrono::steady_clock Clock;
+
+        int instructions_per_frame;
+        bool paced;
+        Clock::time_point next_frame;
+
+    public:
+        // With paced false frames run back to back (turbo, or vsync doing
+        // the pacing in SDL_RenderPresent)
+        Scheduler(int instructions_per_frame, bool paced);
+
+        // Execute one frame's instructions, then tick the timers. The frame
+        // ends early if the machine blocks waiting for a key.
+        void run_frame(Chip8& chip8);
+
+        // Same, recording every instruction in a profile
+        void run_frame(Chip8& chip8, Profiler& profiler);
+
+        // Sleep until the next frame is due
+        void wait_for_next_frame();
+
+        // Start timing afresh after emulation was suspended
+        void resync();
+};
+
+#endif // SCHEDULER_H
@@ -0,0 +1,79 @@
+#include <iostream>
+#include <SDL2/SDL.h>
+
+#include "speaker.h"
+
+// Frames held back before playing, so emulation jitter never starves the
+// device, and the most allowed before dropping the oldest to bound latency
+const size_t PRIME_FRAMES = 2;
+const size_t MAX_QUEUED_FRAMES = 6;
+
+struct Speaker {
+    AudioQueue* frames;
+    Tone tone;
+    AudioFrame current;
+    int remaining;      // Samples left of the current frame
+    bool primed;
+};
+
+SDL_AudioDeviceID device;
+Speaker speaker;
+
+// Runs on SDL's audio thread
+static void fill(void* userdata, Uint8* stream, int len) {
+    Speaker& out = *static_cast<Speaker*>(userdata);
+    int16_t* samples = reinterpret_cast<int16_t*>(stream);
+    int count = len / 2;
+
+    while (count > 0) {
+        if (out.remaining == 0) {
+            AudioQueue& frames = *out.frames;
+            if (!out.primed && frames.size() >= PRIME_FRAMES) out.primed = true;
+            while (frames.size() > MAX_QUEUED_FRAMES) frames.pop(out.current);
+
+            // Each frame covers exactly SAMPLES_PER_FRAME samples, so
+            // tones start and stop on the 60 Hz timer ticks
+            if (!out.primed || !frames.pop(out.current)) {
+                out.current.on = false;
+                out.primed = false;
+            }
+            out.remaining = SAMPLES_PER_FRAME;
+        }
+
+        int n = count < out.remaining ? count : out.remaining;
+        out.tone.render(out.current, samples, n);
+        samples += n;
+        count -= n;
+        out.remaining -= n;
+    }
+}
+
+bool setup_audio(AudioQueue& frames) {
+    speaker.frames = &frames;
+    speaker.current.on = false;
+    speaker.remaining = 0;
+    speaker.primed = false;
+
+    SDL_AudioSpec want {};
+    want.freq = AUDIO_RATE;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = 512;
+    want.callback = fill;
+    want.userdata = &speaker;
+
+    // SDL converts if the device wants another format
+    device = SDL_OpenAudioDevice(nullptr, 0, &want, nullptr, 0);
+    if (device == 0) {
+        std::cout << "Failed to open audio device. SDL_Error: "
+                  << SDL_GetError() << std::endl;
+        return false;
+    }
+    SDL_PauseAudioDevice(device, 0);
+    return true;
+}
+
+void close_audio() {
+    if (device != 0) SDL_CloseAudioDevice(device);
+    device = 0;
+}
@@ -0,0 +1,10 @@
+#ifndef SPEAKER_H
+#define SPEAKER_H
+#include "audio.h"
+
+// Play frames from the queue on the default audio device. The callback
+// never locks or waits: when the queue runs dry it plays silence.
+bool setup_audio(AudioQueue& frames);
+void close_audio();
+
+#endif // SPEAKER_H
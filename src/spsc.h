@@ -0,0 +1,59 @@
+#ifndef SPSC_H
+#define SPSC_H
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer
+// thread. Capacity must be a power of two.
+template <typename T, size_t Capacity>
+class SpscQueue {
+    static_assert((Capacity & (Capacity - 1)) == 0,
+                  "SpscQueue capacity must be a power of two");
+
+    private:
+        std::array<T, Capacity> slots;
+
+        // Free-running counters, each written by one side only and kept on
+        // separate cache lines
+        alignas(64) std::atomic<size_t> head;   // Next slot to pop
+        alignas(64) std::atomic<size_t> tail;   // Next slot to push
+
+    public:
+        SpscQueue() : head {0}, tail {0} {}
+
+        // Producer: fails if the queue is full
+        bool push(const T& value) {
+            size_t at = tail.load(std::memory_order_relaxed);
+            if (at - head.load(std::memory_order_acquire) == Capacity) {
+                return false;
+            }
+            slots[at & (Capacity - 1)] = value;
+            tail.store(at + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Consumer: copy the oldest entry without removing it
+        bool peek(T& value) const {
+            size_t at = head.load(std::memory_order_relaxed);
+            if (at == tail.load(std::memory_order_acquire)) return false;
+            value = slots[at & (Capacity - 1)];
+            return true;
+        }
+
+        // Entries queued; the other side may change it at any moment
+        size_t size() const {
+            return tail.load(std::memory_order_acquire)
+                 - head.load(std::memory_order_acquire);
+        }
+
+        // Consumer: remove the oldest entry
+        bool pop(T& value) {
+            if (!peek(value)) return false;
+            head.store(head.load(std::memory_order_relaxed) + 1,
+                       std::memory_order_release);
+            return true;
+        }
+};
+
+#endif // SPSC_H
@@ -0,0 +1,43 @@
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Lock-free triple buffer passing whole values from one producer thread to
+// one consumer thread. The producer always has a slot to write and the
+// consumer always reads a complete value, so neither side ever waits and
+// frames are never torn; values the consumer is too slow for are skipped.
+template <typename T>
+class TripleBuffer {
+    private:
+        // Set in middle while it holds a value the consumer has not taken
+        static const uint8_t FRESH = 4;
+
+        std::array<T, 3> slots;
+        std::atomic<uint8_t> middle;    // Slot index exchanged between sides
+        uint8_t back;                   // Producer's slot
+        uint8_t front;                  // Consumer's slot
+
+    public:
+        TripleBuffer() : middle {1}, back {0}, front {2} {}
+
+        // Producer: the slot to fill, then publish it
+        T& write_buffer() { return slots[back]; }
+        void publish() {
+            back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & 3;
+        }
+
+        // Consumer: switch to the newest published value. Returns false if
+        // nothing was published since the last call.
+        bool update() {
+            if ((middle.load(std::memory_order_relaxed) & FRESH) == 0) {
+                return false;
+            }
+            front = middle.exchange(front, std::memory_order_acq_rel) & 3;
+            return true;
+        }
+        const T& read_buffer() const { return slots[front]; }
+};
+
+#endif // TRIPLEBUFFER_H